@@ -0,0 +1,286 @@
+
+/* filter_sse2_intrinsics.c - SSE2 and SSSE3 optimised filter functions
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ */
+
+#include "../pngpriv.h"
+
+#ifdef PNG_READ_SUPPORTED
+
+#if PNG_INTEL_SSE_OPT > 0
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#  define PNG_SSSE3_TARGET __attribute__((target("ssse3")))
+#else
+#  define PNG_SSSE3_TARGET
+#endif
+
+/* Functions in this file look at most 3 pixels (a,b,c) to predict the 4th (d).
+ * They're positioned like this:
+ *    prev:  c b
+ *    row:   a d
+ * The Sub filter predicts d=a, Avg d=(a+b)/2, and Paeth predicts d to be
+ * whichever of a, b, or c is closest to p=a+b-c.
+ *
+ * Pixels are processed one at a time, since every pixel depends on the one to
+ * its left, but all 3 or 4 bytes of a pixel are handled together.  Loads and
+ * stores go through memcpy to avoid unaligned access and aliasing problems.
+ */
+
+static __m128i load4(const void* p)
+{
+   int tmp;
+   memcpy(&tmp, p, sizeof(tmp));
+   return _mm_cvtsi32_si128(tmp);
+}
+
+static void store4(void* p, __m128i v)
+{
+   int tmp = _mm_cvtsi128_si32(v);
+   memcpy(p, &tmp, sizeof(int));
+}
+
+static __m128i load3(const void* p)
+{
+   png_uint_32 tmp = 0;
+   memcpy(&tmp, p, 3);
+   return _mm_cvtsi32_si128((int)tmp);
+}
+
+static void store3(void* p, __m128i v)
+{
+   int tmp = _mm_cvtsi128_si32(v);
+   memcpy(p, &tmp, 3);
+}
+
+void png_read_filter_row_sub3_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+{
+   /* The Sub filter predicts each pixel as the previous pixel, a.
+    * There is no pixel to the left of the first pixel.  It's encoded directly.
+    * That works with our main loop if we just say that left pixel was zero.
+    */
+   png_size_t rb = row_info->rowbytes;
+
+   __m128i a, d = _mm_setzero_si128();
+
+   /* load4 may read the first byte of the next pixel, but only while there is
+    * one, the last pixel is loaded with load3.
+    */
+   while (rb >= 4)
+   {
+      a = d; d = load4(row);
+      d = _mm_add_epi8(d, a);
+      store3(row, d);
+
+      row += 3;
+      rb  -= 3;
+   }
+   if (rb > 0)
+   {
+      a = d; d = load3(row);
+      d = _mm_add_epi8(d, a);
+      store3(row, d);
+   }
+
+   PNG_UNUSED(prev)
+}
+
+void png_read_filter_row_sub4_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+{
+   png_size_t rb = row_info->rowbytes;
+
+   __m128i a, d = _mm_setzero_si128();
+
+   while (rb > 0)
+   {
+      a = d; d = load4(row);
+      d = _mm_add_epi8(d, a);
+      store4(row, d);
+
+      row += 4;
+      rb  -= 4;
+   }
+
+   PNG_UNUSED(prev)
+}
+
+/* PNG requires a truncating average, _mm_avg_epu8 rounds up.  Subtracting the
+ * lowest bit of a^b undoes the rounding.
+ */
+static __m128i avg_truncated(__m128i a, __m128i b)
+{
+   __m128i avg = _mm_avg_epu8(a, b);
+   return _mm_sub_epi8(avg, _mm_and_si128(_mm_xor_si128(a, b),
+      _mm_set1_epi8(1)));
+}
+
+void png_read_filter_row_avg3_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+{
+   /* The Avg filter predicts each pixel as the (truncated) average of a and b.
+    * There's no pixel to the left of the first pixel.  Luckily, it's
+    * predicted to be half of the pixel above it.  So again, this works
+    * perfectly with our loop if we make sure a starts at zero.
+    */
+   png_size_t rb = row_info->rowbytes;
+
+   __m128i b;
+   __m128i a, d = _mm_setzero_si128();
+
+   while (rb >= 4)
+   {
+      b = load4(prev);
+      a = d; d = load4(row);
+      d = _mm_add_epi8(d, avg_truncated(a, b));
+      store3(row, d);
+
+      prev += 3;
+      row  += 3;
+      rb   -= 3;
+   }
+   if (rb > 0)
+   {
+      b = load3(prev);
+      a = d; d = load3(row);
+      d = _mm_add_epi8(d, avg_truncated(a, b));
+      store3(row, d);
+   }
+}
+
+void png_read_filter_row_avg4_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+{
+   png_size_t rb = row_info->rowbytes;
+
+   __m128i b;
+   __m128i a, d = _mm_setzero_si128();
+
+   while (rb > 0)
+   {
+      b = load4(prev);
+      a = d; d = load4(row);
+      d = _mm_add_epi8(d, avg_truncated(a, b));
+      store4(row, d);
+
+      prev += 4;
+      row  += 4;
+      rb   -= 4;
+   }
+}
+
+/* Returns |x| for 16-bit lanes. */
+static __m128i abs_i16_sse2(__m128i x)
+{
+   /* Negation is flipping the bits and adding one, the comparison gives -1
+    * for negative lanes, so (x ^ -1) - (-1) == -x, and x for the others.
+    */
+   __m128i is_negative = _mm_cmplt_epi16(x, _mm_setzero_si128());
+
+   x = _mm_xor_si128(x, is_negative);
+   x = _mm_sub_epi16(x, is_negative);
+   return x;
+}
+
+PNG_SSSE3_TARGET
+static __m128i abs_i16_ssse3(__m128i x)
+{
+   return _mm_abs_epi16(x);
+}
+
+/* Bytewise c ? t : e. */
+static __m128i if_then_else(__m128i c, __m128i t, __m128i e)
+{
+   return _mm_or_si128(_mm_and_si128(c, t), _mm_andnot_si128(c, e));
+}
+
+/* The Paeth filter is computed on 16-bit lanes, a+b-c does not fit in 8 bits.
+ * The loop is shared by the SSE2 and SSSE3 versions, which only differ in how
+ * they take absolute values.  The row bytes of the last pixel are loaded with
+ * LOAD_LAST, which may differ from LOAD for 3-byte pixels.
+ */
+#define PNG_PAETH_LOOP(BPP, LOAD, LOAD_LAST, STORE, ABS)                      \
+   {                                                                          \
+      png_size_t rb = row_info->rowbytes;                                     \
+                                                                              \
+      const __m128i zero = _mm_setzero_si128();                               \
+                                                                              \
+      /* Like for Sub and Avg, a and c start at zero, which is what the       \
+       * first pixel is predicted from.                                       \
+       */                                                                     \
+      __m128i c, b = zero,                                                    \
+              a, d = zero;                                                    \
+                                                                              \
+      while (rb > 0)                                                          \
+      {                                                                       \
+         /* It's easiest to do this math (particularly, deal with pc) with    \
+          * 16-bit intermediates.                                             \
+          */                                                                  \
+         __m128i pa, pb, pc, smallest, nearest;                               \
+         int is_last = rb <= BPP;                                             \
+                                                                              \
+         c = b; b = _mm_unpacklo_epi8(is_last ? LOAD_LAST(prev) : LOAD(prev), \
+            zero);                                                            \
+         a = d; d = _mm_unpacklo_epi8(is_last ? LOAD_LAST(row) : LOAD(row),   \
+            zero);                                                            \
+                                                                              \
+         /* (p-a) == (a+b-c - a) == (b-c) */                                  \
+         pa = _mm_sub_epi16(b, c);                                            \
+                                                                              \
+         /* (p-b) == (a+b-c - b) == (a-c) */                                  \
+         pb = _mm_sub_epi16(a, c);                                            \
+                                                                              \
+         /* (p-c) == (a+b-c - c) == (a+b-c-c) == (b-c)+(a-c) */               \
+         pc = _mm_add_epi16(pa, pb);                                          \
+                                                                              \
+         pa = ABS(pa);                                                        \
+         pb = ABS(pb);                                                        \
+         pc = ABS(pc);                                                        \
+                                                                              \
+         smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));                 \
+                                                                              \
+         /* Paeth breaks ties favoring a over b over c. */                    \
+         nearest = if_then_else(_mm_cmpeq_epi16(smallest, pa), a,             \
+                   if_then_else(_mm_cmpeq_epi16(smallest, pb), b,             \
+                                                               c));           \
+                                                                              \
+         /* Note `_epi8`: we need addition to wrap modulo 256. */             \
+         d = _mm_add_epi8(d, nearest);                                        \
+         STORE(row, _mm_packus_epi16(d, d));                                  \
+                                                                              \
+         if (is_last)                                                         \
+            break;                                                            \
+                                                                              \
+         prev += BPP;                                                         \
+         row  += BPP;                                                         \
+         rb   -= BPP;                                                         \
+      }                                                                       \
+   }
+
+void png_read_filter_row_paeth3_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+PNG_PAETH_LOOP(3, load4, load3, store3, abs_i16_sse2)
+
+void png_read_filter_row_paeth4_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+PNG_PAETH_LOOP(4, load4, load4, store4, abs_i16_sse2)
+
+PNG_SSSE3_TARGET
+void png_read_filter_row_paeth3_ssse3(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+PNG_PAETH_LOOP(3, load4, load3, store3, abs_i16_ssse3)
+
+PNG_SSSE3_TARGET
+void png_read_filter_row_paeth4_ssse3(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev)
+PNG_PAETH_LOOP(4, load4, load4, store4, abs_i16_ssse3)
+
+#endif /* PNG_INTEL_SSE_OPT > 0 */
+#endif /* READ */
@@ -0,0 +1,92 @@
+
+/* intel_init.c - SSE2 and SSSE3 optimised filter functions
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ */
+
+#include "../pngpriv.h"
+
+#ifdef PNG_READ_SUPPORTED
+#if PNG_INTEL_SSE_OPT > 0
+
+#include <signal.h> /* for sig_atomic_t */
+
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#endif
+
+/* Checks CPUID leaf 1 for SSE2 (EDX bit 26) and SSSE3 (ECX bit 9). */
+static int
+png_have_sse2(void)
+{
+#if defined(__GNUC__) || defined(__clang__)
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("sse2");
+#elif defined(_MSC_VER)
+   int info[4];
+
+   __cpuid(info, 1);
+   return (info[3] & (1 << 26)) != 0;
+#else
+   return 1; /* The compiler targets SSE2, see PNG_INTEL_SSE_OPT */
+#endif
+}
+
+static int
+png_have_ssse3(void)
+{
+#if defined(__GNUC__) || defined(__clang__)
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("ssse3");
+#elif defined(_MSC_VER)
+   int info[4];
+
+   __cpuid(info, 1);
+   return (info[2] & (1 << 9)) != 0;
+#else
+   return 0;
+#endif
+}
+
+void
+png_init_filter_functions_sse2(png_structp pp, unsigned int bpp)
+{
+   /* The CPU features do not change, check them once per process. */
+   static volatile sig_atomic_t has_sse2 = -1, has_ssse3 = -1;
+
+   if (has_sse2 < 0)
+      has_sse2 = png_have_sse2();
+
+   if (has_ssse3 < 0)
+      has_ssse3 = png_have_ssse3();
+
+   if (!has_sse2)
+      return;
+
+#ifdef PNG_SET_OPTION_SUPPORTED
+   if (((pp->options >> PNG_INTEL_SSE) & 3) == PNG_OPTION_OFF)
+      return;
+#endif
+
+   /* Only the 3 and 4 byte pixels of 8-bit RGB and RGBA images are handled.
+    * The Up filter has no dependency between bytes and stays generic.
+    */
+   if (bpp == 3)
+   {
+      pp->read_filter[PNG_FILTER_VALUE_SUB-1] = png_read_filter_row_sub3_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_AVG-1] = png_read_filter_row_avg3_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_PAETH-1] = has_ssse3 ?
+         png_read_filter_row_paeth3_ssse3 : png_read_filter_row_paeth3_sse2;
+   }
+   else if (bpp == 4)
+   {
+      pp->read_filter[PNG_FILTER_VALUE_SUB-1] = png_read_filter_row_sub4_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_AVG-1] = png_read_filter_row_avg4_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_PAETH-1] = has_ssse3 ?
+         png_read_filter_row_paeth4_ssse3 : png_read_filter_row_paeth4_sse2;
+   }
+}
+#endif /* PNG_INTEL_SSE_OPT > 0 */
+#endif /* READ */
@@ -10,7 +10,11 @@
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#define _USE_MATH_DEFINES /* M_PI on MSVC */
 #include <math.h>
+#include <float.h>
+#include <limits.h>
+#include <ctype.h>
 
 #include "ips_utils.h"
 
@@ -31,9 +35,33 @@
 
 #include <pthread.h>
 
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+    #define IPS_SSE2 1
+    #include <emmintrin.h>
+#endif
+
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+    #define IPS_AVX2 1
+    #define IPS_SSSE3 1
+    #define IPS_TARGET_AVX2 __attribute__((target("avx2")))
+    #define IPS_TARGET_SSSE3 __attribute__((target("ssse3")))
+    #include <immintrin.h>
+#elif defined _MSC_VER && defined _M_X64
+    #define IPS_AVX2 1
+    #define IPS_SSSE3 1
+    #define IPS_TARGET_AVX2
+    #define IPS_TARGET_SSSE3
+    #include <immintrin.h>
+#endif
+
 #pragma mark - Constants
 
+#ifndef M_PI
+    #define M_PI 3.14159265358979323846
+#endif
+
 #define IPS_WINDOW_TITLE_LENGTH 1024
+#define IPS_MAXIMUM_BATCH_FILTERS 16
 static const char *Window_Title = "IPS";
 
 static const int Initial_Window_Width  = 1280,
@@ -50,12 +78,57 @@ static const GLint First_Texture_Unit  = 0;
 static const char *Vertex_Shader_Path   = "ips_shader.glsl.vs",
                   *Fragment_Shader_Path = "ips_shader.glsl.fs";
 
+static const png_uint_32 Default_Tile_Width  = 64,
+                         Default_Tile_Height = 64;
+
+static const size_t Task_Pool_Capacity = 4096;
+static const int Task_Deque_Capacity = 1024;
+static const unsigned int Steal_Attempts_Before_Sleeping = 4;
+static const size_t Task_Arena_Initial_Block_Capacity = 1024;
+
+/* Tasks pushed through the queue by --stress-queue, producers wait for every batch but their last */
+static const size_t Queue_Stress_Tasks = 4000000,
+                    Queue_Stress_Batch = 1024;
+
+/* Tiles filtered at a time while the view is idle, the rest waits if it moves */
+static const size_t Preview_Refinement_Tiles = 64;
+
+/* Uncompressed bytes per independently deflated band of a PNG */
+static const size_t Png_Band_Size = 128 * 1024;
+
+/* Picks the filter type per row instead of using one for the whole image */
+static const int Png_Adaptive_Filter = -1;
+
+/* Frames timed per measurement of --benchmark after a warm-up one, and the pool sizes it compares */
+static const unsigned int Benchmark_Iterations = 5;
+static const int Benchmark_Thread_Counts[] = {
+    4, 16, 64
+};
+static const char *Scheduler_Names[] = {
+    "central", "stealing"
+};
+static const char *Simd_Level_Names[] = {
+    "none", "sse2", "ssse3", "avx2"
+};
+
 static const float Initial_Camera_Zoom = 0.8f,
                    Camera_Speed = 0.01f,
                    Camera_Minimum_Zoom = 0.01f;
 
+static const float Brightness_Step = 10.0f,
+                   Contrast_Step   = 0.1f;
+
 #pragma mark - Data Types
 
+typedef enum ips_layout
+{
+    /* Samples of a pixel next to each other, as in PNG files and textures */
+    IPS_LAYOUT_INTERLEAVED,
+
+    /* One plane per channel, every plane is laid out like a one-channel image */
+    IPS_LAYOUT_PLANAR
+} ips_layout_t;
+
 typedef struct ips_raw_image
 {
     png_bytep data;
@@ -63,29 +136,604 @@ typedef struct ips_raw_image
     png_uint_32 width,
                 height;
 	unsigned int channels;
+
+    /* Bytes from the start of one row to the next */
+    size_t stride;
+
+    /*
+        Pixels of replicated border on every side. rows[-apron] through
+        rows[height + apron - 1] are valid, so are `apron` pixels to the
+        left and to the right of every row.
+    */
+    unsigned int apron;
+
+    /*
+        Sample `channel` of pixel x in row y is at
+        rows[y][x * pixel_step + channel * channel_step], the rows of planar
+        images point into the first plane.
+    */
+    ips_layout_t layout;
+    size_t pixel_step,
+           channel_step;
 } ips_raw_image_t;
 
+/*
+    Rows start on 64-byte boundaries and are followed by at least 64 bytes
+    of slack, so vector loads may run past the last pixel of a row.
+*/
+#define IPS_ROW_ALIGNMENT 64
+#define IPS_ROW_SLACK 64
+
+/*
+    One flag per tile of an image for the tiles that have to be computed
+    again. The tile size is fixed when the map is created.
+*/
+typedef struct ips_dirty_tiles
+{
+    png_uint_32 image_width, image_height;
+    png_uint_32 tile_width, tile_height;
+    png_uint_32 columns, rows;
+
+    unsigned char *flags;
+    unsigned char *previous_flags; /* Scratch for dilation */
+    size_t number_of_dirty_tiles;
+} ips_dirty_tiles_t;
+
+/* Part of the world the camera shows, in the units of the quad */
+typedef struct ips_view
+{
+    float x0, y0,
+          x1, y1;
+
+    /* Window pixels per world unit, the quad is two units wide */
+    float pixels_per_unit;
+} ips_view_t;
+
+/* Levels down to 1x1 of an image of up to 65536 pixels on a side */
+#define IPS_MAXIMUM_LEVELS 17
+
+/*
+    An image halved with a 2x2 box down to 1x1, e.g., for mip levels.
+    levels[0] is the image itself and is not owned, the other levels have
+    its layout and are views of a single block of memory. Sizes follow
+    OpenGL, every level is max(1, floor(size / 2)) of the one above.
+*/
+typedef struct ips_pyramid
+{
+    png_bytep data;
+    ips_raw_image_t *levels[IPS_MAXIMUM_LEVELS];
+    unsigned int number_of_levels;
+} ips_pyramid_t;
+
+/*
+    State of the preview mode of the compute thread. Filters run on the
+    level of a pyramid of the source that matches the density of the
+    screen, and only on the tiles of it that are on screen, until the view
+    is idle and the view is refined one level at a time, then the rest of
+    the source.
+*/
+typedef struct ips_preview
+{
+    /* Of the source the filters read, its first level follows every load */
+    ips_pyramid_t *pyramid;
+
+    /* Level of the latest frame and its tiles filtered with the current parameters */
+    unsigned int level;
+    ips_dirty_tiles_t *filtered_tiles;
+
+    /* Tiles filtered by the step in progress */
+    ips_dirty_tiles_t *tiles;
+
+    /* Filter output before it is interleaved into a frame, with --planar only */
+    ips_raw_image_t *output_image;
+} ips_preview_t;
+
+/*
+    Output of the interactive filters in one slot of the triple buffer.
+    Frames are only handed over whole, so a slot that missed some frames
+    catches up on their tiles from the latest one before it is written.
+*/
+typedef struct ips_frame
+{
+    ips_raw_image_t *image;
+
+    /* Mip levels of the image, the compute thread updates them with it */
+    ips_pyramid_t *pyramid;
+
+    /* Tiles older than in the latest frame, only used by the compute thread */
+    ips_dirty_tiles_t *stale_tiles;
+
+    /* Tiles that changed since the frame the render thread uploaded last */
+    ips_dirty_tiles_t *changed_tiles;
+
+    /*
+        Pixel buffer the image is written into through a persistent mapping,
+        0 if the image lives in client memory. The render thread creates it
+        when the compute thread asks and updates the texture from it.
+    */
+    GLuint pixel_buffer;
+    png_bytep pixel_buffer_data;
+    GLsync upload_fence; /* Signalled when the texture no longer reads the buffer */
+} ips_frame_t;
+
+#define IPS_NUMBER_OF_FRAMES 3
+
+/*
+    Runs the filters of the interactive mode on its own thread. The compute
+    thread writes the back frame, the latest finished one waits as the ready
+    frame, and the render thread uploads the front frame. Finishing a frame
+    and taking the latest one only swap two of them, so neither side ever
+    waits for the other.
+*/
+typedef struct ips_compute_coordinator
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t request_available;
+
+    /* Requests of the render thread */
+    int should_stop;
+    int should_process_image;
+    SDL_atomic_t requested_generation; /* Bumped without waiting for the frame in progress */
+    int should_reload_image;
+    char *image_path; /* Image to load next, freed with SDL_free */
+    size_t filter_index;
+    float brightness_contrast[2];
+    unsigned int median_radius;
+
+    /* Requested with --preview, view changes only cancel the refinement off screen */
+    ips_view_t view;
+    int has_new_view;
+    int is_refining;
+
+    ips_frame_t frames[IPS_NUMBER_OF_FRAMES];
+    ips_frame_t *back_frame,
+                *ready_frame,
+                *front_frame;
+    int has_new_frame;
+    double filter_milliseconds; /* Time the compute thread took for the ready frame */
+    unsigned long number_of_task_allocations; /* Arena allocations the ready frame needed */
+
+    /* The three frames are the ring of pixel buffers if the context has them */
+    int has_pixel_buffers;
+    ips_frame_t *pixel_buffer_frame; /* Back frame waiting for a pixel buffer */
+    size_t pixel_buffer_size;
+
+    /* SDL event pushed to wake the render thread up when a frame is ready */
+    Uint32 frame_event_type;
+} ips_compute_coordinator_t;
+
+#define IPS_MAXIMUM_CHANNELS 4
+#define IPS_HISTOGRAM_SIZE 256
+
+/* Reductions a filter pass can declare */
+enum
+{
+    IPS_REDUCTION_NONE            = 0,
+    IPS_REDUCTION_MINIMUM_MAXIMUM = 1 << 0,
+    IPS_REDUCTION_HISTOGRAM       = 1 << 1,
+    IPS_REDUCTION_SUM             = 1 << 2,
+    IPS_REDUCTION_SUM_OF_SQUARES  = 1 << 3
+};
+
+/*
+    Per-channel statistics of a pass. Every worker accumulates its own
+    partial copy which is merged once the pass is over.
+*/
+typedef struct ips_reduction
+{
+    float minimum[IPS_MAXIMUM_CHANNELS],
+          maximum[IPS_MAXIMUM_CHANNELS];
+    double sum[IPS_MAXIMUM_CHANNELS],
+           sum_of_squares[IPS_MAXIMUM_CHANNELS];
+    Uint64 histogram[IPS_MAXIMUM_CHANNELS][IPS_HISTOGRAM_SIZE];
+} ips_reduction_t;
+
+#define IPS_MAXIMUM_PASSES 4
+#define IPS_MAXIMUM_INTERMEDIATE_IMAGES 2
+
 typedef struct ips_task
 {
     ips_raw_image_t *input_image;
     ips_raw_image_t *output_image;
-    png_uint_32 row_index_to_process;
-    png_uint_32 last_row_index_to_process;
+
+    /* Buffers that carry results from one pass of a filter to the next */
+    ips_raw_image_t **intermediate_images;
+
+    /* Half-open tile rectangle [x0, x1) x [y0, y1) to process */
+    png_uint_32 x0, y0,
+                x1, y1;
+
     void *image_processing_parameters;
     void (*image_processing_function)(struct ips_task *task);
 
     unsigned int pass;
 
-    struct ips_task *next_task;
+    /* Merged reductions of the previous passes */
+    const ips_reduction_t *pass_reduction;
+
+    /* Partial reduction of the worker running the task */
+    ips_reduction_t *reduction;
+
+    /* Worker running the task, owns the scratch memory of the task */
+    struct ips_worker *worker;
+
+    /* Group the task is waited for with */
+    struct ips_task_group *group;
+
+    /* Frame generation of the group when the task was published */
+    unsigned int generation;
 } ips_task_t;
 
+typedef enum ips_simd_level
+{
+    IPS_SIMD_NONE,
+    IPS_SIMD_SSE2,
+    IPS_SIMD_SSSE3,
+    IPS_SIMD_AVX2
+} ips_simd_level_t;
+
+typedef struct ips_sobel_parameters
+{
+    /* Writes the gradient angle mapped to [0, 255] instead of the magnitude, set by --sobel-direction */
+    int should_compute_direction;
+} ips_sobel_parameters_t;
+
+/* Largest median radius, keeps the window population within Uint16 */
+#define IPS_MAXIMUM_MEDIAN_RADIUS 100
+
+typedef struct ips_median_parameters
+{
+    unsigned int radius;
+} ips_median_parameters_t;
+
+/*
+    Two-level histogram of the Perreault-Hebert median. The coarse level
+    counts the values by their upper four bits to find the fine segment
+    of 16 bins holding the median quickly.
+*/
+typedef struct ips_median_histogram
+{
+    Uint16 coarse[16];
+    Uint16 fine[256];
+} ips_median_histogram_t;
+
+/*
+    Histogram of the window of the Perreault-Hebert median. Only the coarse
+    level moves with every pixel. A fine segment is brought up to date when
+    the median falls into it, from the window it was last updated for.
+*/
+typedef struct ips_median_window
+{
+    ips_median_histogram_t histogram;
+
+    /* Column of the window every fine segment is up to date for, -1 if none */
+    long segment_columns[16];
+} ips_median_window_t;
+
+typedef enum ips_tiling
+{
+    IPS_TILING_TILES,
+
+    /* Full-height columns of tile_width pixels or two windows of the pass */
+    IPS_TILING_VERTICAL_STRIPS
+} ips_tiling_t;
+
+typedef struct ips_filter_pass
+{
+    void (*image_processing_function)(ips_task_t *task);
+
+    /* Reductions computed by the pass for the passes that follow */
+    unsigned int reductions;
+
+    ips_tiling_t tiling;
+
+    /*
+        Rows and columns around a tile the pass reads from its input, NULL
+        for passes that only read the pixels of the tile
+    */
+    unsigned int (*get_radius)(const void *image_processing_parameters);
+} ips_filter_pass_t;
+
+/*
+    A filter runs its passes one after another with a barrier in between.
+    Intermediate images have the size of the input and the given number of
+    channels, or the channels of the input if it is zero.
+*/
+typedef struct ips_filter
+{
+    const char *name;
+
+    unsigned int number_of_passes;
+    ips_filter_pass_t passes[IPS_MAXIMUM_PASSES];
+
+    unsigned int number_of_intermediate_images;
+    unsigned int intermediate_image_channels;
+
+    void *image_processing_parameters;
+} ips_filter_t;
+
+/*
+    Task descriptors are carved out of arena blocks that are kept between
+    frames, so the steady-state frame loop does not touch the heap.
+*/
+typedef struct ips_task_arena_block
+{
+    ips_task_t *tasks;
+    size_t capacity;
+    size_t size;
+
+    struct ips_task_arena_block *next_block;
+} ips_task_arena_block_t;
+
+typedef struct ips_task_arena
+{
+    ips_task_arena_block_t *first_block;
+    ips_task_arena_block_t *current_block;
+
+    /* Heap allocations made by the arena since its creation */
+    unsigned long number_of_allocations;
+} ips_task_arena_t;
+
+typedef enum ips_scheduler
+{
+    IPS_SCHEDULER_CENTRAL_QUEUE,
+    IPS_SCHEDULER_WORK_STEALING
+} ips_scheduler_t;
+
+#define IPS_CACHE_LINE_SIZE 64
+
+/*
+    Chase-Lev work-stealing deque with a fixed power-of-two capacity. Only
+    the owner pushes and pops at the bottom, other workers steal from the
+    top.
+*/
+typedef struct ips_task_deque
+{
+    SDL_atomic_t top;
+    char top_padding[IPS_CACHE_LINE_SIZE - sizeof(SDL_atomic_t)];
+
+    SDL_atomic_t bottom;
+    char bottom_padding[IPS_CACHE_LINE_SIZE - sizeof(SDL_atomic_t)];
+
+    ips_task_t **tasks;
+    int capacity;
+} ips_task_deque_t;
+
+typedef struct ips_worker
+{
+    struct ips_task_pool *pool;
+    unsigned int index;
+    unsigned int random_state;
+
+    ips_task_deque_t deque;
+
+    /* Per-worker memory reused by the tasks that need a work area */
+    void *scratch;
+    size_t scratch_size;
+
+    /* Keeps the next worker off this cache line */
+    char padding[IPS_CACHE_LINE_SIZE];
+} ips_worker_t;
+
+/* Bounded multi-producer/multi-consumer ring of task pointers. */
 typedef struct ips_task_pool
 {
-    ips_task_t *first_task;
-    ips_task_t *last_task;
+    ips_task_t **tasks;
+    size_t capacity;
+    size_t first_task_index;
     size_t size;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t tasks_available;
+    pthread_cond_t space_available;
+
+    pthread_t *threads;
+    int is_shut_down;
+
+    ips_scheduler_t scheduler;
+    ips_worker_t *workers;
+    unsigned int number_of_workers;
+
+    /*
+        Tasks in the deques of the workers. Workers only sleep while it is
+        zero, and refilling a deque wakes sleepers up to steal from it.
+    */
+    SDL_atomic_t number_of_stealable_tasks;
+    unsigned int number_of_sleeping_workers; /* Guarded by the mutex */
 } ips_task_pool_t;
 
+typedef struct ips_worker_reduction
+{
+    ips_reduction_t reduction;
+
+    /* Keeps the reduction of the next worker off this cache line */
+    char padding[IPS_CACHE_LINE_SIZE];
+} ips_worker_reduction_t;
+
+/*
+    Tasks that are published and waited for together, e.g., the tiles of a
+    frame or the bands of a PNG. Every group has its own arena, reductions
+    and intermediate images, so several images can share the pool.
+*/
+typedef struct ips_task_group
+{
+    ips_task_pool_t *pool;
+    ips_task_arena_t *task_arena;
+
+    /* Tasks published, but not yet finished, guarded by the pool mutex */
+    size_t number_of_unfinished_tasks;
+    pthread_cond_t tasks_finished;
+
+    /* Partial reductions of the workers and the merged reductions of a pass */
+    ips_worker_reduction_t *worker_reductions;
+    ips_reduction_t pass_reduction;
+
+    ips_raw_image_t *intermediate_images[IPS_MAXIMUM_INTERMEDIATE_IMAGES];
+
+    /*
+        Generation given to the tasks published next. If requested_generation
+        is set, tasks of an older generation than the one it holds are
+        dropped by the workers, and filters stop at the next pass.
+    */
+    unsigned int generation;
+    SDL_atomic_t *requested_generation;
+} ips_task_group_t;
+
+/* Decoder state of a PNG that is read row by row */
+typedef struct ips_png_reader
+{
+    /* The input is either mapped into memory or read through stdio */
+    FILE *file;
+
+    png_bytep mapped_data;
+    size_t mapped_size;
+    size_t mapped_offset;
+
+    png_structp png_struct;
+    png_infop png_info;
+
+    ips_raw_image_t *image;
+
+    /* Rows decoded so far, counted from the top */
+    png_uint_32 number_of_decoded_rows;
+} ips_png_reader_t;
+
+/* Output of one band of a PNG compressed on the task pool */
+typedef struct ips_png_band
+{
+    /* Raw deflate stream of the filtered rows */
+    png_bytep data;
+    size_t size;
+
+    /* Adler-32 and size of the filtered rows before compression */
+    uLong adler;
+    uLong length;
+
+    int status;
+} ips_png_band_t;
+
+typedef struct ips_png_encoder
+{
+    ips_raw_image_t *image;
+    int compression_level;
+
+    /* PNG filter type of every row or Png_Adaptive_Filter */
+    int filter_type;
+
+    png_uint_32 rows_per_band;
+    size_t number_of_bands;
+    ips_png_band_t *bands;
+} ips_png_encoder_t;
+
+/* Image in flight between the stages of the batch pipeline */
+typedef struct ips_batch_item
+{
+    /* Position of the image in the input list */
+    size_t index;
+
+    ips_raw_image_t *image;
+} ips_batch_item_t;
+
+/*
+    Bounded queue between two stages of the batch pipeline. Producers block
+    while it is full, which caps the number of images held in memory.
+*/
+typedef struct ips_batch_queue
+{
+    ips_batch_item_t *items;
+    size_t capacity;
+    size_t first_item_index;
+    size_t size;
+
+    /* The queue is closed once every producer has left */
+    unsigned int number_of_producers;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t items_available;
+    pthread_cond_t space_available;
+} ips_batch_queue_t;
+
+typedef enum ips_batch_stage
+{
+    IPS_BATCH_STAGE_DECODE,
+    IPS_BATCH_STAGE_FILTER,
+    IPS_BATCH_STAGE_ENCODE,
+    IPS_NUMBER_OF_BATCH_STAGES
+} ips_batch_stage_t;
+
+typedef struct ips_batch_pipeline
+{
+    char **input_image_file_paths;
+    char **output_image_file_paths;
+    size_t number_of_images;
+
+    /* Index of the next input to decode, shared by the decoders */
+    SDL_atomic_t next_image_index;
+    SDL_atomic_t number_of_failures;
+
+    const ips_filter_t **filters;
+    size_t number_of_filters;
+
+    ips_batch_queue_t decoded_images,
+                      filtered_images;
+} ips_batch_pipeline_t;
+
+typedef struct ips_batch_thread
+{
+    ips_batch_pipeline_t *pipeline;
+    ips_batch_stage_t stage;
+    pthread_t thread;
+
+    /* Time spent on images rather than waiting on the queues */
+    Uint64 busy_ticks;
+    size_t number_of_images;
+} ips_batch_thread_t;
+
+/* Requests a new generation after a delay, to time how fast a frame is cancelled */
+typedef struct ips_cancellation_timer
+{
+    SDL_atomic_t *requested_generation;
+    Uint32 delay; /* Milliseconds */
+
+    /* Performance counter at the time of the request */
+    Uint64 request_time;
+} ips_cancellation_timer_t;
+
+/* Images of --benchmark and the settings every part of it restores after a sweep */
+typedef struct ips_benchmark
+{
+    ips_raw_image_t *input_image,
+                    *output_image;
+    double megapixels;
+
+    png_uint_32 tile_width, tile_height;
+    int number_of_threads;
+    ips_scheduler_t scheduler;
+    ips_simd_level_t simd_level; /* Also the highest level the SIMD sweeps reach */
+    unsigned int median_radius;
+    int should_map_input_files;
+} ips_benchmark_t;
+
+/* A producer or a consumer of the task queue stress test */
+typedef struct ips_queue_stress_thread
+{
+    ips_task_pool_t *pool;
+    pthread_t thread;
+
+    /* Producers push tasks first_task_id onwards, each counts its runs in run_counts */
+    ips_task_group_t *group;
+    SDL_atomic_t *run_counts;
+    size_t first_task_id,
+           number_of_tasks;
+
+    /* Consumers take batches with ips_pop_tasks like the stealing workers */
+    int should_pop_batches;
+
+    size_t number_of_pushed_tasks,
+           number_of_popped_tasks;
+} ips_queue_stress_thread_t;
+
 #pragma mark - Function Prototypes
 
 void ips_init_gl_window(void);
@@ -100,20 +748,153 @@ void ips_delete_shader_program(GLuint shader_program);
 
 GLuint ips_generate_quad_geometry(void);
 
+ips_raw_image_t *ips_create_image(png_uint_32 width, png_uint_32 height, unsigned int channels);
+ips_raw_image_t *ips_create_image_with_apron(png_uint_32 width, png_uint_32 height,
+                                             unsigned int channels, unsigned int apron);
+ips_raw_image_t *ips_create_image_with_layout(png_uint_32 width, png_uint_32 height,
+                                              unsigned int channels, unsigned int apron,
+                                              ips_layout_t layout);
+ips_raw_image_t *ips_create_image_header(png_uint_32 width, png_uint_32 height, unsigned int channels,
+                                         unsigned int apron, ips_layout_t layout);
+void ips_set_image_data(ips_raw_image_t *image, png_bytep data);
+size_t ips_get_image_data_size(ips_raw_image_t *image);
+void ips_delete_image_view(ips_raw_image_t *view);
+void ips_replicate_image_apron(ips_raw_image_t *image);
+void ips_read_mapped_png_data(png_structp png_struct, png_bytep data, png_size_t length);
+ips_png_reader_t *ips_open_png_reader(const char *png_file_path);
+int ips_read_png_rows(ips_png_reader_t *reader, png_uint_32 number_of_rows);
+void ips_close_png_reader(ips_png_reader_t *reader);
 ips_raw_image_t *ips_load_image_from_png_file(char *png_file_path);
+int ips_decode_png_into_image(png_bytep png_data, size_t png_size, int should_use_simd, ips_raw_image_t *image);
+void ips_deflate_png_band(ips_task_t *task);
+png_bytep ips_encode_png(ips_task_group_t *group, ips_raw_image_t *image, int filter_type,
+                         int compression_level, size_t *png_size);
+int ips_save_image_to_png_file(ips_task_group_t *group, ips_raw_image_t *image, const char *png_file_path);
 ips_raw_image_t *ips_duplicate_image(ips_raw_image_t *image);
 void ips_delete_image(ips_raw_image_t *image);
 
-void reset_pass_data(void);
-void ips_update_image_data(ips_raw_image_t *image, float dt);
+void ips_reset_reduction(ips_reduction_t *reduction, unsigned int reductions);
+void ips_merge_reduction(ips_reduction_t *result, const ips_reduction_t *partial, unsigned int reductions);
+void reset_pass_data(ips_task_group_t *group, unsigned int reductions);
+void ips_merge_pass_data(ips_task_group_t *group, unsigned int reductions);
+int ips_is_generation_stale(const ips_task_group_t *group, unsigned int generation);
+void ips_push_filter_task(ips_task_group_t *group, const ips_filter_t *filter, unsigned int pass,
+                          ips_raw_image_t *input_image, ips_raw_image_t *output_image,
+                          png_uint_32 x0, png_uint_32 y0, png_uint_32 x1, png_uint_32 y1);
+void ips_update_image_rows(ips_task_group_t *group, const ips_filter_t *filter, unsigned int pass,
+                           ips_raw_image_t *input_image, ips_raw_image_t *output_image,
+                           png_uint_32 first_row, png_uint_32 last_row, png_uint_32 band_height);
+void ips_update_image(ips_task_group_t *group, const ips_filter_t *filter, unsigned int pass,
+                      ips_raw_image_t *input_image, ips_raw_image_t *output_image);
+void ips_prepare_intermediate_images(ips_task_group_t *group, const ips_filter_t *filter,
+                                     ips_raw_image_t *input_image);
+unsigned int ips_get_pass_radius(const ips_filter_t *filter, unsigned int pass);
+png_uint_32 ips_get_pass_tile_width(const ips_filter_t *filter, unsigned int pass);
+void ips_replicate_intermediate_image_aprons(ips_task_group_t *group, const ips_filter_t *filter);
+int ips_apply_filter_passes(ips_task_group_t *group, const ips_filter_t *filter, unsigned int first_pass,
+                            ips_raw_image_t *input_image, ips_raw_image_t *output_image);
+int ips_apply_filter(ips_task_group_t *group, const ips_filter_t *filter,
+                     ips_raw_image_t *input_image, ips_raw_image_t *output_image);
+int ips_apply_filter_to_png_stream(ips_task_group_t *group, const ips_filter_t *filter,
+                                   ips_png_reader_t *reader, ips_raw_image_t *output_image,
+                                   double *first_tiles_milliseconds);
+ips_dirty_tiles_t *ips_create_dirty_tiles(png_uint_32 image_width, png_uint_32 image_height);
+void ips_delete_dirty_tiles(ips_dirty_tiles_t *tiles);
+void ips_clear_dirty_tiles(ips_dirty_tiles_t *tiles);
+void ips_mark_dirty_tile(ips_dirty_tiles_t *tiles, png_uint_32 column, png_uint_32 row);
+void ips_mark_dirty_rectangle(ips_dirty_tiles_t *tiles, png_uint_32 x0, png_uint_32 y0,
+                              png_uint_32 x1, png_uint_32 y1);
+void ips_mark_changed_tiles(ips_dirty_tiles_t *tiles, ips_raw_image_t *old_image, ips_raw_image_t *new_image);
+void ips_merge_dirty_tiles(ips_dirty_tiles_t *tiles, const ips_dirty_tiles_t *other_tiles);
+void ips_copy_image_tiles(ips_raw_image_t *source_image, ips_raw_image_t *destination_image,
+                          const ips_dirty_tiles_t *tiles);
+void ips_dilate_dirty_tiles(ips_dirty_tiles_t *tiles, unsigned int radius);
+int ips_can_update_dirty_tiles(const ips_filter_t *filter);
+void ips_update_dirty_tiles(ips_task_group_t *group, const ips_filter_t *filter, unsigned int pass,
+                            ips_raw_image_t *input_image, ips_raw_image_t *output_image,
+                            const ips_dirty_tiles_t *tiles);
+int ips_apply_filter_to_dirty_tiles(ips_task_group_t *group, const ips_filter_t *filter,
+                                    ips_raw_image_t *input_image, ips_raw_image_t *output_image,
+                                    ips_dirty_tiles_t *tiles);
+int ips_apply_filter_to_tiles(ips_task_group_t *group, const ips_filter_t *filter,
+                              ips_raw_image_t *input_image, ips_raw_image_t *output_image,
+                              const ips_dirty_tiles_t *tiles);
+ips_pyramid_t *ips_create_pyramid(ips_raw_image_t *image);
+void ips_build_pyramid(ips_task_group_t *group, ips_pyramid_t *pyramid);
+void ips_update_pyramid(ips_task_group_t *group, ips_pyramid_t *pyramid, const ips_dirty_tiles_t *tiles);
+void ips_delete_pyramid(ips_pyramid_t *pyramid);
+const ips_filter_t *ips_find_filter(const char *name);
+ips_task_arena_t *ips_create_task_arena(void);
+ips_task_t *ips_allocate_task(ips_task_arena_t *arena);
+void ips_reset_task_arena(ips_task_arena_t *arena);
+void ips_delete_task_arena(ips_task_arena_t *arena);
+ips_task_group_t *ips_create_task_group(ips_task_pool_t *pool);
+void ips_delete_task_group(ips_task_group_t *group);
+
 void ips_create_image_processing_task_pool();
+void ips_delete_image_processing_task_pool();
+int ips_push_task(ips_task_pool_t *pool, ips_task_t *task);
+ips_task_t *ips_pop_task(ips_task_pool_t *pool);
+size_t ips_pop_tasks(ips_task_pool_t *pool, ips_task_t **tasks, size_t maximum_number_of_tasks);
+void ips_finish_task(ips_task_pool_t *pool, ips_task_group_t *group);
+void ips_shut_down_task_pool(ips_task_pool_t *pool);
+void ips_wait_for_image_processing_tasks(ips_task_group_t *group);
+int ips_parse_scheduler(const char *scheduler_name);
+
+void ips_init_task_deque(ips_task_deque_t *deque, int capacity);
+void ips_destroy_task_deque(ips_task_deque_t *deque);
+int ips_push_task_to_deque(ips_task_deque_t *deque, ips_task_t *task);
+ips_task_t *ips_pop_task_from_deque(ips_task_deque_t *deque);
+ips_task_t *ips_steal_task_from_deque(ips_task_deque_t *deque);
+ips_task_t *ips_steal_task(ips_worker_t *thief);
+ips_task_t *ips_get_task_for_worker(ips_worker_t *worker);
+void ips_run_task(ips_worker_t *worker, ips_task_t *task);
+void *ips_get_worker_scratch(ips_worker_t *worker, size_t size);
+
 void *ips_thread_process_image_part(void *args);
 
 void ips_set_brightness_and_contrast(ips_task_t *task);
-// TODO: add a Sobel filter function prototype
-
-GLuint ips_create_texture_from_image(ips_raw_image *image);
+void ips_find_channel_range(ips_task_t *task);
+void ips_normalize(ips_task_t *task);
+void ips_compute_luminance(ips_task_t *task);
+png_uint_32 ips_apply_sobel_to_row_sse2(const png_byte *above, const png_byte *row, const png_byte *below,
+                                        png_uint_32 x0, png_uint_32 x1, ips_task_t *task, png_uint_32 y);
+png_uint_32 ips_apply_sobel_to_row_avx2(const png_byte *above, const png_byte *row, const png_byte *below,
+                                        png_uint_32 x0, png_uint_32 x1, ips_task_t *task, png_uint_32 y);
+void ips_apply_sobel(ips_task_t *task);
+unsigned int ips_get_sobel_radius(const void *image_processing_parameters);
+void ips_detect_simd_level(void);
+png_uint_32 ips_apply_median_network_to_row_sse2(ips_task_t *task, png_uint_32 y, png_uint_32 x0, png_uint_32 x1,
+                                                 unsigned int plane);
+png_uint_32 ips_apply_median_network_to_row_avx2(ips_task_t *task, png_uint_32 y, png_uint_32 x0, png_uint_32 x1,
+                                                 unsigned int plane);
+void ips_apply_median_network(ips_task_t *task);
+void ips_apply_histogram_median(ips_task_t *task);
+void ips_apply_median(ips_task_t *task);
+unsigned int ips_get_median_radius(const void *image_processing_parameters);
+png_uint_32 ips_convert_row_to_planar_sse2(const png_byte *source, png_bytep *planes,
+                                           png_uint_32 x0, png_uint_32 x1, unsigned int channels);
+png_uint_32 ips_convert_row_to_interleaved_sse2(const png_byte *const *planes, png_bytep destination,
+                                                png_uint_32 x0, png_uint_32 x1, unsigned int channels);
+png_uint_32 ips_convert_row_to_planar_ssse3(const png_byte *source, png_bytep *planes,
+                                            png_uint_32 x0, png_uint_32 x1, unsigned int channels);
+png_uint_32 ips_convert_row_to_interleaved_ssse3(const png_byte *const *planes, png_bytep destination,
+                                                 png_uint_32 x0, png_uint_32 x1, unsigned int channels);
+void ips_convert_layout(ips_task_t *task);
+png_uint_32 ips_downsample_row_sse2(const png_byte *top, const png_byte *bottom, png_bytep destination,
+                                    png_uint_32 x0, png_uint_32 x1, png_uint_32 input_width,
+                                    unsigned int samples_per_pixel);
+png_uint_32 ips_downsample_row_ssse3(const png_byte *top, const png_byte *bottom, png_bytep destination,
+                                     png_uint_32 x0, png_uint_32 x1, png_uint_32 input_width,
+                                     unsigned int samples_per_pixel);
+void ips_downsample(ips_task_t *task);
+
+GLuint ips_create_texture_from_pyramid(ips_pyramid_t *pyramid);
 void ips_update_texture_from_image(GLuint texture, ips_raw_image *image);
+void ips_update_texture_from_dirty_tiles(GLuint texture, ips_raw_image *image, const ips_dirty_tiles_t *tiles);
+void ips_update_texture_mipmaps(GLuint texture, ips_pyramid_t *pyramid, const ips_dirty_tiles_t *tiles);
+void ips_update_texture_from_pixel_buffer(GLuint texture, ips_frame_t *frame);
+void ips_wait_for_texture_update(ips_frame_t *frame);
 void ips_delete_texture(GLuint texture);
 
 void ips_update_matrices(int new_window_width, int new_window_height);
@@ -124,9 +905,135 @@ void ips_update_model_matrix(ips_raw_image *image);
 
 void ips_measure_and_show_frame_rate(void);
 
+int ips_parse_tile_size(const char *tile_size);
+double ips_benchmark_filter(const ips_filter_t *filter,
+                            ips_raw_image_t *input_image,
+                            ips_raw_image_t *output_image,
+                            unsigned int iterations);
+int ips_images_are_equal(ips_raw_image_t *first_image, ips_raw_image_t *second_image);
+void *ips_request_generation_after_delay(void *args);
+int ips_run_benchmark(char *image_file_path);
+void ips_count_stress_task(ips_task_t *task);
+void *ips_produce_stress_tasks(void *args);
+void *ips_consume_stress_tasks(void *args);
+int ips_run_queue_stress_test(void);
+int ips_run_batch(char *input_image_file_path, char *output_image_file_path,
+                  const ips_filter_t **filters, size_t number_of_filters);
+void ips_init_batch_queue(ips_batch_queue_t *queue, size_t capacity, unsigned int number_of_producers);
+void ips_destroy_batch_queue(ips_batch_queue_t *queue);
+void ips_push_batch_item(ips_batch_queue_t *queue, const ips_batch_item_t *item);
+int ips_pop_batch_item(ips_batch_queue_t *queue, ips_batch_item_t *item);
+void ips_leave_batch_queue(ips_batch_queue_t *queue);
+void *ips_decode_batch_images(void *args);
+void *ips_filter_batch_images(void *args);
+void *ips_encode_batch_images(void *args);
+int ips_run_batch_pipeline(char **input_image_file_paths, char **output_image_file_paths,
+                           size_t number_of_images,
+                           const ips_filter_t **filters, size_t number_of_filters);
+int ips_run_batch_on_directory(char *input_path, int is_file_list, char *output_directory_path,
+                               const ips_filter_t **filters, size_t number_of_filters);
+
+void ips_create_compute_coordinator(void);
+void ips_delete_compute_coordinator(void);
+void ips_request_image(ips_compute_coordinator_t *coordinator, char *image_path);
+void ips_request_parameter_change(ips_compute_coordinator_t *coordinator, SDL_Keycode key);
+png_bytep ips_request_pixel_buffer(ips_compute_coordinator_t *coordinator, ips_frame_t *frame, size_t size);
+void ips_serve_pixel_buffer_request(ips_compute_coordinator_t *coordinator);
+int ips_prepare_frame(ips_compute_coordinator_t *coordinator, ips_frame_t *frame, ips_raw_image_t *image);
+ips_frame_t *ips_publish_frame(ips_compute_coordinator_t *coordinator, double filter_milliseconds);
+ips_frame_t *ips_acquire_frame(ips_compute_coordinator_t *coordinator);
+void *ips_run_compute_coordinator(void *args);
+void ips_request_view(ips_compute_coordinator_t *coordinator, const ips_view_t *view);
+void ips_update_preview_pyramid(ips_task_group_t *group, ips_preview_t *preview, ips_raw_image_t *image,
+                                const ips_dirty_tiles_t *changed_tiles);
+unsigned int ips_select_preview_level(const ips_preview_t *preview, const ips_view_t *view);
+void ips_mark_visible_tiles(ips_dirty_tiles_t *tiles, const ips_view_t *view);
+void ips_mark_unfiltered_tiles(ips_dirty_tiles_t *tiles, const ips_dirty_tiles_t *filtered_tiles,
+                               size_t maximum_number_of_tiles);
+int ips_update_preview(ips_compute_coordinator_t *coordinator, ips_preview_t *preview,
+                       const ips_filter_t *filter, ips_frame_t *latest_frame, const ips_view_t *view,
+                       int should_reset, int is_refinement);
+void ips_delete_preview(ips_preview_t *preview);
+
 void ips_start(char *dropped_file_path);
 void ips_stop(void);
 
+#pragma mark - Filters
+
+static float brightness_contrast[2] = {
+    100.0f, 2.0f
+};
+
+static ips_sobel_parameters_t sobel_parameters = {
+    0
+};
+
+static ips_median_parameters_t median_parameters = {
+    5
+};
+
+static const ips_filter_t Filters[] = {
+    {
+        "brightness-contrast",
+        1, {
+            { ips_set_brightness_and_contrast, IPS_REDUCTION_MINIMUM_MAXIMUM, IPS_TILING_TILES, NULL }
+        },
+        0, 0,
+        (void *) brightness_contrast
+    },
+    {
+        "normalize",
+        2, {
+            { ips_find_channel_range, IPS_REDUCTION_MINIMUM_MAXIMUM, IPS_TILING_TILES, NULL },
+            { ips_normalize, IPS_REDUCTION_NONE, IPS_TILING_TILES, NULL }
+        },
+        0, 0,
+        NULL
+    },
+    {
+        "sobel",
+        2, {
+            { ips_compute_luminance, IPS_REDUCTION_NONE, IPS_TILING_TILES, NULL },
+            { ips_apply_sobel, IPS_REDUCTION_NONE, IPS_TILING_TILES, ips_get_sobel_radius }
+        },
+        1, 1,
+        (void *) &sobel_parameters
+    },
+    {
+        "median",
+        1, {
+            { ips_apply_median, IPS_REDUCTION_NONE, IPS_TILING_VERTICAL_STRIPS, ips_get_median_radius }
+        },
+        0, 0,
+        (void *) &median_parameters
+    }
+};
+
+static const size_t Number_Of_Filters = sizeof(Filters) / sizeof(*Filters);
+
+/*
+    Not a user filter: converts between the layouts of its input and output,
+    so that a chain of filters can stay planar and interleave once at the end.
+*/
+static const ips_filter_t Layout_Conversion_Filter = {
+    "convert-layout",
+    1, {
+        { ips_convert_layout, IPS_REDUCTION_NONE, IPS_TILING_TILES, NULL }
+    },
+    0, 0,
+    NULL
+};
+
+/* Not a user filter either: writes the input halved with a 2x2 box to an output of half its size */
+static const ips_filter_t Downsample_Filter = {
+    "downsample",
+    1, {
+        { ips_downsample, IPS_REDUCTION_NONE, IPS_TILING_TILES, NULL }
+    },
+    0, 0,
+    NULL
+};
+
 #pragma mark - Globals
 
 int current_window_width  = Initial_Window_Width,
@@ -157,992 +1064,7710 @@ static SDL_GLContext gl_context;
 
 static ips_raw_image_t *source_image = NULL; /* Source image without adjustments */
 
-/* Values to normalize pixel values */
-
-static float minimum_channel_value = 0.0f;
-static float maximum_channel_value = 0.0f;
+static size_t current_filter_index = 0;
 
-/* Threading Data */
+/* Nothing is drawn while the window is idle */
+static int should_render_frame = 1;
 
-static ips_task_pool_t *pool;
+/* Widest vector extension the kernels may use, lowered by --no-simd */
+static ips_simd_level_t simd_level = IPS_SIMD_NONE;
 
-static int number_of_threads = 0;
+/* Threading Data */
 
-#pragma mark - Function Definitions
+static ips_task_pool_t *pool = NULL;
+static ips_task_group_t *task_group = NULL; /* Tasks of the interactive frames */
 
-void ips_create_image_processing_task_pool()
-{
-    pool =
-        (ips_task_pool_t*) malloc(sizeof(*pool));
+/* Thread that runs the interactive filters away from the render thread */
+static ips_compute_coordinator_t *compute_coordinator = NULL;
 
-    pool->first_task = NULL;
-    pool->last_task  = NULL;
-    pool->size = 0;
+static int number_of_threads = 0; /* Number of CPU cores if not set */
+static ips_scheduler_t scheduler = IPS_SCHEDULER_CENTRAL_QUEUE;
 
-    number_of_threads =
-        ips_utils_get_number_of_cpu_cores();
+/* Task decomposition: tiles wider than the image become full-row bands */
 
-    for (int i = 0; i < number_of_threads; ++i) {
-        // TODO
-    }
-}
+static png_uint_32 tile_width  = Default_Tile_Width,
+                   tile_height = Default_Tile_Height;
 
-void reset_pass_data()
-{
-    minimum_channel_value = 0.0f;
-    maximum_channel_value = 0.0f;
-}
+/* zlib level of saved images, 0 stores, 1 is the fastest, 9 the smallest */
+static int png_compression_level = 6;
 
-/* Producer tasks: called each time before rendering a frame. */
-void ips_update_image(
-         ips_raw_image_t *source_image,
-         ips_raw_image_t *image,
-         void *image_processing_parameters,
-         void (*image_processing_function)(struct ips_task* task),
-         unsigned int pass,
-         float dt
-     )
-{
-    for (png_uint_32 y = 0; y < image->height; y += number_of_threads) {
-        for (png_uint_32 i = 0; i < number_of_threads && ((y + i) < image->height); ++i) {
-            png_uint_32 current_row_index =
-                y + i;
+/* Input images are memory-mapped unless --no-mmap is given */
+static int should_map_input_files = 1;
 
-            ips_task_t *task;
-            task =
-                (ips_task_t *) malloc(sizeof(*task));
-            task->input_image =
-                source_image;
-            task->output_image =
-                image;
-            task->row_index_to_process =
-                current_row_index;
-            task->last_row_index_to_process =
-                current_row_index + 1;
-            task->image_processing_parameters =
-                image_processing_parameters;
-            task->image_processing_function =
-                image_processing_function;
-            task->pass =
-                pass;
+/* With --planar filter chains run on planar images and interleave once at the end */
+static int should_use_planar_layout = 0;
 
-            task->next_task = NULL;
+/* With --preview the window only filters what is on screen at the density of the screen */
+static int should_preview_visible_region = 0;
 
-            if (!pool->first_task) {
-                pool->first_task = task;
-            }
+/* Frames are written into pixel buffers unless --no-pixel-buffers is given */
+static int should_use_pixel_buffers = 1;
+static double pixel_buffer_upload_milliseconds = 0.0; /* CPU time of the last update from a pixel buffer */
+static double client_upload_milliseconds = 0.0; /* CPU time of the last update from client memory */
+static double filter_milliseconds = 0.0; /* Time the compute thread took for the frame on screen */
+static unsigned long task_allocations = 0; /* Arena allocations of the frame on screen */
 
-            if (pool->last_task) {
-                pool->last_task->next_task =
-                    task;
-            }
+/* Threads of every stage of the batch pipeline and the images each queue can hold */
+static int batch_stage_jobs[IPS_NUMBER_OF_BATCH_STAGES] = { 2, 2, 2 };
+static int batch_queue_capacity = 4;
 
-            pool->last_task = task;
-            pool->size++;
-        }
-    }
-}
+#pragma mark - Function Definitions
 
-void ips_set_brightness_and_contrast(ips_task_t *task)
+ips_task_arena_t *ips_create_task_arena()
 {
-    png_uint_32 x, y;
-    png_bytep source_pixel, destination_pixel;
+    ips_task_arena_t *arena =
+        (ips_task_arena_t *) malloc(sizeof(*arena));
 
-    int channel;
+    arena->first_block = NULL;
+    arena->current_block = NULL;
+    arena->number_of_allocations = 0;
 
-    ips_raw_image_t *input_image =
-        task->input_image;
-    ips_raw_image_t *output_image =
-        task->output_image;
-    float new_image_brightness =
-        ((float *) task->image_processing_parameters)[0];
-    float new_image_contrast =
-        ((float *) task->image_processing_parameters)[1];
-    unsigned int channels =
-        output_image->channels;
+    return arena;
+}
 
-    for (y = task->row_index_to_process; y < task->last_row_index_to_process; ++y) {
-        for (x = 0; x < output_image->width; ++x) {
-            source_pixel = &(input_image->rows[y][x * channels]);
-            destination_pixel = &(output_image->rows[y][x * channels]);
-            for (channel = 0; channel < 3; ++channel) {
-                float newValue =
-                    new_image_contrast * source_pixel[channel] + new_image_brightness;
-                newValue =
-                    IPS_CLAMP(newValue, 0.0f, 255.0f);
+ips_task_t *ips_allocate_task(ips_task_arena_t *arena)
+{
+    ips_task_arena_block_t *block =
+        arena->current_block;
 
-                minimum_channel_value =
-                    fmin(maximum_channel_value, newValue);
-                maximum_channel_value =
-                    fmax(maximum_channel_value, newValue);
+    if (block && block->size == block->capacity) {
+        block = block->next_block;
+        if (block) {
+            block->size = 0;
+        }
+    }
 
-                destination_pixel[channel] =
-                    (png_byte) newValue;
-            }
+    if (!block) {
+        /* Grow geometrically, so a new image size settles in a few frames */
+        size_t capacity =
+            arena->current_block ?
+                arena->current_block->capacity * 2 :
+                Task_Arena_Initial_Block_Capacity;
+
+        block =
+            (ips_task_arena_block_t *) malloc(sizeof(*block));
+        block->tasks =
+            (ips_task_t *) malloc(sizeof(*block->tasks) * capacity);
+        block->capacity = capacity;
+        block->size = 0;
+        block->next_block = NULL;
+
+        if (arena->current_block) {
+            arena->current_block->next_block = block;
+        } else {
+            arena->first_block = block;
         }
+
+        arena->number_of_allocations += 2;
     }
 
-    free(task);
+    arena->current_block = block;
+
+    return &block->tasks[block->size++];
 }
 
-/* TODO: add a Sobel filter */
+/* Must not be called while tasks from the arena are still in flight. */
+void ips_reset_task_arena(ips_task_arena_t *arena)
+{
+    arena->current_block = arena->first_block;
+    if (arena->current_block) {
+        arena->current_block->size = 0;
+    }
+}
 
-/* Image processing tasks for each consumer thread. */
-void *ips_thread_process_image_part(void *args)
+void ips_delete_task_arena(ips_task_arena_t *arena)
 {
-    ips_task_pool_t *pool = (ips_task_pool_t *) args;
-    ips_task_t *task;
+    ips_task_arena_block_t *block, *next_block;
 
-    while (pool->size != 0) {
-        if (pool->size > 0) {
-            // Get a new task
+    if (arena) {
+        for (block = arena->first_block; block; block = next_block) {
+            next_block = block->next_block;
 
-            task = pool->first_task;
-            pool->first_task = task->next_task;
-            pool->size--;
-            if (!pool->size) {
-                pool->last_task = NULL;
-            }
-
-            task->image_processing_function(task);
+            free(block->tasks);
+            free(block);
         }
+
+        free(arena);
     }
+}
 
-    return NULL;
+ips_task_group_t *ips_create_task_group(ips_task_pool_t *pool)
+{
+    ips_task_group_t *group =
+        (ips_task_group_t *) malloc(sizeof(*group));
+
+    group->pool = pool;
+    group->task_arena =
+        ips_create_task_arena();
+    group->number_of_unfinished_tasks = 0;
+    pthread_cond_init(&group->tasks_finished, NULL);
+
+    group->worker_reductions =
+        (ips_worker_reduction_t *) malloc(sizeof(*group->worker_reductions) * pool->number_of_workers);
+
+    for (int i = 0; i < IPS_MAXIMUM_INTERMEDIATE_IMAGES; ++i) {
+        group->intermediate_images[i] = NULL;
+    }
+
+    group->generation = 0;
+    group->requested_generation = NULL;
+
+    return group;
 }
 
-/* ----- */
+/* Must not be called while tasks of the group are still in flight. */
+void ips_delete_task_group(ips_task_group_t *group)
+{
+    if (group) {
+        for (int i = 0; i < IPS_MAXIMUM_INTERMEDIATE_IMAGES; ++i) {
+            ips_delete_image(group->intermediate_images[i]);
+        }
 
-void ips_init_gl_window()
+        free(group->worker_reductions);
+        pthread_cond_destroy(&group->tasks_finished);
+        ips_delete_task_arena(group->task_arena);
+        free(group);
+    }
+}
+
+void ips_create_image_processing_task_pool()
 {
-    GLenum glew_initialization_status;
+    pool =
+        (ips_task_pool_t*) malloc(sizeof(*pool));
 
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0) {
-        fprintf(stderr, "SDL initialization failure: \"%s\"\n", SDL_GetError());
+    pool->capacity = Task_Pool_Capacity;
+    pool->tasks =
+        (ips_task_t **) malloc(sizeof(*pool->tasks) * pool->capacity);
+    pool->first_task_index = 0;
+    pool->size = 0;
+    pool->is_shut_down = 0;
+    SDL_AtomicSet(&pool->number_of_stealable_tasks, 0);
+    pool->number_of_sleeping_workers = 0;
 
-        SDL_Quit();
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->tasks_available, NULL);
+    pthread_cond_init(&pool->space_available, NULL);
 
-        exit(EXIT_FAILURE);
+    if (number_of_threads < 1) {
+        number_of_threads =
+            ips_utils_get_number_of_cpu_cores();
     }
 
-    program_window =
-        SDL_CreateWindow(
-            Window_Title,
-            SDL_WINDOWPOS_CENTERED,
-            SDL_WINDOWPOS_CENTERED,
-            Initial_Window_Width,
-            Initial_Window_Height,
-            SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE
-        );
-    if (!program_window) {
-        fprintf(
-            stderr,
-            "Failed to create an SDL window: \"%s\"\n",
-            SDL_GetError()
-        );
-
-        SDL_Quit();
+    pool->scheduler = scheduler;
+    pool->number_of_workers = number_of_threads;
+    pool->workers =
+        (ips_worker_t *) malloc(sizeof(*pool->workers) * number_of_threads);
+    pool->threads =
+        (pthread_t *) malloc(sizeof(*pool->threads) * number_of_threads);
 
-        exit(EXIT_FAILURE);
+    for (int i = 0; i < number_of_threads; ++i) {
+        ips_worker_t *worker = &pool->workers[i];
+
+        worker->pool = pool;
+        worker->index = i;
+        worker->random_state = 2654435761u * (i + 1);
+        worker->scratch = NULL;
+        worker->scratch_size = 0;
+        ips_init_task_deque(&worker->deque, Task_Deque_Capacity);
     }
 
-    ips_update_matrices(
-        Initial_Window_Width,
-        Initial_Window_Height
-    );
+    task_group =
+        ips_create_task_group(pool);
 
-    SDL_GL_SetAttribute(
-        SDL_GL_CONTEXT_MAJOR_VERSION,
-        OpenGL_Context_Major_Version
-    );
-    SDL_GL_SetAttribute(
-        SDL_GL_CONTEXT_MINOR_VERSION,
-        OpenGL_Context_Minor_Version
-    );
+    for (int i = 0; i < number_of_threads; ++i) {
+        if (pthread_create(&pool->threads[i], NULL, ips_thread_process_image_part, &pool->workers[i]) != 0) {
+            fprintf(stderr, "Failed to create a worker thread\n");
 
-    SDL_GL_SetAttribute(
-        SDL_GL_MULTISAMPLEBUFFERS,
-        Multisample_Enabled
-    );
-    SDL_GL_SetAttribute(
-        SDL_GL_MULTISAMPLESAMPLES,
-        Multisample_Samples_Count
-    );
+            exit(EXIT_FAILURE);
+        }
+    }
+}
 
-    gl_context = SDL_GL_CreateContext(program_window);
-    if (!gl_context) {
-        fprintf(
-            stderr,
-            "Failed to create an OpengGL context: \"%s\"\n",
-            SDL_GetError()
-        );
+void ips_delete_image_processing_task_pool()
+{
+    if (pool) {
+        ips_shut_down_task_pool(pool);
 
-        SDL_DestroyWindow(program_window);
-        SDL_Quit();
+        for (int i = 0; i < number_of_threads; ++i) {
+            pthread_join(pool->threads[i], NULL);
+            ips_destroy_task_deque(&pool->workers[i].deque);
+            free(pool->workers[i].scratch);
+        }
 
-        exit(EXIT_FAILURE);
+        ips_delete_task_group(task_group);
+        task_group = NULL;
+
+        pthread_cond_destroy(&pool->space_available);
+        pthread_cond_destroy(&pool->tasks_available);
+        pthread_mutex_destroy(&pool->mutex);
+
+        free(pool->threads);
+        free(pool->workers);
+        free(pool->tasks);
+        free(pool);
+        pool = NULL;
     }
+}
 
-    glewExperimental = GL_TRUE;
-    glew_initialization_status = glewInit();
-    if (glew_initialization_status != GLEW_OK) {
-        fprintf(
-            stderr,
-            "GLEW initialization failure: %s\n",
-            glewGetErrorString(glew_initialization_status)
-        );
+/*
+    Blocks while the pool is full. Returns 0 without taking the task if the
+    pool was shut down.
+*/
+int ips_push_task(ips_task_pool_t *pool, ips_task_t *task)
+{
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->size == pool->capacity && !pool->is_shut_down) {
+        pthread_cond_wait(&pool->space_available, &pool->mutex);
     }
 
-    /* Change to SDL_GL_SetSwapInterval(0) to get unbound framerate */
-    if (SDL_GL_SetSwapInterval(-1) < 0) {
-        SDL_GL_SetSwapInterval(1);
+    if (pool->is_shut_down) {
+        pthread_mutex_unlock(&pool->mutex);
+
+        return 0;
     }
 
-    SDL_DisableScreenSaver();
+    pool->tasks[(pool->first_task_index + pool->size) % pool->capacity] =
+        task;
+    pool->size++;
+    task->group->number_of_unfinished_tasks++;
+
+    pthread_cond_signal(&pool->tasks_available);
+    pthread_mutex_unlock(&pool->mutex);
+
+    return 1;
 }
 
-void ips_init_gl()
+/*
+    Blocks while the pool is empty. After a shutdown the remaining tasks are
+    still handed out (drained); NULL is returned once none are left.
+*/
+ips_task_t *ips_pop_task(ips_task_pool_t *pool)
 {
-    glEnable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_BLEND);
+    ips_task_t *task = NULL;
 
-    glCullFace(GL_BACK);
-    glFrontFace(GL_CW);
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->size == 0 && !pool->is_shut_down) {
+        pthread_cond_wait(&pool->tasks_available, &pool->mutex);
+    }
 
-    glClearColor(0, 0, 0, 0);
-    glClearDepth(1.0);
+    if (pool->size > 0) {
+        task =
+            pool->tasks[pool->first_task_index];
+        pool->first_task_index =
+            (pool->first_task_index + 1) % pool->capacity;
+        pool->size--;
 
-    glViewport(
-        0, 0,
-        (GLsizei) Initial_Window_Width,
-        (GLsizei) Initial_Window_Height
-    );
+        pthread_cond_signal(&pool->space_available);
+    }
+    pthread_mutex_unlock(&pool->mutex);
 
-    glUseProgram(0);
+    return task;
 }
 
-GLuint ips_create_shader_program(
-           char *vertex_shader_source,
-           char *fragment_shader_source
+/*
+    Takes a fair share of the queued tasks, but no more than
+    maximum_number_of_tasks, under a single lock. Blocks while there is
+    nothing to take or steal, returns 0 once the pool is shut down and
+    drained or if only the deques have tasks.
+*/
+size_t ips_pop_tasks(
+           ips_task_pool_t *pool,
+           ips_task_t **tasks,
+           size_t maximum_number_of_tasks
        )
 {
-    GLuint shader_program = 0;
-
-    GLuint vertex_shader_object   = 0,
-           fragment_shader_object = 0;
+    size_t number_of_tasks = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->size == 0 && !pool->is_shut_down &&
+               SDL_AtomicGet(&pool->number_of_stealable_tasks) == 0) {
+        pool->number_of_sleeping_workers++;
+        pthread_cond_wait(&pool->tasks_available, &pool->mutex);
+        pool->number_of_sleeping_workers--;
+    }
 
-    if (!vertex_shader_source) {
-        fprintf(
-            stderr,
-            "Failed to read a vertex shader file \"%s\"\n",
-            Vertex_Shader_Path
+    maximum_number_of_tasks =
+        IPS_MIN(
+            maximum_number_of_tasks,
+            pool->size / pool->number_of_workers + 1
         );
 
-        return shader_program;
+    while (pool->size > 0 && number_of_tasks < maximum_number_of_tasks) {
+        tasks[number_of_tasks++] =
+            pool->tasks[pool->first_task_index];
+        pool->first_task_index =
+            (pool->first_task_index + 1) % pool->capacity;
+        pool->size--;
     }
 
-    if (!fragment_shader_source) {
-        fprintf(
-            stderr,
-            "Failed to read a fragment shader file \"%s\"\n",
-            Fragment_Shader_Path
-        );
-
-        return shader_program;
+    if (number_of_tasks > 0) {
+        pthread_cond_broadcast(&pool->space_available);
     }
+    pthread_mutex_unlock(&pool->mutex);
 
-    vertex_shader_object =
-        ips_compile_shader(vertex_shader_source, GL_VERTEX_SHADER);
+    return number_of_tasks;
+}
 
-    if (vertex_shader_object) {
-        fragment_shader_object =
-            ips_compile_shader(fragment_shader_source, GL_FRAGMENT_SHADER);
+void ips_finish_task(ips_task_pool_t *pool, ips_task_group_t *group)
+{
+    pthread_mutex_lock(&pool->mutex);
+    if (--group->number_of_unfinished_tasks == 0) {
+        pthread_cond_broadcast(&group->tasks_finished);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
 
-        if (fragment_shader_object) {
-            shader_program =
-                ips_link_shader_program(
-                    vertex_shader_object,
-                    fragment_shader_object
-                );
-        }
+/* Rejects new tasks and wakes up everyone blocked on the pool. */
+void ips_shut_down_task_pool(ips_task_pool_t *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->is_shut_down = 1;
+    pthread_cond_broadcast(&pool->tasks_available);
+    pthread_cond_broadcast(&pool->space_available);
+    pthread_mutex_unlock(&pool->mutex);
+}
 
-        glDeleteShader(vertex_shader_object);
-        glDeleteShader(fragment_shader_object);
+/* Frame barrier: blocks until every published task of the group is processed. */
+void ips_wait_for_image_processing_tasks(ips_task_group_t *group)
+{
+    pthread_mutex_lock(&group->pool->mutex);
+    while (group->number_of_unfinished_tasks != 0) {
+        pthread_cond_wait(&group->tasks_finished, &group->pool->mutex);
     }
+    pthread_mutex_unlock(&group->pool->mutex);
+}
 
-    if (shader_program) {
-        position_attribute_location =
-            glGetAttribLocation(shader_program, "position");
-        normal_attribute_location =
-            glGetAttribLocation(shader_program, "normal");
-        color_attribute_location =
-            glGetAttribLocation(shader_program, "color");
-        texture_coordinates_attribute_location =
-            glGetAttribLocation(shader_program, "texture_coordinates");
+int ips_parse_scheduler(const char *scheduler_name)
+{
+    if (strcmp(scheduler_name, "central") == 0) {
+        scheduler = IPS_SCHEDULER_CENTRAL_QUEUE;
+    } else if (strcmp(scheduler_name, "stealing") == 0) {
+        scheduler = IPS_SCHEDULER_WORK_STEALING;
+    } else {
+        fprintf(stderr, "Unknown scheduler \"%s\"\n", scheduler_name);
 
-        mvp_matrix_uniform_location =
-            glGetUniformLocation(shader_program, "model_view_projection_matrix");
-        texture_sampler_uniform_location =
-            glGetUniformLocation(shader_program, "texture_sampler");
+        return 0;
     }
 
-    return shader_program;
+    return 1;
 }
 
-GLuint ips_compile_shader(
-           char *shader_source,
-           GLenum shader_type
-       )
+void ips_init_task_deque(ips_task_deque_t *deque, int capacity)
 {
-    GLint status;
+    SDL_AtomicSet(&deque->top, 0);
+    SDL_AtomicSet(&deque->bottom, 0);
 
-    GLuint shader_object =
-        glCreateShader(shader_type);
-
-    glShaderSource(
-        shader_object,
-        1,
-        (const GLchar**) &shader_source,
-        NULL
-    );
-    glCompileShader(shader_object);
+    deque->tasks =
+        (ips_task_t **) malloc(sizeof(*deque->tasks) * capacity);
+    deque->capacity = capacity;
+}
 
-    glGetShaderiv(
-        shader_object,
-        GL_COMPILE_STATUS,
-        &status
-    );
+void ips_destroy_task_deque(ips_task_deque_t *deque)
+{
+    free(deque->tasks);
+    deque->tasks = NULL;
+}
 
-    if (status == GL_FALSE) {
-        GLint info_log_length;
-        glGetShaderiv(
-            shader_object,
-            GL_INFO_LOG_LENGTH,
-            &info_log_length
-        );
+/* Owner only. Returns 0 if the deque is full. */
+int ips_push_task_to_deque(ips_task_deque_t *deque, ips_task_t *task)
+{
+    int bottom = SDL_AtomicGet(&deque->bottom),
+        top    = SDL_AtomicGet(&deque->top);
 
-        if (info_log_length > 0) {
-            GLchar *info_log =
-                (GLchar *) malloc((size_t) info_log_length);
+    if (bottom - top >= deque->capacity) {
+        return 0;
+    }
 
-            glGetShaderInfoLog(
-                shader_object,
-                info_log_length,
-                NULL,
-                info_log
-            );
+    /* The atomic add is a full barrier, the task is visible before the new bottom */
+    deque->tasks[bottom & (deque->capacity - 1)] = task;
+    SDL_AtomicAdd(&deque->bottom, 1);
 
-            fprintf(
-                stderr,
-                "Failed to compile a vertex shader \"%s\"\n",
-                shader_type == GL_VERTEX_SHADER ?
-                    Vertex_Shader_Path : Fragment_Shader_Path
-            );
-            fprintf(
-                stderr,
-                "Compilation log:\n%s\n\n",
-                info_log
-            );
+    return 1;
+}
 
-            free(info_log);
+/* Owner only. Races thieves with a CAS on top for the last task. */
+ips_task_t *ips_pop_task_from_deque(ips_task_deque_t *deque)
+{
+    ips_task_t *task = NULL;
+    int bottom, top;
+
+    /* The atomic add is a full barrier between publishing bottom and reading top */
+    bottom = SDL_AtomicAdd(&deque->bottom, -1) - 1;
+    top    = SDL_AtomicGet(&deque->top);
+
+    if (top <= bottom) {
+        task = deque->tasks[bottom & (deque->capacity - 1)];
+        if (top == bottom) {
+            if (!SDL_AtomicCAS(&deque->top, top, top + 1)) {
+                task = NULL;
+            }
+            SDL_AtomicAdd(&deque->bottom, 1);
         }
+    } else {
+        SDL_AtomicAdd(&deque->bottom, 1);
+    }
 
-        glDeleteShader(shader_object);
-        shader_object = 0;
+    return task;
+}
+
+/* Any thread. Returns NULL if the deque is empty or the race was lost. */
+ips_task_t *ips_steal_task_from_deque(ips_task_deque_t *deque)
+{
+    ips_task_t *task = NULL;
+    int bottom, top;
+
+    /* Atomic adds of zero are full-barrier reads */
+    top    = SDL_AtomicAdd(&deque->top, 0);
+    bottom = SDL_AtomicAdd(&deque->bottom, 0);
+
+    if (top < bottom) {
+        /*
+            The slot may already be reused by the owner if this thief was
+            preempted for a whole lap of the ring; the CAS below fails then
+            and the stale value is dropped.
+        */
+        task = deque->tasks[top & (deque->capacity - 1)];
+        if (!SDL_AtomicCAS(&deque->top, top, top + 1)) {
+            task = NULL;
+        }
     }
 
-    return shader_object;
+    return task;
 }
 
-GLuint ips_link_shader_program(
-           GLuint vertex_shader_object,
-           GLuint fragment_shader_object
-       )
+/* Tries every other worker once, starting from a random victim. */
+ips_task_t *ips_steal_task(ips_worker_t *thief)
 {
-    GLint status;
+    ips_task_pool_t *pool = thief->pool;
+    ips_task_t *task = NULL;
 
-    GLuint shader_program =
-        glCreateProgram();
+    unsigned int first_victim, i;
 
-    glAttachShader(
+    if (pool->number_of_workers < 2) {
+        return NULL;
+    }
+
+    /* xorshift32 */
+    thief->random_state ^= thief->random_state << 13;
+    thief->random_state ^= thief->random_state >> 17;
+    thief->random_state ^= thief->random_state << 5;
+
+    first_victim =
+        thief->random_state % pool->number_of_workers;
+
+    for (i = 0; i < pool->number_of_workers && !task; ++i) {
+        unsigned int victim =
+            (first_victim + i) % pool->number_of_workers;
+
+        if (victim != thief->index) {
+            task = ips_steal_task_from_deque(&pool->workers[victim].deque);
+        }
+    }
+
+    return task;
+}
+
+/*
+    Work-stealing mode: take from the own deque first, then steal, then
+    refill the own deque with a fair share of the central queue, which is
+    only used to inject tasks from producers. Sleeps only while no deque
+    has tasks left to steal.
+*/
+ips_task_t *ips_get_task_for_worker(ips_worker_t *worker)
+{
+    ips_task_pool_t *pool = worker->pool;
+    ips_task_t *task;
+
+    ips_task_t *tasks[256];
+    size_t number_of_tasks, i;
+    unsigned int attempt, number_of_sleepers_to_wake;
+    int is_shut_down;
+
+    for (;;) {
+        if ((task = ips_pop_task_from_deque(&worker->deque))) {
+            SDL_AtomicAdd(&pool->number_of_stealable_tasks, -1);
+
+            return task;
+        }
+
+        for (attempt = 0; attempt < Steal_Attempts_Before_Sleeping; ++attempt) {
+            if ((task = ips_steal_task(worker))) {
+                SDL_AtomicAdd(&pool->number_of_stealable_tasks, -1);
+
+                return task;
+            }
+        }
+
+        number_of_tasks =
+            ips_pop_tasks(pool, tasks, sizeof(tasks) / sizeof(*tasks));
+        if (number_of_tasks > 0) {
+            break;
+        }
+
+        /* Either the pool is shut down or another deque has tasks to steal */
+        pthread_mutex_lock(&pool->mutex);
+        is_shut_down = pool->is_shut_down;
+        pthread_mutex_unlock(&pool->mutex);
+
+        if (is_shut_down && SDL_AtomicGet(&pool->number_of_stealable_tasks) == 0) {
+            return NULL;
+        }
+    }
+
+    for (i = 1; i < number_of_tasks; ++i) {
+        if (!ips_push_task_to_deque(&worker->deque, tasks[i])) {
+            break;
+        }
+    }
+
+    /*
+        The count is raised before the sleepers are woken under the mutex,
+        so a worker that is about to sleep either sees it or gets the signal.
+    */
+    if (i > 1) {
+        SDL_AtomicAdd(&pool->number_of_stealable_tasks, (int) (i - 1));
+
+        pthread_mutex_lock(&pool->mutex);
+        number_of_sleepers_to_wake =
+            (unsigned int) IPS_MIN(pool->number_of_sleeping_workers, i - 1);
+        while (number_of_sleepers_to_wake-- > 0) {
+            pthread_cond_signal(&pool->tasks_available);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    /* Run whatever did not fit into the deque right away */
+    for (; i < number_of_tasks; ++i) {
+        ips_run_task(worker, tasks[i]);
+    }
+
+    return tasks[0];
+}
+
+void ips_run_task(ips_worker_t *worker, ips_task_t *task)
+{
+    ips_task_group_t *group = task->group;
+
+    task->reduction = &group->worker_reductions[worker->index].reduction;
+    task->worker = worker;
+    if (!ips_is_generation_stale(group, task->generation)) {
+        task->image_processing_function(task);
+    }
+
+    ips_finish_task(worker->pool, group);
+}
+
+/* A generation is stale once a newer one was requested for the group. */
+int ips_is_generation_stale(const ips_task_group_t *group, unsigned int generation)
+{
+    return
+        group->requested_generation &&
+            (int) ((unsigned int) SDL_AtomicGet(group->requested_generation) - generation) > 0;
+}
+
+/* The buffer only grows, its contents are not preserved. */
+void *ips_get_worker_scratch(ips_worker_t *worker, size_t size)
+{
+    if (worker->scratch_size < size) {
+        free(worker->scratch);
+        worker->scratch = malloc(size);
+        if (!worker->scratch) {
+            fprintf(stderr, "Failed to allocate %lu bytes of scratch memory\n", (unsigned long) size);
+
+            exit(EXIT_FAILURE);
+        }
+        worker->scratch_size = size;
+    }
+
+    return worker->scratch;
+}
+
+void ips_reset_reduction(ips_reduction_t *reduction, unsigned int reductions)
+{
+    for (int channel = 0; channel < IPS_MAXIMUM_CHANNELS; ++channel) {
+        if (reductions & IPS_REDUCTION_MINIMUM_MAXIMUM) {
+            reduction->minimum[channel] =  FLT_MAX;
+            reduction->maximum[channel] = -FLT_MAX;
+        }
+        if (reductions & IPS_REDUCTION_SUM) {
+            reduction->sum[channel] = 0.0;
+        }
+        if (reductions & IPS_REDUCTION_SUM_OF_SQUARES) {
+            reduction->sum_of_squares[channel] = 0.0;
+        }
+        if (reductions & IPS_REDUCTION_HISTOGRAM) {
+            memset(
+                reduction->histogram[channel], 0,
+                sizeof(reduction->histogram[channel])
+            );
+        }
+    }
+}
+
+void ips_merge_reduction(
+         ips_reduction_t *result,
+         const ips_reduction_t *partial,
+         unsigned int reductions
+     )
+{
+    for (int channel = 0; channel < IPS_MAXIMUM_CHANNELS; ++channel) {
+        if (reductions & IPS_REDUCTION_MINIMUM_MAXIMUM) {
+            result->minimum[channel] =
+                IPS_MIN(result->minimum[channel], partial->minimum[channel]);
+            result->maximum[channel] =
+                IPS_MAX(result->maximum[channel], partial->maximum[channel]);
+        }
+        if (reductions & IPS_REDUCTION_SUM) {
+            result->sum[channel] += partial->sum[channel];
+        }
+        if (reductions & IPS_REDUCTION_SUM_OF_SQUARES) {
+            result->sum_of_squares[channel] += partial->sum_of_squares[channel];
+        }
+        if (reductions & IPS_REDUCTION_HISTOGRAM) {
+            for (int i = 0; i < IPS_HISTOGRAM_SIZE; ++i) {
+                result->histogram[channel][i] += partial->histogram[channel][i];
+            }
+        }
+    }
+}
+
+/* Must only be called while the group is idle, i.e., after a barrier. */
+void reset_pass_data(ips_task_group_t *group, unsigned int reductions)
+{
+    for (unsigned int i = 0; i < group->pool->number_of_workers; ++i) {
+        ips_reset_reduction(&group->worker_reductions[i].reduction, reductions);
+    }
+}
+
+/* Merges the partial reductions of the workers into the pass reduction. */
+void ips_merge_pass_data(ips_task_group_t *group, unsigned int reductions)
+{
+    ips_reset_reduction(&group->pass_reduction, reductions);
+    for (unsigned int i = 0; i < group->pool->number_of_workers; ++i) {
+        ips_merge_reduction(&group->pass_reduction, &group->worker_reductions[i].reduction, reductions);
+    }
+}
+
+/* Producer task: publishes the rectangle [x0, x1) x [y0, y1) of one pass of a filter. */
+void ips_push_filter_task(
+         ips_task_group_t *group,
+         const ips_filter_t *filter,
+         unsigned int pass,
+         ips_raw_image_t *input_image,
+         ips_raw_image_t *output_image,
+         png_uint_32 x0, png_uint_32 y0,
+         png_uint_32 x1, png_uint_32 y1
+     )
+{
+    ips_task_t *task;
+    task =
+        ips_allocate_task(group->task_arena);
+    task->input_image =
+        input_image;
+    task->output_image =
+        output_image;
+    task->intermediate_images =
+        group->intermediate_images;
+    task->x0 =
+        x0;
+    task->y0 =
+        y0;
+    task->x1 =
+        x1;
+    task->y1 =
+        y1;
+    task->image_processing_parameters =
+        filter->image_processing_parameters;
+    task->image_processing_function =
+        filter->passes[pass - 1].image_processing_function;
+    task->pass =
+        pass;
+    task->pass_reduction =
+        &group->pass_reduction;
+    task->reduction =
+        NULL;
+    task->worker =
+        NULL;
+    task->group =
+        group;
+    task->generation =
+        group->generation;
+
+    ips_push_task(group->pool, task);
+}
+
+/*
+    Publishes the tiles of one pass of a filter that lie in the rows
+    [first_row, last_row), band_height rows at a time.
+*/
+void ips_update_image_rows(
+         ips_task_group_t *group,
+         const ips_filter_t *filter,
+         unsigned int pass,
+         ips_raw_image_t *input_image,
+         ips_raw_image_t *output_image,
+         png_uint_32 first_row,
+         png_uint_32 last_row,
+         png_uint_32 band_height
+     )
+{
+    png_uint_32 pass_tile_width =
+        ips_get_pass_tile_width(filter, pass);
+
+    for (png_uint_32 y = first_row; y < last_row; y += band_height) {
+        for (png_uint_32 x = 0; x < output_image->width; x += pass_tile_width) {
+            ips_push_filter_task(
+                group, filter, pass,
+                input_image, output_image,
+                x, y,
+                IPS_MIN(x + pass_tile_width, output_image->width),
+                IPS_MIN(y + band_height, last_row)
+            );
+        }
+    }
+}
+
+/* Publishes all tiles of one pass of a filter. */
+void ips_update_image(
+         ips_task_group_t *group,
+         const ips_filter_t *filter,
+         unsigned int pass,
+         ips_raw_image_t *input_image,
+         ips_raw_image_t *output_image
+     )
+{
+    png_uint_32 pass_tile_height =
+        filter->passes[pass - 1].tiling == IPS_TILING_VERTICAL_STRIPS ?
+            output_image->height : tile_height;
+
+    ips_update_image_rows(
+        group, filter, pass,
+        input_image, output_image,
+        0, output_image->height,
+        pass_tile_height
+    );
+}
+
+void ips_prepare_intermediate_images(
+         ips_task_group_t *group,
+         const ips_filter_t *filter,
+         ips_raw_image_t *input_image
+     )
+{
+    unsigned int channels =
+        filter->intermediate_image_channels ?
+            filter->intermediate_image_channels : input_image->channels;
+
+    /* Later passes read the intermediate images up to their radius past the border */
+    unsigned int apron = 0;
+    for (unsigned int pass = 2; pass <= filter->number_of_passes; ++pass) {
+        apron = IPS_MAX(apron, ips_get_pass_radius(filter, pass));
+    }
+
+    for (unsigned int i = 0; i < filter->number_of_intermediate_images; ++i) {
+        ips_raw_image_t *image = group->intermediate_images[i];
+        if (!image ||
+                image->width    != input_image->width  ||
+                image->height   != input_image->height ||
+                image->channels != channels            ||
+                image->apron    != apron               ||
+                image->layout   != input_image->layout) {
+            ips_delete_image(image);
+            group->intermediate_images[i] =
+                ips_create_image_with_layout(
+                    input_image->width,
+                    input_image->height,
+                    channels,
+                    apron,
+                    input_image->layout
+                );
+        }
+    }
+}
+
+/* Must be called after a barrier, the passes may have changed the borders. */
+void ips_replicate_intermediate_image_aprons(ips_task_group_t *group, const ips_filter_t *filter)
+{
+    for (unsigned int i = 0; i < filter->number_of_intermediate_images; ++i) {
+        ips_replicate_image_apron(group->intermediate_images[i]);
+    }
+}
+
+unsigned int ips_get_pass_radius(const ips_filter_t *filter, unsigned int pass)
+{
+    const ips_filter_pass_t *filter_pass =
+        &filter->passes[pass - 1];
+
+    return
+        filter_pass->get_radius ?
+            filter_pass->get_radius(filter->image_processing_parameters) : 0;
+}
+
+/*
+    Strips are at least two windows wide. Every row of a strip updates the
+    columns of its apron too, which would cost more than the pixels of a
+    narrow strip for large radii.
+*/
+png_uint_32 ips_get_pass_tile_width(const ips_filter_t *filter, unsigned int pass)
+{
+    if (filter->passes[pass - 1].tiling != IPS_TILING_VERTICAL_STRIPS) {
+        return tile_width;
+    }
+
+    return IPS_MAX(tile_width, 2 * (2 * ips_get_pass_radius(filter, pass) + 1));
+}
+
+/*
+    Runs the passes of a filter starting from first_pass. Pass N + 1 starts
+    only after every tile of pass N is done and its reductions are merged.
+    Returns 0 if the generation of the group became stale, the output and
+    the intermediate images are then left partly written.
+*/
+int ips_apply_filter_passes(
+        ips_task_group_t *group,
+        const ips_filter_t *filter,
+        unsigned int first_pass,
+        ips_raw_image_t *input_image,
+        ips_raw_image_t *output_image
+    )
+{
+    for (unsigned int pass = first_pass; pass <= filter->number_of_passes; ++pass) {
+        unsigned int reductions =
+            filter->passes[pass - 1].reductions;
+
+        reset_pass_data(group, reductions);
+        ips_update_image(group, filter, pass, input_image, output_image);
+        ips_wait_for_image_processing_tasks(group);
+        if (ips_is_generation_stale(group, group->generation)) {
+            return 0;
+        }
+        ips_merge_pass_data(group, reductions);
+        ips_replicate_intermediate_image_aprons(group, filter);
+    }
+
+    return 1;
+}
+
+int ips_apply_filter(
+        ips_task_group_t *group,
+        const ips_filter_t *filter,
+        ips_raw_image_t *input_image,
+        ips_raw_image_t *output_image
+    )
+{
+    ips_prepare_intermediate_images(group, filter, input_image);
+
+    return ips_apply_filter_passes(group, filter, 1, input_image, output_image);
+}
+
+/*
+    Applies a filter to an image that is still being decoded. The first
+    pass publishes a band of tiles as soon as the band and the rows its
+    radius reaches below it are decoded, so the workers filter while this
+    thread inflates the rest. Decoded rows are also copied to the output,
+    which ends up as if it started as a copy of the input, unless the output
+    is planar and the filter is expected to write every sample of it. Strip
+    passes are split into bands of tile_height rows. Returns 0 if decoding
+    failed.
+*/
+int ips_apply_filter_to_png_stream(
+        ips_task_group_t *group,
+        const ips_filter_t *filter,
+        ips_png_reader_t *reader,
+        ips_raw_image_t *output_image,
+        double *first_tiles_milliseconds
+    )
+{
+    ips_raw_image_t *input_image =
+        reader->image;
+    png_uint_32 height =
+        input_image->height;
+    size_t row_size =
+        input_image->width * input_image->channels;
+    unsigned int radius =
+        ips_get_pass_radius(filter, 1);
+    unsigned int reductions =
+        filter->passes[0].reductions;
+
+    png_uint_32 number_of_copied_rows = 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+    int status = 1;
+
+    ips_prepare_intermediate_images(group, filter, input_image);
+    reset_pass_data(group, reductions);
+
+    for (png_uint_32 y = 0; y < height && status; y += tile_height) {
+        png_uint_32 last_row =
+            IPS_MIN(y + tile_height, height);
+
+        status =
+            ips_read_png_rows(reader, (png_uint_32) IPS_MIN((Uint64) last_row + radius, (Uint64) height));
+
+        for (; output_image->layout == IPS_LAYOUT_INTERLEAVED &&
+                   number_of_copied_rows < reader->number_of_decoded_rows; ++number_of_copied_rows) {
+            memcpy(
+                output_image->rows[number_of_copied_rows],
+                input_image->rows[number_of_copied_rows],
+                row_size
+            );
+        }
+
+        if (status) {
+            ips_update_image_rows(
+                group, filter, 1,
+                input_image, output_image,
+                y, last_row,
+                tile_height
+            );
+
+            if (y == 0 && first_tiles_milliseconds) {
+                *first_tiles_milliseconds =
+                    (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+            }
+        }
+    }
+
+    ips_wait_for_image_processing_tasks(group);
+    ips_merge_pass_data(group, reductions);
+    ips_replicate_intermediate_image_aprons(group, filter);
+
+    if (status) {
+        ips_apply_filter_passes(group, filter, 2, input_image, output_image);
+    }
+
+    return status;
+}
+
+ips_dirty_tiles_t *ips_create_dirty_tiles(png_uint_32 image_width, png_uint_32 image_height)
+{
+    ips_dirty_tiles_t *tiles =
+        (ips_dirty_tiles_t *) malloc(sizeof(*tiles));
+
+    tiles->image_width =
+        image_width;
+    tiles->image_height =
+        image_height;
+    tiles->tile_width =
+        IPS_MIN(tile_width, image_width);
+    tiles->tile_height =
+        IPS_MIN(tile_height, image_height);
+    tiles->columns =
+        (image_width + tiles->tile_width - 1) / tiles->tile_width;
+    tiles->rows =
+        (image_height + tiles->tile_height - 1) / tiles->tile_height;
+
+    tiles->flags =
+        (unsigned char *) calloc((size_t) tiles->columns * tiles->rows, 1);
+    tiles->previous_flags =
+        (unsigned char *) malloc((size_t) tiles->columns * tiles->rows);
+    tiles->number_of_dirty_tiles = 0;
+
+    return tiles;
+}
+
+void ips_delete_dirty_tiles(ips_dirty_tiles_t *tiles)
+{
+    if (tiles) {
+        free(tiles->previous_flags);
+        free(tiles->flags);
+        free(tiles);
+    }
+}
+
+void ips_clear_dirty_tiles(ips_dirty_tiles_t *tiles)
+{
+    memset(tiles->flags, 0, (size_t) tiles->columns * tiles->rows);
+    tiles->number_of_dirty_tiles = 0;
+}
+
+void ips_mark_dirty_tile(ips_dirty_tiles_t *tiles, png_uint_32 column, png_uint_32 row)
+{
+    unsigned char *flag =
+        &tiles->flags[(size_t) row * tiles->columns + column];
+
+    if (!*flag) {
+        *flag = 1;
+        ++tiles->number_of_dirty_tiles;
+    }
+}
+
+/* Marks every tile that overlaps the pixels [x0, x1) x [y0, y1). */
+void ips_mark_dirty_rectangle(
+         ips_dirty_tiles_t *tiles,
+         png_uint_32 x0, png_uint_32 y0,
+         png_uint_32 x1, png_uint_32 y1
+     )
+{
+    x1 = IPS_MIN(x1, tiles->image_width);
+    y1 = IPS_MIN(y1, tiles->image_height);
+
+    for (png_uint_32 y = y0; y < y1; y += tiles->tile_height - y % tiles->tile_height) {
+        for (png_uint_32 x = x0; x < x1; x += tiles->tile_width - x % tiles->tile_width) {
+            ips_mark_dirty_tile(tiles, x / tiles->tile_width, y / tiles->tile_height);
+        }
+    }
+}
+
+/* Marks the tiles in which two interleaved images of the same size differ. */
+void ips_mark_changed_tiles(
+         ips_dirty_tiles_t *tiles,
+         ips_raw_image_t *old_image,
+         ips_raw_image_t *new_image
+     )
+{
+    unsigned int channels =
+        new_image->channels;
+
+    for (png_uint_32 row = 0; row < tiles->rows; ++row) {
+        png_uint_32 y0 =
+            row * tiles->tile_height;
+        png_uint_32 y1 =
+            IPS_MIN(y0 + tiles->tile_height, tiles->image_height);
+
+        for (png_uint_32 column = 0; column < tiles->columns; ++column) {
+            png_uint_32 x0 =
+                column * tiles->tile_width;
+            png_uint_32 x1 =
+                IPS_MIN(x0 + tiles->tile_width, tiles->image_width);
+
+            for (png_uint_32 y = y0; y < y1; ++y) {
+                if (memcmp(
+                        old_image->rows[y] + x0 * channels,
+                        new_image->rows[y] + x0 * channels,
+                        (x1 - x0) * channels
+                    ) != 0) {
+                    ips_mark_dirty_tile(tiles, column, row);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/* Adds the tiles of another map, all of them if the two maps do not match. */
+void ips_merge_dirty_tiles(ips_dirty_tiles_t *tiles, const ips_dirty_tiles_t *other_tiles)
+{
+    if (tiles->columns     != other_tiles->columns     ||
+            tiles->rows        != other_tiles->rows        ||
+            tiles->tile_width  != other_tiles->tile_width  ||
+            tiles->tile_height != other_tiles->tile_height) {
+        ips_mark_dirty_rectangle(tiles, 0, 0, tiles->image_width, tiles->image_height);
+
+        return;
+    }
+
+    for (size_t i = 0; i < (size_t) tiles->columns * tiles->rows; ++i) {
+        if (other_tiles->flags[i] && !tiles->flags[i]) {
+            tiles->flags[i] = 1;
+            ++tiles->number_of_dirty_tiles;
+        }
+    }
+}
+
+/* Copies the pixels of the dirty tiles between two images of the same size and layout. */
+void ips_copy_image_tiles(
+         ips_raw_image_t *source_image,
+         ips_raw_image_t *destination_image,
+         const ips_dirty_tiles_t *tiles
+     )
+{
+    unsigned int planes =
+        source_image->layout == IPS_LAYOUT_PLANAR ? source_image->channels : 1;
+    size_t pixel_size =
+        source_image->layout == IPS_LAYOUT_PLANAR ? 1 : source_image->channels;
+
+    if (tiles->number_of_dirty_tiles == 0) {
+        return;
+    }
+
+    for (png_uint_32 row = 0; row < tiles->rows; ++row) {
+        png_uint_32 y0 =
+            row * tiles->tile_height;
+        png_uint_32 y1 =
+            IPS_MIN(y0 + tiles->tile_height, tiles->image_height);
+
+        for (png_uint_32 column = 0; column < tiles->columns; ++column) {
+            png_uint_32 first_column = column;
+            if (!tiles->flags[(size_t) row * tiles->columns + column]) {
+                continue;
+            }
+
+            while (column + 1 < tiles->columns &&
+                       tiles->flags[(size_t) row * tiles->columns + column + 1]) {
+                ++column;
+            }
+
+            png_uint_32 x0 =
+                first_column * tiles->tile_width;
+            png_uint_32 x1 =
+                IPS_MIN((column + 1) * tiles->tile_width, tiles->image_width);
+
+            for (unsigned int plane = 0; plane < planes; ++plane) {
+                for (png_uint_32 y = y0; y < y1; ++y) {
+                    memcpy(
+                        destination_image->rows[y] + plane * destination_image->channel_step + x0 * pixel_size,
+                        source_image->rows[y] + plane * source_image->channel_step + x0 * pixel_size,
+                        (x1 - x0) * pixel_size
+                    );
+                }
+            }
+        }
+    }
+}
+
+/*
+    Grows the dirty tiles by a kernel footprint: a pass that reads radius
+    pixels around every output pixel changes its output up to radius pixels
+    away from a changed input pixel.
+*/
+void ips_dilate_dirty_tiles(ips_dirty_tiles_t *tiles, unsigned int radius)
+{
+    long reach_x =
+        (long) ((radius + tiles->tile_width - 1) / tiles->tile_width);
+    long reach_y =
+        (long) ((radius + tiles->tile_height - 1) / tiles->tile_height);
+
+    if (radius == 0 || tiles->number_of_dirty_tiles == 0) {
+        return;
+    }
+
+    memcpy(tiles->previous_flags, tiles->flags, (size_t) tiles->columns * tiles->rows);
+
+    for (long row = 0; row < (long) tiles->rows; ++row) {
+        for (long column = 0; column < (long) tiles->columns; ++column) {
+            if (!tiles->previous_flags[row * tiles->columns + column]) {
+                continue;
+            }
+
+            for (long y = IPS_MAX(row - reach_y, 0L); y <= IPS_MIN(row + reach_y, (long) tiles->rows - 1); ++y) {
+                for (long x = IPS_MAX(column - reach_x, 0L); x <= IPS_MIN(column + reach_x, (long) tiles->columns - 1); ++x) {
+                    ips_mark_dirty_tile(tiles, (png_uint_32) x, (png_uint_32) y);
+                }
+            }
+        }
+    }
+}
+
+/*
+    A reduction that a later pass reads depends on every tile, so filters
+    with one have to be applied to the whole image.
+*/
+int ips_can_update_dirty_tiles(const ips_filter_t *filter)
+{
+    for (unsigned int pass = 1; pass < filter->number_of_passes; ++pass) {
+        if (filter->passes[pass - 1].reductions != IPS_REDUCTION_NONE) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+    Publishes the dirty tiles of one pass of a filter. Strip passes get
+    one task per vertical run of dirty tiles, so that their per-column state
+    is set up once per run.
+*/
+void ips_update_dirty_tiles(
+         ips_task_group_t *group,
+         const ips_filter_t *filter,
+         unsigned int pass,
+         ips_raw_image_t *input_image,
+         ips_raw_image_t *output_image,
+         const ips_dirty_tiles_t *tiles
+     )
+{
+    int should_merge_rows =
+        filter->passes[pass - 1].tiling == IPS_TILING_VERTICAL_STRIPS;
+
+    for (png_uint_32 column = 0; column < tiles->columns; ++column) {
+        png_uint_32 x0 =
+            column * tiles->tile_width;
+        png_uint_32 x1 =
+            IPS_MIN(x0 + tiles->tile_width, tiles->image_width);
+
+        for (png_uint_32 row = 0; row < tiles->rows; ++row) {
+            png_uint_32 first_row = row;
+            if (!tiles->flags[(size_t) row * tiles->columns + column]) {
+                continue;
+            }
+
+            while (should_merge_rows &&
+                       row + 1 < tiles->rows &&
+                       tiles->flags[(size_t) (row + 1) * tiles->columns + column]) {
+                ++row;
+            }
+
+            ips_push_filter_task(
+                group, filter, pass,
+                input_image, output_image,
+                x0, first_row * tiles->tile_height,
+                x1, IPS_MIN((row + 1) * tiles->tile_height, tiles->image_height)
+            );
+        }
+    }
+}
+
+/*
+    Recomputes only what a change of the input in the dirty tiles affects.
+    The output and the intermediate images have to hold the result of the
+    same filter for the previous input. The tiles are dilated by the radius
+    of every pass and end up marking the output tiles that changed. Returns
+    0 if the generation of the group became stale.
+*/
+int ips_apply_filter_to_dirty_tiles(
+        ips_task_group_t *group,
+        const ips_filter_t *filter,
+        ips_raw_image_t *input_image,
+        ips_raw_image_t *output_image,
+        ips_dirty_tiles_t *tiles
+    )
+{
+    ips_prepare_intermediate_images(group, filter, input_image);
+
+    for (unsigned int pass = 1; pass <= filter->number_of_passes; ++pass) {
+        unsigned int reductions =
+            filter->passes[pass - 1].reductions;
+
+        ips_dilate_dirty_tiles(tiles, ips_get_pass_radius(filter, pass));
+
+        reset_pass_data(group, reductions);
+        ips_update_dirty_tiles(group, filter, pass, input_image, output_image, tiles);
+        ips_wait_for_image_processing_tasks(group);
+        if (ips_is_generation_stale(group, group->generation)) {
+            return 0;
+        }
+        ips_merge_pass_data(group, reductions);
+        ips_replicate_intermediate_image_aprons(group, filter);
+    }
+
+    return 1;
+}
+
+/*
+    Computes the output of a filter in the given tiles only, e.g., the ones
+    on screen. Every pass before the last also computes the tiles that the
+    radius of the pass after it reaches. A reduction read by a later pass
+    would only cover these tiles. Returns 0 if the generation of the group
+    became stale.
+*/
+int ips_apply_filter_to_tiles(
+        ips_task_group_t *group,
+        const ips_filter_t *filter,
+        ips_raw_image_t *input_image,
+        ips_raw_image_t *output_image,
+        const ips_dirty_tiles_t *tiles
+    )
+{
+    ips_dirty_tiles_t *pass_tiles[IPS_MAXIMUM_PASSES];
+    int status = 1;
+
+    ips_prepare_intermediate_images(group, filter, input_image);
+
+    for (unsigned int pass = filter->number_of_passes; pass >= 1; --pass) {
+        pass_tiles[pass - 1] =
+            ips_create_dirty_tiles(tiles->image_width, tiles->image_height);
+
+        if (pass == filter->number_of_passes) {
+            ips_merge_dirty_tiles(pass_tiles[pass - 1], tiles);
+        } else {
+            ips_merge_dirty_tiles(pass_tiles[pass - 1], pass_tiles[pass]);
+            ips_dilate_dirty_tiles(pass_tiles[pass - 1], ips_get_pass_radius(filter, pass + 1));
+        }
+    }
+
+    for (unsigned int pass = 1; pass <= filter->number_of_passes && status; ++pass) {
+        unsigned int reductions =
+            filter->passes[pass - 1].reductions;
+
+        reset_pass_data(group, reductions);
+        ips_update_dirty_tiles(group, filter, pass, input_image, output_image, pass_tiles[pass - 1]);
+        ips_wait_for_image_processing_tasks(group);
+        if (ips_is_generation_stale(group, group->generation)) {
+            status = 0;
+        } else {
+            ips_merge_pass_data(group, reductions);
+            ips_replicate_intermediate_image_aprons(group, filter);
+        }
+    }
+
+    for (unsigned int pass = 1; pass <= filter->number_of_passes; ++pass) {
+        ips_delete_dirty_tiles(pass_tiles[pass - 1]);
+    }
+
+    return status;
+}
+
+/* Lays out the levels below an image in one block, ips_build_pyramid computes them. */
+ips_pyramid_t *ips_create_pyramid(ips_raw_image_t *image)
+{
+    ips_pyramid_t *pyramid =
+        (ips_pyramid_t *) malloc(sizeof(*pyramid));
+    size_t offsets[IPS_MAXIMUM_LEVELS], size = 0;
+
+    pyramid->levels[0] = image;
+    pyramid->number_of_levels = 1;
+
+    while (pyramid->number_of_levels < IPS_MAXIMUM_LEVELS) {
+        ips_raw_image_t *previous_level =
+            pyramid->levels[pyramid->number_of_levels - 1];
+        if (previous_level->width == 1 && previous_level->height == 1) {
+            break;
+        }
+
+        ips_raw_image_t *level =
+            ips_create_image_header(
+                IPS_MAX(previous_level->width / 2, 1u),
+                IPS_MAX(previous_level->height / 2, 1u),
+                previous_level->channels,
+                0, previous_level->layout
+            );
+
+        /* Strides are multiples of the row alignment, so every level starts aligned */
+        offsets[pyramid->number_of_levels] = size;
+        size += ips_get_image_data_size(level);
+
+        pyramid->levels[pyramid->number_of_levels++] = level;
+    }
+
+    pyramid->data =
+        size > 0 ? (png_bytep) ips_utils_aligned_malloc(size, IPS_ROW_ALIGNMENT) : NULL;
+    for (unsigned int level = 1; level < pyramid->number_of_levels; ++level) {
+        ips_set_image_data(pyramid->levels[level], pyramid->data + offsets[level]);
+    }
+
+    return pyramid;
+}
+
+/* Computes every level from the one above it, the tiles of a level run in parallel. */
+void ips_build_pyramid(ips_task_group_t *group, ips_pyramid_t *pyramid)
+{
+    for (unsigned int level = 1; level < pyramid->number_of_levels; ++level) {
+        ips_reset_task_arena(group->task_arena);
+        ips_apply_filter(group, &Downsample_Filter, pyramid->levels[level - 1], pyramid->levels[level]);
+    }
+}
+
+/*
+    Recomputes the parts of the levels below the given tiles of the first
+    one. A rectangle of one level reaches half of it, rounded outwards, on
+    the next.
+*/
+void ips_update_pyramid(ips_task_group_t *group, ips_pyramid_t *pyramid, const ips_dirty_tiles_t *tiles)
+{
+    const ips_dirty_tiles_t *previous_level_tiles = tiles;
+    ips_dirty_tiles_t *level_tiles = NULL;
+
+    for (unsigned int level = 1;
+             level < pyramid->number_of_levels && previous_level_tiles->number_of_dirty_tiles > 0;
+             ++level) {
+        ips_raw_image_t *level_image =
+            pyramid->levels[level];
+        ips_dirty_tiles_t *next_level_tiles =
+            ips_create_dirty_tiles(level_image->width, level_image->height);
+
+        for (png_uint_32 row = 0; row < previous_level_tiles->rows; ++row) {
+            for (png_uint_32 column = 0; column < previous_level_tiles->columns; ++column) {
+                if (!previous_level_tiles->flags[(size_t) row * previous_level_tiles->columns + column]) {
+                    continue;
+                }
+
+                png_uint_32 x0 =
+                    column * previous_level_tiles->tile_width;
+                png_uint_32 y0 =
+                    row * previous_level_tiles->tile_height;
+                png_uint_32 x1 =
+                    IPS_MIN(x0 + previous_level_tiles->tile_width, previous_level_tiles->image_width);
+                png_uint_32 y1 =
+                    IPS_MIN(y0 + previous_level_tiles->tile_height, previous_level_tiles->image_height);
+
+                ips_mark_dirty_rectangle(
+                    next_level_tiles,
+                    x0 / 2, y0 / 2,
+                    IPS_MIN((x1 + 1) / 2, level_image->width),
+                    IPS_MIN((y1 + 1) / 2, level_image->height)
+                );
+            }
+        }
+
+        ips_reset_task_arena(group->task_arena);
+        ips_apply_filter_to_tiles(group, &Downsample_Filter, pyramid->levels[level - 1], level_image, next_level_tiles);
+
+        ips_delete_dirty_tiles(level_tiles);
+        level_tiles = next_level_tiles;
+        previous_level_tiles = next_level_tiles;
+    }
+
+    ips_delete_dirty_tiles(level_tiles);
+}
+
+void ips_delete_pyramid(ips_pyramid_t *pyramid)
+{
+    if (pyramid) {
+        for (unsigned int level = 1; level < pyramid->number_of_levels; ++level) {
+            ips_delete_image_view(pyramid->levels[level]);
+        }
+        if (pyramid->data) {
+            ips_utils_aligned_free(pyramid->data);
+        }
+
+        free(pyramid);
+    }
+}
+
+const ips_filter_t *ips_find_filter(const char *name)
+{
+    for (size_t i = 0; i < Number_Of_Filters; ++i) {
+        if (strcmp(Filters[i].name, name) == 0) {
+            return &Filters[i];
+        }
+    }
+
+    return NULL;
+}
+
+void ips_set_brightness_and_contrast(ips_task_t *task)
+{
+    png_uint_32 x, y;
+    png_bytep source_pixel, destination_pixel;
+
+    int channel;
+
+    float minimum[3] = {  FLT_MAX,  FLT_MAX,  FLT_MAX },
+          maximum[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+    ips_raw_image_t *input_image =
+        task->input_image;
+    ips_raw_image_t *output_image =
+        task->output_image;
+    float new_image_brightness =
+        ((float *) task->image_processing_parameters)[0];
+    float new_image_contrast =
+        ((float *) task->image_processing_parameters)[1];
+    unsigned int channels =
+        output_image->channels;
+    size_t source_pixel_step =
+        input_image->pixel_step,
+           source_channel_step =
+        input_image->channel_step;
+    size_t destination_pixel_step =
+        output_image->pixel_step,
+           destination_channel_step =
+        output_image->channel_step;
+
+    for (y = task->y0; y < task->y1; ++y) {
+        for (x = task->x0; x < task->x1; ++x) {
+            source_pixel = &(input_image->rows[y][x * source_pixel_step]);
+            destination_pixel = &(output_image->rows[y][x * destination_pixel_step]);
+            for (channel = 0; channel < 3; ++channel) {
+                float newValue =
+                    new_image_contrast * source_pixel[channel * source_channel_step] + new_image_brightness;
+                newValue =
+                    IPS_CLAMP(newValue, 0.0f, 255.0f);
+
+                minimum[channel] =
+                    IPS_MIN(minimum[channel], newValue);
+                maximum[channel] =
+                    IPS_MAX(maximum[channel], newValue);
+
+                destination_pixel[channel * destination_channel_step] =
+                    (png_byte) newValue;
+            }
+            if (channels == 4) {
+                destination_pixel[3 * destination_channel_step] =
+                    source_pixel[3 * source_channel_step];
+            }
+        }
+    }
+
+    for (channel = 0; channel < 3; ++channel) {
+        task->reduction->minimum[channel] =
+            IPS_MIN(task->reduction->minimum[channel], minimum[channel]);
+        task->reduction->maximum[channel] =
+            IPS_MAX(task->reduction->maximum[channel], maximum[channel]);
+    }
+}
+
+/* Pass 1 of normalization: per-channel range of the input. */
+void ips_find_channel_range(ips_task_t *task)
+{
+    png_uint_32 x, y;
+    png_bytep source_pixel;
+
+    int channel;
+
+    float minimum[3] = {  FLT_MAX,  FLT_MAX,  FLT_MAX },
+          maximum[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+    ips_raw_image_t *input_image =
+        task->input_image;
+    size_t pixel_step =
+        input_image->pixel_step,
+           channel_step =
+        input_image->channel_step;
+
+    for (y = task->y0; y < task->y1; ++y) {
+        for (x = task->x0; x < task->x1; ++x) {
+            source_pixel = &(input_image->rows[y][x * pixel_step]);
+            for (channel = 0; channel < 3; ++channel) {
+                minimum[channel] =
+                    IPS_MIN(minimum[channel], source_pixel[channel * channel_step]);
+                maximum[channel] =
+                    IPS_MAX(maximum[channel], source_pixel[channel * channel_step]);
+            }
+        }
+    }
+
+    for (channel = 0; channel < 3; ++channel) {
+        task->reduction->minimum[channel] =
+            IPS_MIN(task->reduction->minimum[channel], minimum[channel]);
+        task->reduction->maximum[channel] =
+            IPS_MAX(task->reduction->maximum[channel], maximum[channel]);
+    }
+}
+
+/* Pass 2 of normalization: stretches every channel to [0, 255]. */
+void ips_normalize(ips_task_t *task)
+{
+    png_uint_32 x, y;
+    png_bytep source_pixel, destination_pixel;
+
+    int channel;
+
+    float offset[3], scale[3];
+
+    ips_raw_image_t *input_image =
+        task->input_image;
+    ips_raw_image_t *output_image =
+        task->output_image;
+    unsigned int channels =
+        output_image->channels;
+    size_t source_pixel_step =
+        input_image->pixel_step,
+           source_channel_step =
+        input_image->channel_step;
+    size_t destination_pixel_step =
+        output_image->pixel_step,
+           destination_channel_step =
+        output_image->channel_step;
+
+    for (channel = 0; channel < 3; ++channel) {
+        float minimum =
+            task->pass_reduction->minimum[channel];
+        float maximum =
+            task->pass_reduction->maximum[channel];
+
+        offset[channel] =
+            minimum;
+        scale[channel] =
+            maximum > minimum ? 255.0f / (maximum - minimum) : 1.0f;
+    }
+
+    for (y = task->y0; y < task->y1; ++y) {
+        for (x = task->x0; x < task->x1; ++x) {
+            source_pixel = &(input_image->rows[y][x * source_pixel_step]);
+            destination_pixel = &(output_image->rows[y][x * destination_pixel_step]);
+            for (channel = 0; channel < 3; ++channel) {
+                float newValue =
+                    (source_pixel[channel * source_channel_step] - offset[channel]) * scale[channel];
+
+                destination_pixel[channel * destination_channel_step] =
+                    (png_byte) IPS_CLAMP(newValue, 0.0f, 255.0f);
+            }
+            if (channels == 4) {
+                destination_pixel[3 * destination_channel_step] =
+                    source_pixel[3 * source_channel_step];
+            }
+        }
+    }
+}
+
+/* Pass 1 of Sobel: 8-bit luminance of the input in intermediate image 0. */
+void ips_compute_luminance(ips_task_t *task)
+{
+    png_uint_32 x, y;
+    png_bytep source_pixel, destination_row;
+
+    ips_raw_image_t *input_image =
+        task->input_image;
+    ips_raw_image_t *luminance_image =
+        task->intermediate_images[0];
+    size_t pixel_step =
+        input_image->pixel_step,
+           channel_step =
+        input_image->channel_step;
+
+    for (y = task->y0; y < task->y1; ++y) {
+        destination_row = luminance_image->rows[y];
+        for (x = task->x0; x < task->x1; ++x) {
+            source_pixel = &(input_image->rows[y][x * pixel_step]);
+
+            /* BT.601 weights in 8-bit fixed point */
+            destination_row[x] =
+                (png_byte) ((77 * source_pixel[0] +
+                             150 * source_pixel[channel_step] +
+                             29 * source_pixel[2 * channel_step] + 128) >> 8);
+        }
+    }
+}
+
+/* Writes a gradient magnitude or direction to the color channels of an output pixel. */
+static inline void ips_store_sobel_value(
+                       ips_task_t *task,
+                       png_uint_32 x, png_uint_32 y,
+                       png_byte value
+                   )
+{
+    ips_raw_image_t *input_image =
+        task->input_image;
+    ips_raw_image_t *output_image =
+        task->output_image;
+    size_t channel_step =
+        output_image->channel_step;
+    png_bytep destination_pixel =
+        &(output_image->rows[y][x * output_image->pixel_step]);
+
+    destination_pixel[0] = value;
+    destination_pixel[channel_step] = value;
+    destination_pixel[2 * channel_step] = value;
+    if (output_image->channels == 4) {
+        destination_pixel[3 * channel_step] =
+            input_image->rows[y][x * input_image->pixel_step + 3 * input_image->channel_step];
+    }
+}
+
+#ifdef IPS_SSSE3
+static const signed char Sobel_Rgb_Shuffle_Masks[3][16] = {
+    {  0,  0,  0,  1,  1,  1,  2,  2,  2,  3,  3,  3,  4,  4,  4,  5 },
+    {  5,  5,  6,  6,  6,  7,  7,  7,  8,  8,  8,  9,  9,  9, 10, 10 },
+    { 10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15 }
+};
+
+/* Spreads 16 gradient values over the three channels of 16 RGB pixels. */
+IPS_TARGET_SSSE3
+static void ips_store_sobel_rgb_values_ssse3(png_bytep destination, __m128i values)
+{
+    for (int i = 0; i < 3; ++i) {
+        _mm_storeu_si128(
+            (__m128i *) (destination + 16 * i),
+            _mm_shuffle_epi8(values, _mm_loadu_si128((const __m128i *) Sobel_Rgb_Shuffle_Masks[i]))
+        );
+    }
+}
+#endif
+
+#ifdef IPS_SSE2
+/*
+    Writes 16 gradient values to the color channels of the output pixels
+    from x on with whole vectors and copies their alpha from the input.
+    Interleaved RGB needs SSSE3, see ips_can_store_sobel_vectors.
+*/
+static inline void ips_store_sobel_values_sse2(
+                       ips_task_t *task,
+                       png_uint_32 x, png_uint_32 y,
+                       __m128i values
+                   )
+{
+    ips_raw_image_t *input_image =
+        task->input_image;
+    ips_raw_image_t *output_image =
+        task->output_image;
+    const png_byte *source =
+        input_image->rows[y] + x * input_image->pixel_step;
+    png_bytep destination =
+        output_image->rows[y] + x * output_image->pixel_step;
+
+    if (output_image->layout == IPS_LAYOUT_PLANAR) {
+        for (unsigned int channel = 0; channel < 3; ++channel) {
+            _mm_storeu_si128((__m128i *) (destination + channel * output_image->channel_step), values);
+        }
+        if (output_image->channels == 4) {
+            _mm_storeu_si128(
+                (__m128i *) (destination + 3 * output_image->channel_step),
+                _mm_loadu_si128((const __m128i *) (source + 3 * input_image->channel_step))
+            );
+        }
+    } else if (output_image->channels == 4) {
+        const __m128i alpha_mask =
+            _mm_set1_epi32((int) 0xFF000000);
+        __m128i pairs[2] = {
+            _mm_unpacklo_epi8(values, values),
+            _mm_unpackhi_epi8(values, values)
+        };
+
+        for (int i = 0; i < 4; ++i) {
+            __m128i pixels =
+                i & 1 ?
+                    _mm_unpackhi_epi16(pairs[i >> 1], pairs[i >> 1]) :
+                    _mm_unpacklo_epi16(pairs[i >> 1], pairs[i >> 1]);
+
+            _mm_storeu_si128(
+                (__m128i *) (destination + 16 * i),
+                _mm_or_si128(
+                    _mm_andnot_si128(alpha_mask, pixels),
+                    _mm_and_si128(alpha_mask, _mm_loadu_si128((const __m128i *) (source + 16 * i)))
+                )
+            );
+        }
+    } else {
+#ifdef IPS_SSSE3
+        ips_store_sobel_rgb_values_ssse3(destination, values);
+#endif
+    }
+}
+
+/*
+    The vector kernels write whole vectors of output pixels. Inputs and
+    outputs have to share a layout, and interleaved RGB is spread with
+    SSSE3 shuffles.
+*/
+static inline int ips_can_store_sobel_vectors(ips_task_t *task)
+{
+    ips_raw_image_t *output_image =
+        task->output_image;
+
+    return
+        task->input_image->layout == output_image->layout &&
+        task->input_image->channels == output_image->channels &&
+        (output_image->layout == IPS_LAYOUT_PLANAR ||
+         output_image->channels == 4 ||
+         simd_level >= IPS_SIMD_SSSE3);
+}
+
+/*
+    Processes 16 pixels per iteration from x0 to x1. The last vector is
+    moved back to end at x1 and overlaps the previous one. Tiles narrower
+    than a vector are only processed at the right border of the image,
+    where the vector ends in the row slack, otherwise x0 is returned. Reads
+    up to 16 pixels past x1 and one before x0, which the apron and the row
+    slack of the luminance image cover. Returns the first pixel it did not
+    process. The separable form is used: a vertical [1 2 1] smoothing
+    followed by a horizontal [-1 0 1] difference for Gx, and a vertical
+    [-1 0 1] difference followed by a horizontal [1 2 1] smoothing for Gy.
+    The result is bit-exact with the scalar path.
+*/
+png_uint_32 ips_apply_sobel_to_row_sse2(
+                const png_byte *above,
+                const png_byte *row,
+                const png_byte *below,
+                png_uint_32 x0, png_uint_32 x1,
+                ips_task_t *task, png_uint_32 y
+            )
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    png_uint_32 x = x0;
+
+    if (!ips_can_store_sobel_vectors(task) ||
+            (x1 - x0 < 16 && x1 < task->output_image->width)) {
+        return x0;
+    }
+
+    for (; x < x1; x += 16) {
+        __m128i result[2];
+
+        if (x + 16 > x1 && x1 - x0 >= 16) {
+            x = x1 - 16;
+        }
+
+        __m128i a[3], r[3], b[3];
+        for (int i = 0; i < 3; ++i) {
+            a[i] = _mm_loadu_si128((const __m128i *) (above + x - 1 + i));
+            r[i] = _mm_loadu_si128((const __m128i *) (row   + x - 1 + i));
+            b[i] = _mm_loadu_si128((const __m128i *) (below + x - 1 + i));
+        }
+
+        for (int half = 0; half < 2; ++half) {
+            __m128i smooth[3], difference[3];
+            for (int i = 0; i < 3; ++i) {
+                __m128i a16, r16, b16;
+                if (half == 0) {
+                    a16 = _mm_unpacklo_epi8(a[i], zero);
+                    r16 = _mm_unpacklo_epi8(r[i], zero);
+                    b16 = _mm_unpacklo_epi8(b[i], zero);
+                } else {
+                    a16 = _mm_unpackhi_epi8(a[i], zero);
+                    r16 = _mm_unpackhi_epi8(r[i], zero);
+                    b16 = _mm_unpackhi_epi8(b[i], zero);
+                }
+
+                smooth[i] =
+                    _mm_add_epi16(_mm_add_epi16(a16, b16), _mm_slli_epi16(r16, 1));
+                difference[i] =
+                    _mm_sub_epi16(b16, a16);
+            }
+
+            __m128i gx =
+                _mm_sub_epi16(smooth[2], smooth[0]);
+            __m128i gy =
+                _mm_add_epi16(
+                    _mm_add_epi16(difference[0], difference[2]),
+                    _mm_slli_epi16(difference[1], 1)
+                );
+
+            gx = _mm_max_epi16(gx, _mm_sub_epi16(zero, gx));
+            gy = _mm_max_epi16(gy, _mm_sub_epi16(zero, gy));
+
+            result[half] =
+                _mm_srli_epi16(_mm_add_epi16(gx, gy), 1);
+        }
+
+        ips_store_sobel_values_sse2(
+            task, x, y,
+            _mm_packus_epi16(result[0], result[1])
+        );
+    }
+
+    return x1;
+}
+#endif
+
+#ifdef IPS_AVX2
+/*
+    The same as the SSE2 kernel with 32 pixels per iteration, tiles
+    narrower than that are left to the SSE2 one.
+*/
+IPS_TARGET_AVX2
+png_uint_32 ips_apply_sobel_to_row_avx2(
+                const png_byte *above,
+                const png_byte *row,
+                const png_byte *below,
+                png_uint_32 x0, png_uint_32 x1,
+                ips_task_t *task, png_uint_32 y
+            )
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    png_uint_32 x = x0;
+    int is_interleaved_rgb =
+        task->output_image->layout == IPS_LAYOUT_INTERLEAVED &&
+        task->output_image->channels == 3;
+
+    if (!ips_can_store_sobel_vectors(task) || x1 - x0 < 32) {
+        return x0;
+    }
+
+    for (; x < x1; x += 32) {
+        __m256i result[2], values;
+
+        if (x + 32 > x1) {
+            x = x1 - 32;
+        }
+
+        for (int half = 0; half < 2; ++half) {
+            __m256i smooth[3], difference[3];
+            long offset = (long) x - 1 + half * 16;
+
+            for (int i = 0; i < 3; ++i) {
+                __m256i a16 =
+                    _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (above + offset + i)));
+                __m256i r16 =
+                    _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (row   + offset + i)));
+                __m256i b16 =
+                    _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (below + offset + i)));
+
+                smooth[i] =
+                    _mm256_add_epi16(_mm256_add_epi16(a16, b16), _mm256_slli_epi16(r16, 1));
+                difference[i] =
+                    _mm256_sub_epi16(b16, a16);
+            }
+
+            __m256i gx =
+                _mm256_sub_epi16(smooth[2], smooth[0]);
+            __m256i gy =
+                _mm256_add_epi16(
+                    _mm256_add_epi16(difference[0], difference[2]),
+                    _mm256_slli_epi16(difference[1], 1)
+                );
+
+            gx = _mm256_abs_epi16(gx);
+            gy = _mm256_abs_epi16(gy);
+
+            result[half] =
+                _mm256_srli_epi16(_mm256_add_epi16(gx, gy), 1);
+        }
+
+        /* packus works within 128-bit lanes, restore the pixel order */
+        values =
+            _mm256_permute4x64_epi64(
+                _mm256_packus_epi16(result[0], result[1]),
+                0xD8
+            );
+        if (is_interleaved_rgb) {
+            /* The shuffles of ips_store_sobel_rgb_values_ssse3 without a call out of AVX code */
+            png_bytep destination =
+                task->output_image->rows[y] + x * 3;
+            for (int i = 0; i < 6; ++i) {
+                _mm_storeu_si128(
+                    (__m128i *) (destination + 16 * i),
+                    _mm_shuffle_epi8(
+                        i < 3 ? _mm256_castsi256_si128(values) : _mm256_extracti128_si256(values, 1),
+                        _mm_loadu_si128((const __m128i *) Sobel_Rgb_Shuffle_Masks[i % 3])
+                    )
+                );
+            }
+        } else {
+            ips_store_sobel_values_sse2(task, x, y, _mm256_castsi256_si128(values));
+            ips_store_sobel_values_sse2(task, x + 16, y, _mm256_extracti128_si256(values, 1));
+        }
+    }
+
+    (void) zero;
+
+    return x1;
+}
+#endif
+
+/* Scalar Sobel for one pixel, also the reference for the vector kernels. */
+static inline void ips_apply_sobel_to_pixel(
+                       const png_byte *above,
+                       const png_byte *row,
+                       const png_byte *below,
+                       png_uint_32 x, png_uint_32 y,
+                       ips_task_t *task,
+                       int should_compute_direction
+                   )
+{
+    long left  = (long) x - 1,
+         right = (long) x + 1;
+
+    int smooth_left =
+        above[left]  + 2 * row[left]  + below[left];
+    int smooth_right =
+        above[right] + 2 * row[right] + below[right];
+
+    int difference_left =
+        below[left]  - above[left];
+    int difference_center =
+        below[x]     - above[x];
+    int difference_right =
+        below[right] - above[right];
+
+    int gx =
+        smooth_right - smooth_left;
+    int gy =
+        difference_left + 2 * difference_center + difference_right;
+
+    if (should_compute_direction) {
+        float angle =
+            atan2f((float) gy, (float) gx);
+
+        ips_store_sobel_value(
+            task, x, y,
+            (png_byte) ((angle + (float) M_PI) * 255.0f / (2.0f * (float) M_PI) + 0.5f)
+        );
+    } else {
+        int magnitude =
+            (abs(gx) + abs(gy)) >> 1;
+
+        ips_store_sobel_value(
+            task, x, y,
+            (png_byte) IPS_MIN(magnitude, 255)
+        );
+    }
+}
+
+/*
+    Pass 2 of Sobel: gradient of the luminance with replicated borders, which
+    are read from the apron of the luminance image. The
+    magnitude (|Gx| + |Gy|) / 2 saturated to 255 goes to the color channels
+    of the output, or with --sobel-direction the angle of the gradient from
+    -pi to pi mapped to [0, 255].
+*/
+void ips_apply_sobel(ips_task_t *task)
+{
+    png_uint_32 x, y;
+
+    ips_raw_image_t *luminance_image =
+        task->intermediate_images[0];
+    ips_sobel_parameters_t *parameters =
+        (ips_sobel_parameters_t *) task->image_processing_parameters;
+    int should_compute_direction =
+        parameters->should_compute_direction;
+
+    /* The apron of the luminance replicates the borders, no clamping needed */
+    for (y = task->y0; y < task->y1; ++y) {
+        const png_byte *above =
+            luminance_image->rows[(long) y - 1];
+        const png_byte *row =
+            luminance_image->rows[y];
+        const png_byte *below =
+            luminance_image->rows[(long) y + 1];
+
+        x = task->x0;
+
+        /* Directions need Gx and Gy themselves, only the scalar path keeps them */
+        if (!should_compute_direction) {
+#ifdef IPS_AVX2
+            if (simd_level >= IPS_SIMD_AVX2) {
+                x = ips_apply_sobel_to_row_avx2(above, row, below, x, task->x1, task, y);
+            }
+#endif
+#ifdef IPS_SSE2
+            if (simd_level >= IPS_SIMD_SSE2) {
+                x = ips_apply_sobel_to_row_sse2(above, row, below, x, task->x1, task, y);
+            }
+#endif
+        }
+
+        for (; x < task->x1; ++x) {
+            ips_apply_sobel_to_pixel(above, row, below, x, y, task, should_compute_direction);
+        }
+    }
+}
+
+static inline png_uint_32 ips_clamp_coordinate(long coordinate, png_uint_32 size)
+{
+    return
+        coordinate < 0 ? 0 :
+            ((png_uint_32) coordinate >= size ? size - 1 : (png_uint_32) coordinate);
+}
+
+static inline void ips_add_to_median_histogram(ips_median_histogram_t *histogram, png_byte value)
+{
+    ++histogram->coarse[value >> 4];
+    ++histogram->fine[value];
+}
+
+static inline void ips_remove_from_median_histogram(ips_median_histogram_t *histogram, png_byte value)
+{
+    --histogram->coarse[value >> 4];
+    --histogram->fine[value];
+}
+
+/* bins += added - removed for the 16 bins of a coarse level or a fine segment. */
+static inline void ips_slide_median_bins(Uint16 *bins, const Uint16 *added, const Uint16 *removed)
+{
+#ifdef IPS_SSE2
+    if (simd_level >= IPS_SIMD_SSE2) {
+        for (int i = 0; i < 16; i += 8) {
+            _mm_storeu_si128(
+                (__m128i *) (bins + i),
+                _mm_sub_epi16(
+                    _mm_add_epi16(
+                        _mm_loadu_si128((const __m128i *) (bins + i)),
+                        _mm_loadu_si128((const __m128i *) (added + i))
+                    ),
+                    _mm_loadu_si128((const __m128i *) (removed + i))
+                )
+            );
+        }
+
+        return;
+    }
+#endif
+
+    for (int i = 0; i < 16; ++i) {
+        bins[i] = (Uint16) (bins[i] + added[i] - removed[i]);
+    }
+}
+
+/* bins += added for 16 bins. */
+static inline void ips_add_median_bins(Uint16 *bins, const Uint16 *added)
+{
+#ifdef IPS_SSE2
+    if (simd_level >= IPS_SIMD_SSE2) {
+        for (int i = 0; i < 16; i += 8) {
+            _mm_storeu_si128(
+                (__m128i *) (bins + i),
+                _mm_add_epi16(
+                    _mm_loadu_si128((const __m128i *) (bins + i)),
+                    _mm_loadu_si128((const __m128i *) (added + i))
+                )
+            );
+        }
+
+        return;
+    }
+#endif
+
+    for (int i = 0; i < 16; ++i) {
+        bins[i] = (Uint16) (bins[i] + added[i]);
+    }
+}
+
+/*
+    Returns the first of 16 bins whose running total reaches past rank and
+    adds the counts of the bins before it to count. The vector path finds
+    it without branches from the prefix sums of the bins.
+*/
+static inline unsigned int ips_find_rank_in_median_bins(
+                               const Uint16 *bins,
+                               unsigned int rank,
+                               unsigned int *count
+                           )
+{
+    unsigned int bin = 0;
+
+#ifdef IPS_SSE2
+    if (simd_level >= IPS_SIMD_SSE2) {
+        const __m128i zero = _mm_setzero_si128();
+
+        Uint16 sums[16];
+
+        __m128i low =
+            _mm_loadu_si128((const __m128i *) bins);
+        __m128i high =
+            _mm_loadu_si128((const __m128i *) (bins + 8));
+        __m128i remaining_rank =
+            _mm_set1_epi16((short) (rank - *count));
+
+        low  = _mm_add_epi16(low,  _mm_slli_si128(low,  2));
+        high = _mm_add_epi16(high, _mm_slli_si128(high, 2));
+        low  = _mm_add_epi16(low,  _mm_slli_si128(low,  4));
+        high = _mm_add_epi16(high, _mm_slli_si128(high, 4));
+        low  = _mm_add_epi16(low,  _mm_slli_si128(low,  8));
+        high = _mm_add_epi16(high, _mm_slli_si128(high, 8));
+
+        /* The total of the low half is in its last lane */
+        high =
+            _mm_add_epi16(high, _mm_unpackhi_epi64(_mm_shufflehi_epi16(low, 0xFF), _mm_shufflehi_epi16(low, 0xFF)));
+
+        /* Saturated differences are zero for the running totals that do not reach past rank */
+        __m128i is_before =
+            _mm_packs_epi16(
+                _mm_cmpeq_epi16(_mm_subs_epu16(low, remaining_rank), zero),
+                _mm_cmpeq_epi16(_mm_subs_epu16(high, remaining_rank), zero)
+            );
+        __m128i bytes =
+            _mm_sad_epu8(is_before, zero);
+
+        bin =
+            (unsigned int) (_mm_cvtsi128_si32(bytes) + _mm_extract_epi16(bytes, 4)) / 255;
+
+        if (bin > 0) {
+            _mm_storeu_si128((__m128i *) sums, low);
+            _mm_storeu_si128((__m128i *) (sums + 8), high);
+            *count += sums[bin - 1];
+        }
+
+        return bin;
+    }
+#endif
+
+    while (*count + bins[bin] <= rank) {
+        *count += bins[bin++];
+    }
+
+    return bin;
+}
+
+/*
+    Returns the value with the zero-based rank in the window whose first
+    column histogram is columns[first_column * stride]. The coarse level
+    picks the segment, which is caught up with the columns the window moved
+    by since it was last used, or summed again if that was a whole window
+    ago.
+*/
+static inline png_byte ips_find_window_median_in_columns(
+                           ips_median_window_t *window,
+                           const ips_median_histogram_t *columns,
+                           long first_column, long stride,
+                           long diameter, unsigned int rank
+                       )
+{
+    ips_median_histogram_t *histogram =
+        &window->histogram;
+    unsigned int count = 0;
+    unsigned int segment =
+        ips_find_rank_in_median_bins(histogram->coarse, rank, &count);
+    long column;
+
+    Uint16 *bins =
+        &histogram->fine[segment << 4];
+    long segment_column =
+        window->segment_columns[segment];
+
+    if (segment_column < 0 || first_column - segment_column > diameter) {
+        memset(bins, 0, 16 * sizeof(*bins));
+        for (column = first_column; column < first_column + diameter; ++column) {
+            ips_add_median_bins(bins, &columns[column * stride].fine[segment << 4]);
+        }
+    } else {
+        for (column = segment_column + 1; column <= first_column; ++column) {
+            ips_slide_median_bins(
+                bins,
+                &columns[(column + diameter - 1) * stride].fine[segment << 4],
+                &columns[(column - 1) * stride].fine[segment << 4]
+            );
+        }
+    }
+    window->segment_columns[segment] = first_column;
+
+    return (png_byte) ((segment << 4) + ips_find_rank_in_median_bins(bins, rank, &count));
+}
+
+/*
+    Compare-exchange networks that leave the median of 9 and 25 values in
+    the elements 4 and 12 (Paeth, Devillard). They are expanded with a SORT
+    macro that places the minimum to the first and the maximum to the second
+    element.
+*/
+#define IPS_MEDIAN_OF_9_NETWORK(SORT) \
+    SORT(1, 2)   SORT(4, 5)   SORT(7, 8)   SORT(0, 1)   SORT(3, 4)   \
+    SORT(6, 7)   SORT(1, 2)   SORT(4, 5)   SORT(7, 8)   SORT(0, 3)   \
+    SORT(5, 8)   SORT(4, 7)   SORT(3, 6)   SORT(1, 4)   SORT(2, 5)   \
+    SORT(4, 7)   SORT(4, 2)   SORT(6, 4)   SORT(4, 2)
+
+#define IPS_MEDIAN_OF_25_NETWORK(SORT) \
+    SORT(0, 1)   SORT(3, 4)   SORT(2, 4)   SORT(2, 3)   SORT(6, 7)   \
+    SORT(5, 7)   SORT(5, 6)   SORT(9, 10)  SORT(8, 10)  SORT(8, 9)   \
+    SORT(12, 13) SORT(11, 13) SORT(11, 12) SORT(15, 16) SORT(14, 16) \
+    SORT(14, 15) SORT(18, 19) SORT(17, 19) SORT(17, 18) SORT(21, 22) \
+    SORT(20, 22) SORT(20, 21) SORT(23, 24) SORT(2, 5)   SORT(3, 6)   \
+    SORT(0, 6)   SORT(0, 3)   SORT(4, 7)   SORT(1, 7)   SORT(1, 4)   \
+    SORT(11, 14) SORT(8, 14)  SORT(8, 11)  SORT(12, 15) SORT(9, 15)  \
+    SORT(9, 12)  SORT(13, 16) SORT(10, 16) SORT(10, 13) SORT(20, 23) \
+    SORT(17, 23) SORT(17, 20) SORT(21, 24) SORT(18, 24) SORT(18, 21) \
+    SORT(19, 22) SORT(8, 17)  SORT(9, 18)  SORT(0, 18)  SORT(0, 9)   \
+    SORT(10, 19) SORT(1, 19)  SORT(1, 10)  SORT(11, 20) SORT(2, 20)  \
+    SORT(2, 11)  SORT(12, 21) SORT(3, 21)  SORT(3, 12)  SORT(13, 22) \
+    SORT(4, 22)  SORT(4, 13)  SORT(14, 23) SORT(5, 23)  SORT(5, 14)  \
+    SORT(15, 24) SORT(6, 24)  SORT(6, 15)  SORT(7, 16)  SORT(7, 19)  \
+    SORT(13, 21) SORT(15, 23) SORT(7, 13)  SORT(7, 15)  SORT(1, 9)   \
+    SORT(3, 11)  SORT(5, 17)  SORT(11, 17) SORT(9, 17)  SORT(4, 10)  \
+    SORT(6, 12)  SORT(7, 14)  SORT(4, 6)   SORT(4, 7)   SORT(12, 14) \
+    SORT(10, 14) SORT(6, 7)   SORT(10, 12) SORT(6, 10)  SORT(6, 17)  \
+    SORT(12, 17) SORT(7, 17)  SORT(7, 10)  SORT(12, 18) SORT(7, 12)  \
+    SORT(10, 18) SORT(12, 20) SORT(10, 20) SORT(10, 12)
+
+/* Radius of the windows the sorting networks handle */
+#define IPS_MAXIMUM_MEDIAN_NETWORK_RADIUS 2
+
+/* Median of one channel of a clamped window, for the borders of the networks. */
+static inline png_byte ips_find_window_median(
+                           ips_raw_image_t *image,
+                           png_uint_32 x, png_uint_32 y,
+                           unsigned int channel, long radius
+                       )
+{
+    png_byte values[(2 * IPS_MAXIMUM_MEDIAN_NETWORK_RADIUS + 1) *
+                    (2 * IPS_MAXIMUM_MEDIAN_NETWORK_RADIUS + 1)];
+    int number_of_values = 0;
+
+    for (long dy = -radius; dy <= radius; ++dy) {
+        png_bytep row =
+            image->rows[ips_clamp_coordinate((long) y + dy, image->height)];
+        for (long dx = -radius; dx <= radius; ++dx) {
+            png_byte value =
+                row[ips_clamp_coordinate((long) x + dx, image->width) * image->pixel_step +
+                    channel * image->channel_step];
+
+            int i = number_of_values++;
+            for (; i > 0 && values[i - 1] > value; --i) {
+                values[i] = values[i - 1];
+            }
+            values[i] = value;
+        }
+    }
+
+    return values[number_of_values / 2];
+}
+
+#ifdef IPS_SSE2
+#define IPS_SORT_SSE2(A, B) \
+    { __m128i minimum = _mm_min_epu8(p[A], p[B]); p[B] = _mm_max_epu8(p[A], p[B]); p[A] = minimum; }
+
+/*
+    Runs the median network over 16 bytes at a time. Neighbors of a byte
+    are one pixel, i.e., `pixel_step` bytes, apart, so every channel of an
+    interleaved image gets its own median without deinterleaving, alpha is
+    taken from the center. Planar images are processed one color plane per
+    call. Borders of the image are clamped, so the kernel covers only the
+    interior. The last vector is moved back to end with the interior and
+    overlaps the previous one. Interiors narrower than a vector are only
+    processed at the right border of the image. The vector then runs into
+    the border pixels, which the caller overwrites, and into the row slack.
+    Returns the first pixel that still has to be processed.
+*/
+png_uint_32 ips_apply_median_network_to_row_sse2(
+                ips_task_t *task, png_uint_32 y,
+                png_uint_32 x0, png_uint_32 x1,
+                unsigned int plane
+            )
+{
+    ips_raw_image_t *input_image =
+        task->input_image;
+    ips_raw_image_t *output_image =
+        task->output_image;
+    long radius =
+        ((ips_median_parameters_t *) task->image_processing_parameters)->radius;
+    long step =
+        (long) input_image->pixel_step;
+
+    png_uint_32 first_x = x0;
+    png_uint_32 last_x = x1;
+    if ((long) input_image->width <= 2 * radius) {
+        return x0;
+    }
+    first_x = IPS_MAX(first_x, (png_uint_32) radius);
+    last_x = IPS_MIN(last_x, input_image->width - (png_uint_32) radius);
+    if (first_x >= last_x) {
+        return x0;
+    }
+
+    const png_byte *rows[2 * IPS_MAXIMUM_MEDIAN_NETWORK_RADIUS + 1];
+    for (long dy = -radius; dy <= radius; ++dy) {
+        rows[dy + radius] =
+            input_image->rows[ips_clamp_coordinate((long) y + dy, input_image->height)] +
+                plane * input_image->channel_step;
+    }
+    png_bytep destination_row =
+        output_image->rows[y] + plane * output_image->channel_step;
+
+    const __m128i alpha_mask =
+        step == 4 ?
+            _mm_set1_epi32((int) 0xFF000000) : _mm_setzero_si128();
+
+    size_t offset = first_x * step,
+           end    = last_x * step;
+    if (end - offset < 16 && x1 < input_image->width) {
+        return x0;
+    }
+
+    for (; offset < end; offset += 16) {
+        __m128i p[25], center, median;
+
+        int i = 0;
+        if (offset + 16 > end && end - first_x * step >= 16) {
+            offset = end - 16;
+        }
+        for (long dy = 0; dy <= 2 * radius; ++dy) {
+            for (long dx = -radius; dx <= radius; ++dx) {
+                p[i++] =
+                    _mm_loadu_si128((const __m128i *) (rows[dy] + offset + dx * step));
+            }
+        }
+        center = p[i / 2];
+
+        if (radius == 1) {
+            IPS_MEDIAN_OF_9_NETWORK(IPS_SORT_SSE2)
+            median = p[4];
+        } else {
+            IPS_MEDIAN_OF_25_NETWORK(IPS_SORT_SSE2)
+            median = p[12];
+        }
+
+        median =
+            _mm_or_si128(
+                _mm_andnot_si128(alpha_mask, median),
+                _mm_and_si128(alpha_mask, center)
+            );
+        _mm_storeu_si128((__m128i *) (destination_row + offset), median);
+    }
+
+    return last_x;
+}
+#endif
+
+#ifdef IPS_AVX2
+#define IPS_SORT_AVX2(A, B) \
+    { __m256i minimum = _mm256_min_epu8(p[A], p[B]); p[B] = _mm256_max_epu8(p[A], p[B]); p[A] = minimum; }
+
+/* The same as the SSE2 kernel with 32 bytes per iteration. */
+IPS_TARGET_AVX2
+png_uint_32 ips_apply_median_network_to_row_avx2(
+                ips_task_t *task, png_uint_32 y,
+                png_uint_32 x0, png_uint_32 x1,
+                unsigned int plane
+            )
+{
+    ips_raw_image_t *input_image =
+        task->input_image;
+    ips_raw_image_t *output_image =
+        task->output_image;
+    long radius =
+        ((ips_median_parameters_t *) task->image_processing_parameters)->radius;
+    long step =
+        (long) input_image->pixel_step;
+
+    png_uint_32 first_x = x0;
+    png_uint_32 last_x = x1;
+    if ((long) input_image->width <= 2 * radius) {
+        return x0;
+    }
+    first_x = IPS_MAX(first_x, (png_uint_32) radius);
+    last_x = IPS_MIN(last_x, input_image->width - (png_uint_32) radius);
+    if (first_x >= last_x) {
+        return x0;
+    }
+
+    const png_byte *rows[2 * IPS_MAXIMUM_MEDIAN_NETWORK_RADIUS + 1];
+    for (long dy = -radius; dy <= radius; ++dy) {
+        rows[dy + radius] =
+            input_image->rows[ips_clamp_coordinate((long) y + dy, input_image->height)] +
+                plane * input_image->channel_step;
+    }
+    png_bytep destination_row =
+        output_image->rows[y] + plane * output_image->channel_step;
+
+    const __m256i alpha_mask =
+        step == 4 ?
+            _mm256_set1_epi32((int) 0xFF000000) : _mm256_setzero_si256();
+
+    size_t offset = first_x * step,
+           end    = last_x * step;
+    if (end - offset < 32 && x1 < input_image->width) {
+        return x0;
+    }
+
+    for (; offset < end; offset += 32) {
+        __m256i p[25], center, median;
+
+        int i = 0;
+        if (offset + 32 > end && end - first_x * step >= 32) {
+            offset = end - 32;
+        }
+        for (long dy = 0; dy <= 2 * radius; ++dy) {
+            for (long dx = -radius; dx <= radius; ++dx) {
+                p[i++] =
+                    _mm256_loadu_si256((const __m256i *) (rows[dy] + offset + dx * step));
+            }
+        }
+        center = p[i / 2];
+
+        if (radius == 1) {
+            IPS_MEDIAN_OF_9_NETWORK(IPS_SORT_AVX2)
+            median = p[4];
+        } else {
+            IPS_MEDIAN_OF_25_NETWORK(IPS_SORT_AVX2)
+            median = p[12];
+        }
+
+        median =
+            _mm256_blendv_epi8(median, center, alpha_mask);
+        _mm256_storeu_si256((__m256i *) (destination_row + offset), median);
+    }
+
+    return last_x;
+}
+#endif
+
+/* 3x3 and 5x5 median with vector sorting networks and a scalar border. */
+void ips_apply_median_network(ips_task_t *task)
+{
+    png_uint_32 y;
+
+    ips_raw_image_t *input_image =
+        task->input_image;
+    ips_raw_image_t *output_image =
+        task->output_image;
+    long radius =
+        ((ips_median_parameters_t *) task->image_processing_parameters)->radius;
+    unsigned int channels =
+        input_image->channels;
+    unsigned int color_channels =
+        IPS_MIN(channels, 3);
+    png_uint_32 interior_x0 =
+        IPS_MAX(task->x0, (png_uint_32) radius);
+    int is_planar =
+        input_image->layout == IPS_LAYOUT_PLANAR;
+    unsigned int number_of_planes =
+        is_planar ? color_channels : 1;
+    size_t source_pixel_step =
+        input_image->pixel_step,
+           source_channel_step =
+        input_image->channel_step;
+    size_t destination_pixel_step =
+        output_image->pixel_step,
+           destination_channel_step =
+        output_image->channel_step;
+
+    for (y = task->y0; y < task->y1; ++y) {
+        /* Every plane stops at the same column, x is where the last one did */
+        png_uint_32 vector_x0 =
+            IPS_MIN(interior_x0, task->x1),
+                    x =
+            vector_x0;
+
+        for (unsigned int plane = 0; plane < number_of_planes; ++plane) {
+            x = vector_x0;
+#ifdef IPS_AVX2
+            if (simd_level >= IPS_SIMD_AVX2) {
+                x = ips_apply_median_network_to_row_avx2(task, y, x, task->x1, plane);
+            }
+#endif
+#ifdef IPS_SSE2
+            if (simd_level >= IPS_SIMD_SSE2) {
+                x = ips_apply_median_network_to_row_sse2(task, y, x, task->x1, plane);
+            }
+#endif
+        }
+
+        /* The kernels leave the alpha plane of planar images alone */
+        if (is_planar && channels == 4 && x > vector_x0) {
+            memcpy(
+                output_image->rows[y] + 3 * destination_channel_step + vector_x0,
+                input_image->rows[y] + 3 * source_channel_step + vector_x0,
+                x - vector_x0
+            );
+        }
+
+        /* The left border and everything the kernels left over */
+        png_uint_32 x_ranges[2][2] = {
+            { task->x0, IPS_MIN(interior_x0, task->x1) },
+            { x,        task->x1 }
+        };
+        for (int range = 0; range < 2; ++range) {
+            for (png_uint_32 scalar_x = x_ranges[range][0]; scalar_x < x_ranges[range][1]; ++scalar_x) {
+                png_bytep destination_pixel =
+                    &(output_image->rows[y][scalar_x * destination_pixel_step]);
+
+                for (unsigned int channel = 0; channel < color_channels; ++channel) {
+                    destination_pixel[channel * destination_channel_step] =
+                        ips_find_window_median(input_image, scalar_x, y, channel, radius);
+                }
+                if (channels == 4) {
+                    destination_pixel[3 * destination_channel_step] =
+                        input_image->rows[y][scalar_x * source_pixel_step + 3 * source_channel_step];
+                }
+            }
+        }
+    }
+}
+
+/*
+    Median filter in constant time per pixel (Perreault and Hebert, 2007).
+    Every column of the strip plus the apron keeps a histogram of its
+    2r + 1 pixels, which moves down by one row per output row, and so does
+    the whole histogram of the first window of a row. The coarse level of
+    the window moves right by adding one column and subtracting another,
+    fine segments only catch up when the median falls into them, so the
+    work per pixel does not depend on the radius. Borders are replicated,
+    alpha is copied from the input.
+*/
+void ips_apply_histogram_median(ips_task_t *task)
+{
+    png_uint_32 x, y;
+
+    ips_raw_image_t *input_image =
+        task->input_image;
+    ips_raw_image_t *output_image =
+        task->output_image;
+    long radius =
+        ((ips_median_parameters_t *) task->image_processing_parameters)->radius;
+    long diameter =
+        2 * radius + 1;
+    png_uint_32 width =
+        input_image->width,
+                height =
+        input_image->height;
+    unsigned int channels =
+        input_image->channels;
+    unsigned int color_channels =
+        IPS_MIN(channels, 3);
+    unsigned int rank =
+        (unsigned int) (diameter * diameter / 2);
+    size_t source_pixel_step =
+        input_image->pixel_step,
+           source_channel_step =
+        input_image->channel_step;
+    size_t destination_pixel_step =
+        output_image->pixel_step,
+           destination_channel_step =
+        output_image->channel_step;
+
+    long number_of_columns =
+        (long) (task->x1 - task->x0) + 2 * radius;
+
+    ips_median_window_t windows[3];
+    ips_median_histogram_t first_windows[3];
+    ips_median_histogram_t *columns =
+        (ips_median_histogram_t *) ips_get_worker_scratch(
+                                       task->worker,
+                                       sizeof(*columns) * number_of_columns * color_channels
+                                   );
+
+    memset(columns, 0, sizeof(*columns) * number_of_columns * color_channels);
+
+    for (long column = 0; column < number_of_columns; ++column) {
+        png_uint_32 source_x =
+            ips_clamp_coordinate((long) task->x0 - radius + column, width);
+
+        for (long dy = -radius; dy <= radius; ++dy) {
+            png_bytep row =
+                input_image->rows[ips_clamp_coordinate((long) task->y0 + dy, height)];
+            for (unsigned int channel = 0; channel < color_channels; ++channel) {
+                ips_add_to_median_histogram(
+                    &columns[column * color_channels + channel],
+                    row[source_x * source_pixel_step + channel * source_channel_step]
+                );
+            }
+        }
+    }
+
+    memset(first_windows, 0, sizeof(first_windows));
+    for (long column = 0; column < diameter; ++column) {
+        for (unsigned int channel = 0; channel < color_channels; ++channel) {
+            ips_median_histogram_t *histogram =
+                &columns[column * color_channels + channel];
+
+            ips_add_median_bins(first_windows[channel].coarse, histogram->coarse);
+            for (int segment = 0; segment < 16; ++segment) {
+                ips_add_median_bins(&first_windows[channel].fine[segment << 4], &histogram->fine[segment << 4]);
+            }
+        }
+    }
+
+    for (y = task->y0; y < task->y1; ++y) {
+        /* Strips span the whole image, a newer edit should not wait for the rest of one */
+        if (ips_is_generation_stale(task->group, task->generation)) {
+            return;
+        }
+
+        if (y > task->y0) {
+            png_bytep removed_row =
+                input_image->rows[ips_clamp_coordinate((long) y - radius - 1, height)];
+            png_bytep added_row =
+                input_image->rows[ips_clamp_coordinate((long) y + radius, height)];
+
+            for (long column = 0; column < number_of_columns; ++column) {
+                png_uint_32 source_x =
+                    ips_clamp_coordinate((long) task->x0 - radius + column, width);
+
+                for (unsigned int channel = 0; channel < color_channels; ++channel) {
+                    ips_median_histogram_t *histogram =
+                        &columns[column * color_channels + channel];
+                    png_byte removed_value =
+                        removed_row[source_x * source_pixel_step + channel * source_channel_step];
+                    png_byte added_value =
+                        added_row[source_x * source_pixel_step + channel * source_channel_step];
+
+                    ips_remove_from_median_histogram(histogram, removed_value);
+                    ips_add_to_median_histogram(histogram, added_value);
+
+                    if (column < diameter) {
+                        ips_remove_from_median_histogram(&first_windows[channel], removed_value);
+                        ips_add_to_median_histogram(&first_windows[channel], added_value);
+                    }
+                }
+            }
+        }
+
+        /* Every row starts with all fine segments up to date for the first window */
+        for (unsigned int channel = 0; channel < color_channels; ++channel) {
+            windows[channel].histogram = first_windows[channel];
+            for (int segment = 0; segment < 16; ++segment) {
+                windows[channel].segment_columns[segment] = 0;
+            }
+        }
+
+        for (x = task->x0; x < task->x1; ++x) {
+            png_bytep destination_pixel =
+                &(output_image->rows[y][x * destination_pixel_step]);
+            long first_column =
+                (long) (x - task->x0);
+
+            for (unsigned int channel = 0; channel < color_channels; ++channel) {
+                if (x > task->x0) {
+                    ips_slide_median_bins(
+                        windows[channel].histogram.coarse,
+                        columns[(first_column + diameter - 1) * color_channels + channel].coarse,
+                        columns[(first_column - 1) * color_channels + channel].coarse
+                    );
+                }
+
+                destination_pixel[channel * destination_channel_step] =
+                    ips_find_window_median_in_columns(
+                        &windows[channel], columns + channel,
+                        first_column, (long) color_channels,
+                        diameter, rank
+                    );
+            }
+            if (channels == 4) {
+                destination_pixel[3 * destination_channel_step] =
+                    input_image->rows[y][x * source_pixel_step + 3 * source_channel_step];
+            }
+        }
+    }
+}
+
+/* Small windows go to the sorting networks if vector units are available. */
+void ips_apply_median(ips_task_t *task)
+{
+    unsigned int radius =
+        ((ips_median_parameters_t *) task->image_processing_parameters)->radius;
+
+    if (radius <= IPS_MAXIMUM_MEDIAN_NETWORK_RADIUS && simd_level >= IPS_SIMD_SSE2) {
+        ips_apply_median_network(task);
+    } else {
+        ips_apply_histogram_median(task);
+    }
+}
+
+#ifdef IPS_SSE2
+/*
+    Splits 16 RGBA pixels at a time into four planes: every 32-bit pixel is
+    masked and shifted into the low byte of its lane, then the lanes of
+    four vectors are packed down to bytes. Returns the first pixel it did
+    not process.
+*/
+png_uint_32 ips_convert_row_to_planar_sse2(
+                const png_byte *source, png_bytep *planes,
+                png_uint_32 x0, png_uint_32 x1,
+                unsigned int channels
+            )
+{
+    const __m128i low_byte =
+        _mm_set1_epi32(0xFF);
+
+    png_uint_32 x = x0;
+    if (channels != 4) {
+        return x;
+    }
+
+    for (; x + 16 <= x1; x += 16) {
+        __m128i samples[4][4];
+
+        for (int i = 0; i < 4; ++i) {
+            __m128i pixels =
+                _mm_loadu_si128((const __m128i *) (source + (x + i * 4) * 4));
+
+            samples[0][i] = _mm_and_si128(pixels, low_byte);
+            samples[1][i] = _mm_and_si128(_mm_srli_epi32(pixels, 8), low_byte);
+            samples[2][i] = _mm_and_si128(_mm_srli_epi32(pixels, 16), low_byte);
+            samples[3][i] = _mm_srli_epi32(pixels, 24);
+        }
+
+        for (int channel = 0; channel < 4; ++channel) {
+            _mm_storeu_si128(
+                (__m128i *) (planes[channel] + x),
+                _mm_packus_epi16(
+                    _mm_packs_epi32(samples[channel][0], samples[channel][1]),
+                    _mm_packs_epi32(samples[channel][2], samples[channel][3])
+                )
+            );
+        }
+    }
+
+    return x;
+}
+
+/* Joins four planes into 16 RGBA pixels at a time by unpacking bytes, then pairs. */
+png_uint_32 ips_convert_row_to_interleaved_sse2(
+                const png_byte *const *planes, png_bytep destination,
+                png_uint_32 x0, png_uint_32 x1,
+                unsigned int channels
+            )
+{
+    png_uint_32 x = x0;
+    if (channels != 4) {
+        return x;
+    }
+
+    for (; x + 16 <= x1; x += 16) {
+        __m128i r = _mm_loadu_si128((const __m128i *) (planes[0] + x)),
+                g = _mm_loadu_si128((const __m128i *) (planes[1] + x)),
+                b = _mm_loadu_si128((const __m128i *) (planes[2] + x)),
+                a = _mm_loadu_si128((const __m128i *) (planes[3] + x));
+
+        __m128i rg_low  = _mm_unpacklo_epi8(r, g),
+                rg_high = _mm_unpackhi_epi8(r, g),
+                ba_low  = _mm_unpacklo_epi8(b, a),
+                ba_high = _mm_unpackhi_epi8(b, a);
+
+        __m128i *pixels =
+            (__m128i *) (destination + x * 4);
+        _mm_storeu_si128(pixels + 0, _mm_unpacklo_epi16(rg_low, ba_low));
+        _mm_storeu_si128(pixels + 1, _mm_unpackhi_epi16(rg_low, ba_low));
+        _mm_storeu_si128(pixels + 2, _mm_unpacklo_epi16(rg_high, ba_high));
+        _mm_storeu_si128(pixels + 3, _mm_unpackhi_epi16(rg_high, ba_high));
+    }
+
+    return x;
+}
+#endif
+
+#ifdef IPS_SSSE3
+/*
+    16 RGB pixels span three vectors. Every plane gathers its samples from
+    each of them with a byte shuffle, -1 (0x80) in a mask zeroes the byte,
+    and the three parts are ORed together.
+*/
+static const signed char Planar_Shuffle_Masks[3][3][16] = {
+    {
+        {  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  1,  4,  7, 10, 13 }
+    },
+    {
+        {  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14 }
+    },
+    {
+        {  2,  5,  8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1,  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1 },
+        { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15 }
+    }
+};
+
+/* The inverse: for every output vector, where its bytes come from in each plane. */
+static const signed char Interleaved_Shuffle_Masks[3][3][16] = {
+    {
+        {  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1,  5 },
+        { -1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1 },
+        { -1, -1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1 }
+    },
+    {
+        { -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10, -1 },
+        {  5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10 },
+        { -1,  5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1 }
+    },
+    {
+        { -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 },
+        { -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 },
+        { 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 }
+    }
+};
+
+/* Splits 16 RGB pixels at a time into three planes. */
+IPS_TARGET_SSSE3
+png_uint_32 ips_convert_row_to_planar_ssse3(
+                const png_byte *source, png_bytep *planes,
+                png_uint_32 x0, png_uint_32 x1,
+                unsigned int channels
+            )
+{
+    __m128i masks[3][3];
+
+    png_uint_32 x = x0;
+    if (channels != 3) {
+        return x;
+    }
+
+    for (int channel = 0; channel < 3; ++channel) {
+        for (int part = 0; part < 3; ++part) {
+            masks[channel][part] =
+                _mm_loadu_si128((const __m128i *) Planar_Shuffle_Masks[channel][part]);
+        }
+    }
+
+    for (; x + 16 <= x1; x += 16) {
+        __m128i pixels[3];
+        for (int part = 0; part < 3; ++part) {
+            pixels[part] =
+                _mm_loadu_si128((const __m128i *) (source + x * 3 + part * 16));
+        }
+
+        for (int channel = 0; channel < 3; ++channel) {
+            _mm_storeu_si128(
+                (__m128i *) (planes[channel] + x),
+                _mm_or_si128(
+                    _mm_or_si128(
+                        _mm_shuffle_epi8(pixels[0], masks[channel][0]),
+                        _mm_shuffle_epi8(pixels[1], masks[channel][1])
+                    ),
+                    _mm_shuffle_epi8(pixels[2], masks[channel][2])
+                )
+            );
+        }
+    }
+
+    return x;
+}
+
+/* Joins three planes into 16 RGB pixels at a time. */
+IPS_TARGET_SSSE3
+png_uint_32 ips_convert_row_to_interleaved_ssse3(
+                const png_byte *const *planes, png_bytep destination,
+                png_uint_32 x0, png_uint_32 x1,
+                unsigned int channels
+            )
+{
+    __m128i masks[3][3];
+
+    png_uint_32 x = x0;
+    if (channels != 3) {
+        return x;
+    }
+
+    for (int part = 0; part < 3; ++part) {
+        for (int channel = 0; channel < 3; ++channel) {
+            masks[part][channel] =
+                _mm_loadu_si128((const __m128i *) Interleaved_Shuffle_Masks[part][channel]);
+        }
+    }
+
+    for (; x + 16 <= x1; x += 16) {
+        __m128i samples[3];
+        for (int channel = 0; channel < 3; ++channel) {
+            samples[channel] =
+                _mm_loadu_si128((const __m128i *) (planes[channel] + x));
+        }
+
+        for (int part = 0; part < 3; ++part) {
+            _mm_storeu_si128(
+                (__m128i *) (destination + x * 3 + part * 16),
+                _mm_or_si128(
+                    _mm_or_si128(
+                        _mm_shuffle_epi8(samples[0], masks[part][0]),
+                        _mm_shuffle_epi8(samples[1], masks[part][1])
+                    ),
+                    _mm_shuffle_epi8(samples[2], masks[part][2])
+                )
+            );
+        }
+    }
+
+    return x;
+}
+#endif
+
+/*
+    The only pass of Layout_Conversion_Filter: copies a tile from the
+    layout of the input to the layout of the output, which must differ.
+    There is no separate SSSE3 detection, every CPU with AVX2 has it.
+*/
+void ips_convert_layout(ips_task_t *task)
+{
+    png_uint_32 x, y;
+
+    ips_raw_image_t *input_image =
+        task->input_image;
+    ips_raw_image_t *output_image =
+        task->output_image;
+    unsigned int channels =
+        input_image->channels;
+    int should_split =
+        input_image->layout == IPS_LAYOUT_INTERLEAVED;
+    ips_raw_image_t *interleaved_image =
+        should_split ? input_image : output_image;
+    ips_raw_image_t *planar_image =
+        should_split ? output_image : input_image;
+
+    png_bytep planes[4];
+
+    for (y = task->y0; y < task->y1; ++y) {
+        png_bytep interleaved_row =
+            interleaved_image->rows[y];
+        for (unsigned int channel = 0; channel < channels; ++channel) {
+            planes[channel] =
+                planar_image->rows[y] + channel * planar_image->channel_step;
+        }
+
+        x = task->x0;
+        if (should_split) {
+#ifdef IPS_SSSE3
+            if (simd_level >= IPS_SIMD_SSSE3) {
+                x = ips_convert_row_to_planar_ssse3(interleaved_row, planes, x, task->x1, channels);
+            }
+#endif
+#ifdef IPS_SSE2
+            if (simd_level >= IPS_SIMD_SSE2) {
+                x = ips_convert_row_to_planar_sse2(interleaved_row, planes, x, task->x1, channels);
+            }
+#endif
+            for (; x < task->x1; ++x) {
+                for (unsigned int channel = 0; channel < channels; ++channel) {
+                    planes[channel][x] =
+                        interleaved_row[x * channels + channel];
+                }
+            }
+        } else {
+#ifdef IPS_SSSE3
+            if (simd_level >= IPS_SIMD_SSSE3) {
+                x = ips_convert_row_to_interleaved_ssse3(planes, interleaved_row, x, task->x1, channels);
+            }
+#endif
+#ifdef IPS_SSE2
+            if (simd_level >= IPS_SIMD_SSE2) {
+                x = ips_convert_row_to_interleaved_sse2(planes, interleaved_row, x, task->x1, channels);
+            }
+#endif
+            for (; x < task->x1; ++x) {
+                for (unsigned int channel = 0; channel < channels; ++channel) {
+                    interleaved_row[x * channels + channel] =
+                        planes[channel][x];
+                }
+            }
+        }
+    }
+}
+
+#ifdef IPS_SSE2
+/*
+    Halves 16 samples of a plane or 4 RGBA pixels at a time. The sums of
+    the two rows are widened to 16 bits, then neighbours are added with a
+    multiply-add by one in a plane or by adding the halves of a vector for
+    RGBA. Stops before the last input column would have to be used twice.
+*/
+png_uint_32 ips_downsample_row_sse2(
+                const png_byte *top, const png_byte *bottom, png_bytep destination,
+                png_uint_32 x0, png_uint_32 x1, png_uint_32 input_width,
+                unsigned int samples_per_pixel
+            )
+{
+    const __m128i zero =
+        _mm_setzero_si128();
+
+    png_uint_32 x = x0;
+
+    if (samples_per_pixel == 1) {
+        const __m128i ones =
+            _mm_set1_epi16(1);
+        const __m128i rounding =
+            _mm_set1_epi32(2);
+
+        for (; x + 16 <= x1 && 2 * (x + 16) <= input_width; x += 16) {
+            __m128i sums[4];
+
+            for (int i = 0; i < 2; ++i) {
+                __m128i top_samples =
+                    _mm_loadu_si128((const __m128i *) (top + 2 * x + i * 16));
+                __m128i bottom_samples =
+                    _mm_loadu_si128((const __m128i *) (bottom + 2 * x + i * 16));
+
+                __m128i low =
+                    _mm_add_epi16(_mm_unpacklo_epi8(top_samples, zero), _mm_unpacklo_epi8(bottom_samples, zero));
+                __m128i high =
+                    _mm_add_epi16(_mm_unpackhi_epi8(top_samples, zero), _mm_unpackhi_epi8(bottom_samples, zero));
+
+                sums[i * 2]     = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(low, ones), rounding), 2);
+                sums[i * 2 + 1] = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(high, ones), rounding), 2);
+            }
+
+            _mm_storeu_si128(
+                (__m128i *) (destination + x),
+                _mm_packus_epi16(
+                    _mm_packs_epi32(sums[0], sums[1]),
+                    _mm_packs_epi32(sums[2], sums[3])
+                )
+            );
+        }
+    } else if (samples_per_pixel == 4) {
+        const __m128i rounding =
+            _mm_set1_epi16(2);
+
+        for (; x + 4 <= x1 && 2 * (x + 4) <= input_width; x += 4) {
+            __m128i pixels[2];
+
+            for (int i = 0; i < 2; ++i) {
+                __m128i top_pixels =
+                    _mm_loadu_si128((const __m128i *) (top + (2 * x + i * 4) * 4));
+                __m128i bottom_pixels =
+                    _mm_loadu_si128((const __m128i *) (bottom + (2 * x + i * 4) * 4));
+
+                /* Two input pixels per vector, the pairs to add are in different halves */
+                __m128i low =
+                    _mm_add_epi16(_mm_unpacklo_epi8(top_pixels, zero), _mm_unpacklo_epi8(bottom_pixels, zero));
+                __m128i high =
+                    _mm_add_epi16(_mm_unpackhi_epi8(top_pixels, zero), _mm_unpackhi_epi8(bottom_pixels, zero));
+
+                pixels[i] =
+                    _mm_srli_epi16(
+                        _mm_add_epi16(
+                            _mm_add_epi16(_mm_unpacklo_epi64(low, high), _mm_unpackhi_epi64(low, high)),
+                            rounding
+                        ),
+                        2
+                    );
+            }
+
+            _mm_storeu_si128(
+                (__m128i *) (destination + x * 4),
+                _mm_packus_epi16(pixels[0], pixels[1])
+            );
+        }
+    }
+
+    return x;
+}
+#endif
+
+#ifdef IPS_SSSE3
+/*
+    Two RGB output pixels come from 12 input bytes. The shuffles pick the
+    left and the right pixel of every pair into 16-bit lanes, -1 (0x80)
+    zeroes the high bytes, the last one joins the 6 bytes of both halves.
+*/
+static const signed char Downsample_Shuffle_Masks[5][16] = {
+    {  0, -1,  1, -1,  2, -1,  6, -1,  7, -1,  8, -1, -1, -1, -1, -1 },
+    {  3, -1,  4, -1,  5, -1,  9, -1, 10, -1, 11, -1, -1, -1, -1, -1 },
+    {  4, -1,  5, -1,  6, -1, 10, -1, 11, -1, 12, -1, -1, -1, -1, -1 },
+    {  7, -1,  8, -1,  9, -1, 13, -1, 14, -1, 15, -1, -1, -1, -1, -1 },
+    {  0,  1,  2,  3,  4,  5,  8,  9, 10, 11, 12, 13, -1, -1, -1, -1 }
+};
+
+/* Halves 4 RGB pixels at a time, the second load starts 8 bytes in to stay inside 8 input pixels. */
+IPS_TARGET_SSSE3
+png_uint_32 ips_downsample_row_ssse3(
+                const png_byte *top, const png_byte *bottom, png_bytep destination,
+                png_uint_32 x0, png_uint_32 x1, png_uint_32 input_width,
+                unsigned int samples_per_pixel
+            )
+{
+    __m128i masks[5];
+
+    png_uint_32 x = x0;
+    if (samples_per_pixel != 3) {
+        return x;
+    }
+
+    for (int i = 0; i < 5; ++i) {
+        masks[i] =
+            _mm_loadu_si128((const __m128i *) Downsample_Shuffle_Masks[i]);
+    }
+
+    const __m128i rounding =
+        _mm_set1_epi16(2);
+
+    for (; x + 4 <= x1 && 2 * (x + 4) <= input_width; x += 4) {
+        __m128i sums[2];
+
+        for (int i = 0; i < 2; ++i) {
+            __m128i top_pixels =
+                _mm_loadu_si128((const __m128i *) (top + x * 6 + i * 8));
+            __m128i bottom_pixels =
+                _mm_loadu_si128((const __m128i *) (bottom + x * 6 + i * 8));
+
+            sums[i] =
+                _mm_add_epi16(
+                    _mm_add_epi16(
+                        _mm_shuffle_epi8(top_pixels, masks[i * 2]),
+                        _mm_shuffle_epi8(top_pixels, masks[i * 2 + 1])
+                    ),
+                    _mm_add_epi16(
+                        _mm_shuffle_epi8(bottom_pixels, masks[i * 2]),
+                        _mm_shuffle_epi8(bottom_pixels, masks[i * 2 + 1])
+                    )
+                );
+            sums[i] =
+                _mm_srli_epi16(_mm_add_epi16(sums[i], rounding), 2);
+        }
+
+        __m128i pixels =
+            _mm_shuffle_epi8(_mm_packus_epi16(sums[0], sums[1]), masks[4]);
+
+        /* 12 bytes, a wider store would write into the pixels of the next tile */
+        int last_pixels =
+            _mm_cvtsi128_si32(_mm_srli_si128(pixels, 8));
+        _mm_storel_epi64((__m128i *) (destination + x * 3), pixels);
+        memcpy(destination + x * 3 + 8, &last_pixels, sizeof(last_pixels));
+    }
+
+    return x;
+}
+#endif
+
+/*
+    Averages 2x2 blocks of the input into one output pixel, the last row or
+    column of an input of size 1 is used twice. Works on either layout,
+    planes are halved one after another.
+*/
+void ips_downsample(ips_task_t *task)
+{
+    ips_raw_image_t *input_image =
+        task->input_image;
+    ips_raw_image_t *output_image =
+        task->output_image;
+    unsigned int samples_per_pixel =
+        (unsigned int) input_image->pixel_step;
+    unsigned int number_of_planes =
+        input_image->layout == IPS_LAYOUT_PLANAR ? input_image->channels : 1;
+
+    for (png_uint_32 y = task->y0; y < task->y1; ++y) {
+        for (unsigned int plane = 0; plane < number_of_planes; ++plane) {
+            const png_byte *top =
+                input_image->rows[IPS_MIN(2 * y, input_image->height - 1)] +
+                    plane * input_image->channel_step;
+            const png_byte *bottom =
+                input_image->rows[IPS_MIN(2 * y + 1, input_image->height - 1)] +
+                    plane * input_image->channel_step;
+            png_bytep destination =
+                output_image->rows[y] + plane * output_image->channel_step;
+
+            png_uint_32 x = task->x0;
+#ifdef IPS_SSSE3
+            if (simd_level >= IPS_SIMD_SSSE3) {
+                x = ips_downsample_row_ssse3(top, bottom, destination, x, task->x1, input_image->width, samples_per_pixel);
+            }
+#endif
+#ifdef IPS_SSE2
+            if (simd_level >= IPS_SIMD_SSE2) {
+                x = ips_downsample_row_sse2(top, bottom, destination, x, task->x1, input_image->width, samples_per_pixel);
+            }
+#endif
+            for (; x < task->x1; ++x) {
+                size_t left =
+                    (size_t) 2 * x * samples_per_pixel;
+                size_t right =
+                    (size_t) IPS_MIN(2 * x + 1, input_image->width - 1) * samples_per_pixel;
+
+                for (unsigned int sample = 0; sample < samples_per_pixel; ++sample) {
+                    destination[x * samples_per_pixel + sample] =
+                        (png_byte) ((top[left + sample] + top[right + sample] +
+                                        bottom[left + sample] + bottom[right + sample] + 2) >> 2);
+                }
+            }
+        }
+    }
+}
+
+unsigned int ips_get_sobel_radius(const void *image_processing_parameters)
+{
+    (void) image_processing_parameters;
+
+    return 1;
+}
+
+unsigned int ips_get_median_radius(const void *image_processing_parameters)
+{
+    return ((const ips_median_parameters_t *) image_processing_parameters)->radius;
+}
+
+void ips_detect_simd_level()
+{
+    simd_level = IPS_SIMD_NONE;
+
+#ifdef IPS_SSE2
+    if (SDL_HasSSE2()) {
+        simd_level = IPS_SIMD_SSE2;
+    }
+#endif
+
+#ifdef IPS_SSSE3
+    if (simd_level == IPS_SIMD_SSE2 && ips_utils_cpu_has_ssse3()) {
+        simd_level = IPS_SIMD_SSSE3;
+    }
+#endif
+
+#ifdef IPS_AVX2
+    if (simd_level == IPS_SIMD_SSSE3 && ips_utils_cpu_has_avx2()) {
+        simd_level = IPS_SIMD_AVX2;
+    }
+#endif
+}
+
+/* Image processing tasks for each consumer thread. */
+void *ips_thread_process_image_part(void *args)
+{
+    ips_worker_t *worker = (ips_worker_t *) args;
+    ips_task_pool_t *pool = worker->pool;
+    ips_task_t *task;
+
+    for (;;) {
+        if (pool->scheduler == IPS_SCHEDULER_WORK_STEALING) {
+            task = ips_get_task_for_worker(worker);
+        } else {
+            task = ips_pop_task(pool);
+        }
+
+        if (!task) {
+            break;
+        }
+
+        ips_run_task(worker, task);
+    }
+
+    return NULL;
+}
+
+/* ----- */
+
+void ips_init_gl_window()
+{
+    GLenum glew_initialization_status;
+
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0) {
+        fprintf(stderr, "SDL initialization failure: \"%s\"\n", SDL_GetError());
+
+        SDL_Quit();
+
+        exit(EXIT_FAILURE);
+    }
+
+    program_window =
+        SDL_CreateWindow(
+            Window_Title,
+            SDL_WINDOWPOS_CENTERED,
+            SDL_WINDOWPOS_CENTERED,
+            Initial_Window_Width,
+            Initial_Window_Height,
+            SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE
+        );
+    if (!program_window) {
+        fprintf(
+            stderr,
+            "Failed to create an SDL window: \"%s\"\n",
+            SDL_GetError()
+        );
+
+        SDL_Quit();
+
+        exit(EXIT_FAILURE);
+    }
+
+    ips_update_matrices(
+        Initial_Window_Width,
+        Initial_Window_Height
+    );
+
+    SDL_GL_SetAttribute(
+        SDL_GL_CONTEXT_MAJOR_VERSION,
+        OpenGL_Context_Major_Version
+    );
+    SDL_GL_SetAttribute(
+        SDL_GL_CONTEXT_MINOR_VERSION,
+        OpenGL_Context_Minor_Version
+    );
+
+    SDL_GL_SetAttribute(
+        SDL_GL_MULTISAMPLEBUFFERS,
+        Multisample_Enabled
+    );
+    SDL_GL_SetAttribute(
+        SDL_GL_MULTISAMPLESAMPLES,
+        Multisample_Samples_Count
+    );
+
+    gl_context = SDL_GL_CreateContext(program_window);
+    if (!gl_context) {
+        fprintf(
+            stderr,
+            "Failed to create an OpengGL context: \"%s\"\n",
+            SDL_GetError()
+        );
+
+        SDL_DestroyWindow(program_window);
+        SDL_Quit();
+
+        exit(EXIT_FAILURE);
+    }
+
+    glewExperimental = GL_TRUE;
+    glew_initialization_status = glewInit();
+    if (glew_initialization_status != GLEW_OK) {
+        fprintf(
+            stderr,
+            "GLEW initialization failure: %s\n",
+            glewGetErrorString(glew_initialization_status)
+        );
+    }
+
+    /* Change to SDL_GL_SetSwapInterval(0) to get unbound framerate */
+    if (SDL_GL_SetSwapInterval(-1) < 0) {
+        SDL_GL_SetSwapInterval(1);
+    }
+
+    SDL_DisableScreenSaver();
+}
+
+void ips_init_gl()
+{
+    glEnable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+
+    glCullFace(GL_BACK);
+    glFrontFace(GL_CW);
+
+    glClearColor(0, 0, 0, 0);
+    glClearDepth(1.0);
+
+    glViewport(
+        0, 0,
+        (GLsizei) Initial_Window_Width,
+        (GLsizei) Initial_Window_Height
+    );
+
+    glUseProgram(0);
+}
+
+GLuint ips_create_shader_program(
+           char *vertex_shader_source,
+           char *fragment_shader_source
+       )
+{
+    GLuint shader_program = 0;
+
+    GLuint vertex_shader_object   = 0,
+           fragment_shader_object = 0;
+
+    if (!vertex_shader_source) {
+        fprintf(
+            stderr,
+            "Failed to read a vertex shader file \"%s\"\n",
+            Vertex_Shader_Path
+        );
+
+        return shader_program;
+    }
+
+    if (!fragment_shader_source) {
+        fprintf(
+            stderr,
+            "Failed to read a fragment shader file \"%s\"\n",
+            Fragment_Shader_Path
+        );
+
+        return shader_program;
+    }
+
+    vertex_shader_object =
+        ips_compile_shader(vertex_shader_source, GL_VERTEX_SHADER);
+
+    if (vertex_shader_object) {
+        fragment_shader_object =
+            ips_compile_shader(fragment_shader_source, GL_FRAGMENT_SHADER);
+
+        if (fragment_shader_object) {
+            shader_program =
+                ips_link_shader_program(
+                    vertex_shader_object,
+                    fragment_shader_object
+                );
+        }
+
+        glDeleteShader(vertex_shader_object);
+        glDeleteShader(fragment_shader_object);
+    }
+
+    if (shader_program) {
+        position_attribute_location =
+            glGetAttribLocation(shader_program, "position");
+        normal_attribute_location =
+            glGetAttribLocation(shader_program, "normal");
+        color_attribute_location =
+            glGetAttribLocation(shader_program, "color");
+        texture_coordinates_attribute_location =
+            glGetAttribLocation(shader_program, "texture_coordinates");
+
+        mvp_matrix_uniform_location =
+            glGetUniformLocation(shader_program, "model_view_projection_matrix");
+        texture_sampler_uniform_location =
+            glGetUniformLocation(shader_program, "texture_sampler");
+    }
+
+    return shader_program;
+}
+
+GLuint ips_compile_shader(
+           char *shader_source,
+           GLenum shader_type
+       )
+{
+    GLint status;
+
+    GLuint shader_object =
+        glCreateShader(shader_type);
+
+    glShaderSource(
+        shader_object,
+        1,
+        (const GLchar**) &shader_source,
+        NULL
+    );
+    glCompileShader(shader_object);
+
+    glGetShaderiv(
+        shader_object,
+        GL_COMPILE_STATUS,
+        &status
+    );
+
+    if (status == GL_FALSE) {
+        GLint info_log_length;
+        glGetShaderiv(
+            shader_object,
+            GL_INFO_LOG_LENGTH,
+            &info_log_length
+        );
+
+        if (info_log_length > 0) {
+            GLchar *info_log =
+                (GLchar *) malloc((size_t) info_log_length);
+
+            glGetShaderInfoLog(
+                shader_object,
+                info_log_length,
+                NULL,
+                info_log
+            );
+
+            fprintf(
+                stderr,
+                "Failed to compile a vertex shader \"%s\"\n",
+                shader_type == GL_VERTEX_SHADER ?
+                    Vertex_Shader_Path : Fragment_Shader_Path
+            );
+            fprintf(
+                stderr,
+                "Compilation log:\n%s\n\n",
+                info_log
+            );
+
+            free(info_log);
+        }
+
+        glDeleteShader(shader_object);
+        shader_object = 0;
+    }
+
+    return shader_object;
+}
+
+GLuint ips_link_shader_program(
+           GLuint vertex_shader_object,
+           GLuint fragment_shader_object
+       )
+{
+    GLint status;
+
+    GLuint shader_program =
+        glCreateProgram();
+
+    glAttachShader(
+        shader_program,
+        vertex_shader_object
+    );
+    glAttachShader(
+        shader_program,
+        fragment_shader_object
+    );
+
+    glLinkProgram(shader_program);
+
+    glGetProgramiv(
+        shader_program,
+        GL_LINK_STATUS,
+        &status
+    );
+
+    if (status == GL_FALSE) {
+        GLint info_log_length;
+        glGetProgramiv(
+            shader_program,
+            GL_INFO_LOG_LENGTH,
+            &info_log_length
+        );
+
+        if (info_log_length > 0) {
+            GLchar *info_log =
+                (GLchar *) malloc((size_t) info_log_length);
+
+            glGetProgramInfoLog(
+                shader_program,
+                info_log_length,
+                NULL,
+                info_log
+            );
+
+            fprintf(stderr, "Failed to link a GPU program\n");
+            fprintf(stderr, "Linker log:\n%s\n\n", info_log);
+
+            free(info_log);
+        }
+
+        shader_program = 0;
+    }
+
+    glDetachShader(
         shader_program,
         vertex_shader_object
     );
-    glAttachShader(
-        shader_program,
-        fragment_shader_object
+    glDetachShader(
+        shader_program,
+        fragment_shader_object
+    );
+
+    return shader_program;
+}
+
+void ips_delete_shader_program(GLuint shader_program)
+{
+    glDeleteProgram(shader_program);
+}
+
+GLuint ips_generate_quad_geometry()
+{
+    GLuint vertex_array_object  = 0,
+           vertex_buffer_object = 0;
+
+    GLfloat vertex_data[] = {
+    //   Position           Color (RGBA),            Texture coordinates (UV)
+        -1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f,  1.0f, 0.0f,
+        -1.0f,  1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f,  1.0f, 1.0f,
+         1.0f,  1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f,  0.0f, 1.0f,
+         1.0f, -1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f,  0.0f, 0.0f
+    };
+
+    glGenVertexArrays(1, &vertex_array_object);
+    glBindVertexArray(vertex_array_object);
+
+    glGenBuffers(1, &vertex_buffer_object);
+    glBindBuffer(
+        GL_ARRAY_BUFFER,
+        vertex_buffer_object
+    );
+    glBufferData(
+        GL_ARRAY_BUFFER,
+        sizeof(vertex_data),
+        vertex_data,
+        GL_STATIC_DRAW
+    );
+
+    GLsizei stride =
+        sizeof(GLfloat) * 9;
+
+    glEnableVertexAttribArray(position_attribute_location);
+    glVertexAttribPointer(
+        position_attribute_location, 3, GL_FLOAT, GL_FALSE,
+        stride, (const GLvoid *) 0
+    );
+
+    glEnableVertexAttribArray(color_attribute_location);
+    glVertexAttribPointer(
+        color_attribute_location, 4, GL_FLOAT, GL_FALSE,
+        stride, (const GLvoid *) (sizeof(GLfloat) * 3)
+    );
+
+    glEnableVertexAttribArray(texture_coordinates_attribute_location);
+    glVertexAttribPointer(
+        texture_coordinates_attribute_location, 2, GL_FLOAT, GL_FALSE,
+        stride, (const GLvoid *) (sizeof(GLfloat) * 7)
+    );
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    return vertex_array_object;
+}
+
+ips_raw_image_t *ips_create_image(
+                     png_uint_32 width,
+                     png_uint_32 height,
+                     unsigned int channels
+                 )
+{
+    return ips_create_image_with_apron(width, height, channels, 0);
+}
+
+ips_raw_image_t *ips_create_image_with_apron(
+                     png_uint_32 width,
+                     png_uint_32 height,
+                     unsigned int channels,
+                     unsigned int apron
+                 )
+{
+    return ips_create_image_with_layout(width, height, channels, apron, IPS_LAYOUT_INTERLEAVED);
+}
+
+ips_raw_image_t *ips_create_image_with_layout(
+                     png_uint_32 width,
+                     png_uint_32 height,
+                     unsigned int channels,
+                     unsigned int apron,
+                     ips_layout_t layout
+                 )
+{
+    ips_raw_image_t *image =
+        ips_create_image_header(width, height, channels, apron, layout);
+
+    ips_set_image_data(
+        image,
+        (png_bytep) ips_utils_aligned_malloc(
+                        ips_get_image_data_size(image),
+                        IPS_ROW_ALIGNMENT
+                    )
+    );
+
+    return image;
+}
+
+/*
+    The size and layout of an image without pixels, ips_get_image_data_size
+    tells how much memory ips_set_image_data has to give it.
+*/
+ips_raw_image_t *ips_create_image_header(
+                     png_uint_32 width,
+                     png_uint_32 height,
+                     unsigned int channels,
+                     unsigned int apron,
+                     ips_layout_t layout
+                 )
+{
+    ips_raw_image_t *image;
+
+    size_t left_padding, stride_alignment;
+    unsigned int samples_per_pixel =
+        layout == IPS_LAYOUT_PLANAR ? 1 : channels;
+
+    image = (ips_raw_image_t *) malloc(sizeof(*image));
+
+    /*
+        The stride is also a whole number of pixels, GL_UNPACK_ROW_LENGTH
+        can only describe those
+    */
+    stride_alignment = IPS_ROW_ALIGNMENT;
+    while (stride_alignment % samples_per_pixel != 0) {
+        stride_alignment += IPS_ROW_ALIGNMENT;
+    }
+
+    left_padding =
+        (apron * samples_per_pixel + IPS_ROW_ALIGNMENT - 1) / IPS_ROW_ALIGNMENT * IPS_ROW_ALIGNMENT;
+    image->stride =
+        (left_padding + ((size_t) width + apron) * samples_per_pixel + IPS_ROW_SLACK + stride_alignment - 1) /
+            stride_alignment * stride_alignment;
+
+    image->layout =
+        layout;
+    image->pixel_step =
+        samples_per_pixel;
+    image->channel_step =
+        layout == IPS_LAYOUT_PLANAR ? (height + 2 * apron) * image->stride : 1;
+
+    image->data = NULL;
+    image->rows = NULL;
+
+    image->width =
+        width;
+    image->height =
+        height;
+    image->channels =
+        channels;
+    image->apron =
+        apron;
+
+    return image;
+}
+
+/* Points the rows of an image header at its pixels, data has to be 64-byte aligned. */
+void ips_set_image_data(ips_raw_image_t *image, png_bytep data)
+{
+    png_uint_32 i, number_of_rows =
+        image->height + 2 * image->apron;
+    size_t left_padding =
+        (image->apron * image->pixel_step + IPS_ROW_ALIGNMENT - 1) / IPS_ROW_ALIGNMENT * IPS_ROW_ALIGNMENT;
+
+    image->data =
+        data;
+    image->rows =
+        (png_bytepp) malloc(number_of_rows * sizeof(*image->rows)) + image->apron;
+    for (i = 0; i < number_of_rows; ++i) {
+        image->rows[(long) image->height + image->apron - i - 1] =
+            image->data + i * image->stride + left_padding;
+    }
+}
+
+/* Deletes an image without the pixels, they belong to someone else. */
+void ips_delete_image_view(ips_raw_image_t *view)
+{
+    if (view) {
+        view->data = NULL;
+        ips_delete_image(view);
+    }
+}
+
+size_t ips_get_image_data_size(ips_raw_image_t *image)
+{
+    size_t number_of_planes =
+        image->layout == IPS_LAYOUT_PLANAR ? image->channels : 1;
+
+    return (image->height + 2 * image->apron) * image->stride * number_of_planes;
+}
+
+/* Fills the apron with copies of the nearest border pixels. */
+void ips_replicate_image_apron(ips_raw_image_t *image)
+{
+    size_t pixel_size =
+        image->pixel_step;
+    size_t number_of_planes =
+        image->channels / pixel_size;
+    long apron =
+        image->apron;
+    long height =
+        image->height;
+    size_t row_size =
+        image->width * pixel_size;
+
+    if (apron == 0) {
+        return;
+    }
+
+    for (size_t plane = 0; plane < number_of_planes; ++plane) {
+        size_t plane_offset =
+            plane * image->channel_step;
+
+        for (long y = 0; y < height; ++y) {
+            png_bytep row = image->rows[y] + plane_offset;
+            for (long x = 1; x <= apron; ++x) {
+                memcpy(row - x * pixel_size, row, pixel_size);
+                memcpy(row + row_size + (x - 1) * pixel_size, row + row_size - pixel_size, pixel_size);
+            }
+        }
+
+        for (long y = 1; y <= apron; ++y) {
+            memcpy(
+                image->rows[-y] + plane_offset - apron * pixel_size,
+                image->rows[0] + plane_offset - apron * pixel_size,
+                row_size + 2 * apron * pixel_size
+            );
+            memcpy(
+                image->rows[height - 1 + y] + plane_offset - apron * pixel_size,
+                image->rows[height - 1] + plane_offset - apron * pixel_size,
+                row_size + 2 * apron * pixel_size
+            );
+        }
+    }
+}
+
+/* libpng read callback that copies straight from the mapped file. */
+void ips_read_mapped_png_data(png_structp png_struct, png_bytep data, png_size_t length)
+{
+    ips_png_reader_t *reader =
+        (ips_png_reader_t *) png_get_io_ptr(png_struct);
+
+    if (length > reader->mapped_size - reader->mapped_offset) {
+        png_error(png_struct, "Read Error");
+    }
+
+    memcpy(data, reader->mapped_data + reader->mapped_offset, length);
+    reader->mapped_offset += length;
+}
+
+/*
+    Opens a PNG for decoding row by row. The image is allocated, but its
+    rows are filled by ips_read_png_rows. Returns NULL on failure.
+*/
+ips_png_reader_t *ips_open_png_reader(const char *png_file_path)
+{
+#define IPS_ERROR(MESSAGE)                     \
+do {                                           \
+    fprintf(stderr, "Error: %s\n", (MESSAGE)); \
+    status = 0;                                \
+    goto cleanup;                              \
+} while (0)
+    /* Both are still read after libpng jumps back to setjmp */
+    ips_png_reader_t *volatile reader;
+
+    reader = (ips_png_reader_t *) malloc(sizeof(*reader));
+    reader->file = NULL;
+    reader->mapped_data = NULL;
+    reader->mapped_size = 0;
+    reader->mapped_offset = 0;
+    reader->png_struct = NULL;
+    reader->png_info = NULL;
+    reader->image = NULL;
+    reader->number_of_decoded_rows = 0;
+
+    volatile int status = 1;
+
+    png_byte input_image_header[1];
+
+    png_uint_32 input_image_width,
+                input_image_height;
+
+    int input_image_bit_depth,
+        input_image_color_type,
+        input_image_interlace_type,
+        input_image_compression_type,
+        input_image_filter_type;
+
+    if (should_map_input_files) {
+        reader->mapped_data =
+            (png_bytep) ips_utils_map_file(png_file_path, &reader->mapped_size);
+    }
+
+    if (reader->mapped_data) {
+        memcpy(input_image_header, reader->mapped_data, sizeof(input_image_header));
+        reader->mapped_offset = sizeof(input_image_header);
+    } else {
+        /* Empty files can not be mapped, stdio reports the rest of the errors */
+        reader->file = fopen(png_file_path, "rb");
+        if (!reader->file) {
+            IPS_ERROR(
+                "failed to open the input image"
+            );
+        }
+
+        if (fread(input_image_header, 1, sizeof(input_image_header), reader->file) != sizeof(input_image_header)) {
+            IPS_ERROR(
+                "input file is not a valid PNG file"
+            );
+        }
+    }
+
+    if (png_sig_cmp(input_image_header, 0, sizeof(input_image_header))) {
+        IPS_ERROR(
+            "input file is not a valid PNG file"
+        );
+    }
+
+    reader->png_struct =
+        png_create_read_struct(
+            PNG_LIBPNG_VER_STRING,
+            NULL, NULL, NULL
+        );
+
+    if (!reader->png_struct) {
+        IPS_ERROR(
+            "internal error: libpng: read structure was not created"
+        );
+    }
+
+    reader->png_info = png_create_info_struct(reader->png_struct);
+    if (!reader->png_info) {
+        IPS_ERROR(
+            "internal error: libpng: info structure for the "
+            "input file was not created"
+        );
+    }
+
+    if (setjmp(png_jmpbuf(reader->png_struct))) {
+        IPS_ERROR(
+            "failed to read the image"
+        );
+    }
+
+    if (reader->mapped_data) {
+        png_set_read_fn(
+            reader->png_struct,
+            reader,
+            ips_read_mapped_png_data
+        );
+    } else {
+        png_init_io(
+            reader->png_struct,
+            reader->file
+        );
+    }
+    png_set_sig_bytes(
+        reader->png_struct,
+        sizeof(input_image_header)
+    );
+
+    png_read_info(
+        reader->png_struct,
+        reader->png_info
+    );
+
+    png_get_IHDR(
+        reader->png_struct,
+        reader->png_info,
+        &input_image_width,
+        &input_image_height,
+        &input_image_bit_depth,
+        &input_image_color_type,
+        &input_image_interlace_type,
+        &input_image_compression_type,
+        &input_image_filter_type
+    );
+
+    if (input_image_interlace_type != PNG_INTERLACE_NONE) {
+        IPS_ERROR(
+            "interlaced images are not supported"
+        );
+    }
+
+    if ((input_image_color_type != PNG_COLOR_TYPE_RGB &&
+         input_image_color_type != PNG_COLOR_TYPE_RGBA) ||
+            input_image_bit_depth != 8) {
+        IPS_ERROR(
+            "only RGB or RGBA 8-bit images can be processed"
+        );
+    }
+#undef IPS_ERROR
+
+    reader->image =
+        ips_create_image(
+            input_image_width,
+            input_image_height,
+            input_image_color_type == PNG_COLOR_TYPE_RGBA ? 4 : 3
+        );
+
+cleanup:
+    if (!status) {
+        ips_close_png_reader(reader);
+        reader = NULL;
+    }
+
+    return reader;
+}
+
+/*
+    Decodes rows from the top until the first `number_of_rows` rows of the
+    image are available. Returns 0 on failure.
+*/
+int ips_read_png_rows(ips_png_reader_t *reader, png_uint_32 number_of_rows)
+{
+    ips_raw_image_t *image = reader->image;
+
+    number_of_rows =
+        IPS_MIN(number_of_rows, image->height);
+
+    if (setjmp(png_jmpbuf(reader->png_struct))) {
+        fprintf(stderr, "Error: %s\n", "failed to read the image");
+
+        return 0;
+    }
+
+    while (reader->number_of_decoded_rows < number_of_rows) {
+        png_read_row(
+            reader->png_struct,
+            image->rows[reader->number_of_decoded_rows++],
+            NULL
+        );
+    }
+
+    return 1;
+}
+
+/* Frees the decoder. The image stays with the caller. */
+void ips_close_png_reader(ips_png_reader_t *reader)
+{
+    if (reader) {
+        if (reader->png_struct) {
+            png_destroy_read_struct(
+                &reader->png_struct,
+                reader->png_info ? &reader->png_info : NULL,
+                NULL
+            );
+        }
+
+        if (reader->file) {
+            fclose(reader->file);
+            reader->file = NULL;
+        }
+
+        ips_utils_unmap_file(reader->mapped_data, reader->mapped_size);
+        reader->mapped_data = NULL;
+
+        free(reader);
+    }
+}
+
+ips_raw_image_t *ips_load_image_from_png_file(char *png_file_path)
+{
+    ips_raw_image_t *result = NULL;
+
+    ips_png_reader_t *reader =
+        ips_open_png_reader(png_file_path);
+
+    if (reader) {
+        if (ips_read_png_rows(reader, reader->image->height)) {
+            result = reader->image;
+        } else {
+            ips_delete_image(reader->image);
+        }
+        ips_close_png_reader(reader);
+    }
+
+    return result;
+}
+
+/*
+    Decodes an 8-bit RGB or RGBA PNG in memory into an image of the same
+    size, with or without the SSE2 and SSSE3 row filters of libpng, which
+    only the benchmark compares. Returns 0 on failure.
+*/
+int ips_decode_png_into_image(png_bytep png_data, size_t png_size, int should_use_simd, ips_raw_image_t *image)
+{
+    ips_png_reader_t reader;
+    png_infop png_info = NULL;
+    volatile int status = 1; /* Read after libpng jumps back to setjmp */
+
+    memset(&reader, 0, sizeof(reader));
+    reader.mapped_data = png_data;
+    reader.mapped_size = png_size;
+
+    reader.png_struct =
+        png_create_read_struct(
+            PNG_LIBPNG_VER_STRING,
+            NULL, NULL, NULL
+        );
+    if (!reader.png_struct) {
+        return 0;
+    }
+
+    png_info = png_create_info_struct(reader.png_struct);
+    if (!png_info || setjmp(png_jmpbuf(reader.png_struct))) {
+        status = 0;
+    } else {
+        png_set_read_fn(reader.png_struct, &reader, ips_read_mapped_png_data);
+#ifdef PNG_INTEL_SSE
+        png_set_option(reader.png_struct, PNG_INTEL_SSE, should_use_simd);
+#else
+        (void) should_use_simd;
+#endif
+
+        png_read_info(reader.png_struct, png_info);
+        if (png_get_image_width(reader.png_struct, png_info) != image->width ||
+                png_get_image_height(reader.png_struct, png_info) != image->height ||
+                png_get_channels(reader.png_struct, png_info) != image->channels) {
+            status = 0;
+        } else {
+            png_read_rows(reader.png_struct, image->rows, NULL, image->height);
+        }
+    }
+
+    png_destroy_read_struct(&reader.png_struct, png_info ? &png_info : NULL, NULL);
+
+    return status;
+}
+
+static inline png_byte ips_predict_paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a),
+        pb = abs(p - b),
+        pc = abs(p - c);
+
+    return (png_byte) (pa <= pb && pa <= pc ? a : (pb <= pc ? b : c));
+}
+
+/*
+    Filters one row with every PNG filter type and returns the candidate
+    with the smallest sum of absolute signed bytes, the heuristic libpng
+    uses, or only with the forced one. Candidates start with their filter
+    type byte.
+*/
+static png_bytep ips_filter_png_row(
+                     const png_byte *row,
+                     const png_byte *previous_row,
+                     size_t row_size,
+                     unsigned int bpp,
+                     int forced_filter_type,
+                     png_bytep candidates
+                 )
+{
+    png_bytep best_candidate = candidates;
+    unsigned long best_sum = ULONG_MAX;
+
+    for (int filter_type = 0; filter_type < 5; ++filter_type) {
+        if (forced_filter_type != Png_Adaptive_Filter && filter_type != forced_filter_type) {
+            continue;
+        }
+
+        png_bytep candidate = candidates + filter_type * (row_size + 1);
+        unsigned long sum = 0;
+
+        candidate[0] = (png_byte) filter_type;
+        for (size_t i = 0; i < row_size; ++i) {
+            int a = i >= bpp ? row[i - bpp] : 0,
+                b = previous_row[i],
+                c = i >= bpp ? previous_row[i - bpp] : 0;
+
+            png_byte prediction;
+            switch (filter_type) {
+                case 1:  prediction = (png_byte) a; break;
+                case 2:  prediction = (png_byte) b; break;
+                case 3:  prediction = (png_byte) ((a + b) >> 1); break;
+                case 4:  prediction = ips_predict_paeth(a, b, c); break;
+                default: prediction = 0; break;
+            }
+
+            candidate[i + 1] = (png_byte) (row[i] - prediction);
+            sum += (unsigned long) abs((signed char) candidate[i + 1]);
+        }
+
+        if (sum < best_sum) {
+            best_sum = sum;
+            best_candidate = candidate;
+        }
+    }
+
+    return best_candidate;
+}
+
+/* Runs deflate until the input is consumed and the flush is complete, growing the output. */
+static int ips_deflate_png_band_data(
+               z_stream *stream,
+               ips_png_band_t *band,
+               size_t *capacity,
+               int flush
+           )
+{
+    for (;;) {
+        int result;
+
+        if (stream->avail_out == 0) {
+            png_bytep data =
+                (png_bytep) realloc(band->data, *capacity * 2);
+            if (!data) {
+                return 0;
+            }
+            band->data = data;
+            *capacity *= 2;
+        }
+        stream->next_out = band->data + stream->total_out;
+        stream->avail_out = (uInt) (*capacity - stream->total_out);
+
+        result = deflate(stream, flush);
+        if (result == Z_STREAM_ERROR) {
+            return 0;
+        }
+
+        if (flush == Z_FINISH) {
+            if (result == Z_STREAM_END) {
+                return 1;
+            }
+        } else if (stream->avail_in == 0 && stream->avail_out != 0) {
+            return 1;
+        }
+    }
+}
+
+/*
+    Filters and deflates one band of rows into a raw deflate stream. Bands
+    other than the last end with a sync flush on a byte boundary, so the
+    streams of all bands concatenate into a single valid deflate stream
+    (as in pigz).
+*/
+void ips_deflate_png_band(ips_task_t *task)
+{
+    ips_png_encoder_t *encoder =
+        (ips_png_encoder_t *) task->image_processing_parameters;
+    ips_raw_image_t *image =
+        encoder->image;
+    ips_png_band_t *band =
+        &encoder->bands[task->y0 / encoder->rows_per_band];
+    int is_last_band =
+        task->y1 == image->height;
+
+    size_t row_size =
+        image->width * image->channels;
+    size_t capacity;
+
+    /* Five filter candidates and a zero row above the image */
+    png_bytep candidates =
+        (png_bytep) ips_get_worker_scratch(task->worker, 6 * (row_size + 1));
+    png_bytep zero_row =
+        candidates + 5 * (row_size + 1);
+    memset(zero_row, 0, row_size);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    band->status = 0;
+    band->length = (uLong) ((task->y1 - task->y0) * (row_size + 1));
+    band->adler = adler32(0L, Z_NULL, 0);
+
+    if (deflateInit2(&stream, encoder->compression_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return;
+    }
+
+    capacity = deflateBound(&stream, band->length) + 64;
+    band->data = (png_bytep) malloc(capacity);
+    if (band->data) {
+        band->status = 1;
+        for (png_uint_32 y = task->y0; y < task->y1 && band->status; ++y) {
+            png_bytep filtered_row =
+                ips_filter_png_row(
+                    image->rows[y], y > 0 ? image->rows[y - 1] : zero_row,
+                    row_size, image->channels, encoder->filter_type, candidates
+                );
+
+            band->adler = adler32(band->adler, filtered_row, (uInt) (row_size + 1));
+
+            stream.next_in = filtered_row;
+            stream.avail_in = (uInt) (row_size + 1);
+            band->status =
+                ips_deflate_png_band_data(
+                    &stream, band, &capacity,
+                    y + 1 < task->y1 ? Z_NO_FLUSH : (is_last_band ? Z_FINISH : Z_SYNC_FLUSH)
+                );
+        }
+        band->size = stream.total_out;
+    }
+
+    deflateEnd(&stream);
+}
+
+static png_bytep ips_begin_png_chunk(png_bytep destination, const char *type, size_t length)
+{
+    png_save_uint_32(destination, (png_uint_32) length);
+    memcpy(destination + 4, type, 4);
+
+    return destination + 8;
+}
+
+static png_bytep ips_end_png_chunk(png_bytep chunk, png_bytep destination)
+{
+    png_save_uint_32(
+        destination,
+        (png_uint_32) crc32(crc32(0L, Z_NULL, 0), chunk + 4, (uInt) (destination - chunk - 4))
+    );
+
+    return destination + 4;
+}
+
+/*
+    Encodes an image into a PNG in memory. Bands of rows are filtered and
+    compressed on the task pool, every band becomes one IDAT chunk. The
+    Adler-32 checksums of the bands are combined for the zlib trailer.
+    Returns NULL on failure.
+*/
+png_bytep ips_encode_png(
+              ips_task_group_t *group,
+              ips_raw_image_t *image,
+              int filter_type,
+              int compression_level,
+              size_t *png_size
+          )
+{
+    static const png_byte Color_Types[] = {
+        PNG_COLOR_TYPE_GRAY, PNG_COLOR_TYPE_GRAY_ALPHA,
+        PNG_COLOR_TYPE_RGB,  PNG_COLOR_TYPE_RGBA
+    };
+
+    ips_png_encoder_t encoder;
+    size_t row_size =
+        image->width * image->channels;
+    size_t size, i;
+
+    png_bytep result = NULL, destination, chunk;
+    png_byte zlib_header[2];
+    uLong adler = adler32(0L, Z_NULL, 0);
+
+    int status = 1;
+
+    encoder.image = image;
+    encoder.compression_level = compression_level;
+    encoder.filter_type = filter_type;
+    encoder.rows_per_band =
+        (png_uint_32) IPS_MAX(1, Png_Band_Size / (row_size + 1));
+    encoder.number_of_bands =
+        (image->height + encoder.rows_per_band - 1) / encoder.rows_per_band;
+    encoder.bands =
+        (ips_png_band_t *) calloc(encoder.number_of_bands, sizeof(*encoder.bands));
+    if (!encoder.bands) {
+        return NULL;
+    }
+
+    for (i = 0; i < encoder.number_of_bands; ++i) {
+        ips_task_t *task;
+        task =
+            ips_allocate_task(group->task_arena);
+        task->input_image =
+            image;
+        task->output_image =
+            NULL;
+        task->intermediate_images =
+            NULL;
+        task->x0 =
+            0;
+        task->y0 =
+            (png_uint_32) i * encoder.rows_per_band;
+        task->x1 =
+            image->width;
+        task->y1 =
+            IPS_MIN(task->y0 + encoder.rows_per_band, image->height);
+        task->image_processing_parameters =
+            &encoder;
+        task->image_processing_function =
+            ips_deflate_png_band;
+        task->pass =
+            1;
+        task->pass_reduction =
+            NULL;
+        task->reduction =
+            NULL;
+        task->worker =
+            NULL;
+        task->group =
+            group;
+
+        ips_push_task(group->pool, task);
+    }
+    ips_wait_for_image_processing_tasks(group);
+
+    /* CMF of a 32K window and the FLEVEL hint, FCHECK makes the header divisible by 31 */
+    zlib_header[0] = 0x78;
+    zlib_header[1] =
+        (png_byte) ((compression_level < 2 ? 0 : (compression_level < 6 ? 1 : (compression_level == 6 ? 2 : 3))) << 6);
+    zlib_header[1] += 31 - ((zlib_header[0] * 256 + zlib_header[1]) % 31);
+
+    size = 8 + (12 + 13) + sizeof(zlib_header) + 4 + 12;
+    for (i = 0; i < encoder.number_of_bands; ++i) {
+        status = status && encoder.bands[i].status;
+        size += 12 + encoder.bands[i].size;
+        adler = adler32_combine(adler, encoder.bands[i].adler, (z_off_t) encoder.bands[i].length);
+    }
+
+    if (status) {
+        result = (png_bytep) malloc(size);
+    }
+
+    if (result) {
+        destination = result;
+
+        memcpy(destination, "\x89PNG\r\n\x1a\n", 8);
+        destination += 8;
+
+        chunk = destination;
+        destination = ips_begin_png_chunk(destination, "IHDR", 13);
+        png_save_uint_32(destination, image->width);
+        png_save_uint_32(destination + 4, image->height);
+        destination[8]  = 8;
+        destination[9]  = Color_Types[image->channels - 1];
+        destination[10] = PNG_COMPRESSION_TYPE_BASE;
+        destination[11] = PNG_FILTER_TYPE_BASE;
+        destination[12] = PNG_INTERLACE_NONE;
+        destination = ips_end_png_chunk(chunk, destination + 13);
+
+        for (i = 0; i < encoder.number_of_bands; ++i) {
+            ips_png_band_t *band = &encoder.bands[i];
+            int is_first_band = i == 0,
+                is_last_band  = i + 1 == encoder.number_of_bands;
+
+            chunk = destination;
+            destination =
+                ips_begin_png_chunk(
+                    destination, "IDAT",
+                    band->size + (is_first_band ? sizeof(zlib_header) : 0) + (is_last_band ? 4 : 0)
+                );
+            if (is_first_band) {
+                memcpy(destination, zlib_header, sizeof(zlib_header));
+                destination += sizeof(zlib_header);
+            }
+            memcpy(destination, band->data, band->size);
+            destination += band->size;
+            if (is_last_band) {
+                png_save_uint_32(destination, (png_uint_32) adler);
+                destination += 4;
+            }
+            destination = ips_end_png_chunk(chunk, destination);
+        }
+
+        chunk = destination;
+        destination = ips_begin_png_chunk(destination, "IEND", 0);
+        destination = ips_end_png_chunk(chunk, destination);
+
+        *png_size = (size_t) (destination - result);
+    }
+
+    for (i = 0; i < encoder.number_of_bands; ++i) {
+        free(encoder.bands[i].data);
+    }
+    free(encoder.bands);
+
+    return result;
+}
+
+/* Returns 0 on failure. */
+int ips_save_image_to_png_file(ips_task_group_t *group, ips_raw_image_t *image, const char *png_file_path)
+{
+    int status = 1;
+
+    size_t png_size = 0;
+    png_bytep png_data =
+        ips_encode_png(group, image, Png_Adaptive_Filter, png_compression_level, &png_size);
+
+    FILE *output_image_file = NULL;
+
+    if (!png_data) {
+        fprintf(stderr, "Error: failed to encode the output image\n");
+
+        return 0;
+    }
+
+    output_image_file = fopen(png_file_path, "wb");
+    if (!output_image_file) {
+        fprintf(stderr, "Error: failed to open the output image\n");
+        status = 0;
+    } else {
+        if (fwrite(png_data, 1, png_size, output_image_file) != png_size) {
+            status = 0;
+        }
+        if (fclose(output_image_file) != 0) {
+            status = 0;
+        }
+        if (!status) {
+            fprintf(stderr, "Error: failed to write the output image\n");
+        }
+    }
+
+    free(png_data);
+
+    return status;
+}
+
+ips_raw_image_t *ips_duplicate_image(ips_raw_image_t *image)
+{
+    ips_raw_image_t *duplicate = NULL;
+
+    if (image) {
+        duplicate =
+            ips_create_image_with_layout(
+                image->width,
+                image->height,
+                image->channels,
+                image->apron,
+                image->layout
+            );
+
+        /* The same layout, the apron and the padding are copied along */
+        memcpy(
+            duplicate->data, image->data,
+            ips_get_image_data_size(image)
+        );
+    }
+
+    return duplicate;
+}
+
+void ips_delete_image(ips_raw_image_t *image)
+{
+    if (image) {
+        if (image->data) {
+            ips_utils_aligned_free(image->data);
+            image->data = NULL;
+        }
+
+        if (image->rows) {
+            free(image->rows - image->apron);
+            image->rows = NULL;
+        }
+
+        free(image);
+    }
+}
+
+/*
+    Every level of the pyramid becomes a mip level, so zoomed out views are
+    filtered instead of skipping texels.
+*/
+GLuint ips_create_texture_from_pyramid(ips_pyramid_t *pyramid)
+{
+    GLuint texture = 0;
+    GLint format;
+
+    if (pyramid) {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        format = pyramid->levels[0]->channels == 3 ? GL_RGB : GL_RGBA;
+        for (unsigned int level = 0; level < pyramid->number_of_levels; ++level) {
+            ips_raw_image_t *image =
+                pyramid->levels[level];
+
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint) (image->stride / image->channels));
+            glTexImage2D(
+                GL_TEXTURE_2D, (GLint) level, format,
+                (GLsizei) image->width,
+                (GLsizei) image->height,
+                0, format, GL_UNSIGNED_BYTE,
+                (GLvoid *) image->rows[image->height - 1]
+            );
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint) pyramid->number_of_levels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    return texture;
+}
+
+void ips_update_texture_from_image(
+         GLuint texture,
+         ips_raw_image *image
+     )
+{
+    GLint format;
+
+    if (texture && image) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        format = image->channels == 3 ? GL_RGB : GL_RGBA;
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint) (image->stride / image->channels));
+        glTexSubImage2D(
+            GL_TEXTURE_2D, 0, 0, 0, image->width,
+            image->height,
+            format, GL_UNSIGNED_BYTE,
+            image->rows[image->height - 1]
+        );
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+}
+
+/* Uploads horizontal runs of dirty tiles as sub-rectangles of the texture. */
+void ips_update_texture_from_dirty_tiles(
+         GLuint texture,
+         ips_raw_image *image,
+         const ips_dirty_tiles_t *tiles
+     )
+{
+    GLint format;
+
+    if (texture && image && tiles->number_of_dirty_tiles > 0) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        format = image->channels == 3 ? GL_RGB : GL_RGBA;
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint) (image->stride / image->channels));
+
+        for (png_uint_32 row = 0; row < tiles->rows; ++row) {
+            png_uint_32 y0 =
+                row * tiles->tile_height;
+            png_uint_32 y1 =
+                IPS_MIN(y0 + tiles->tile_height, image->height);
+
+            for (png_uint_32 column = 0; column < tiles->columns; ++column) {
+                png_uint_32 first_column = column;
+                if (!tiles->flags[(size_t) row * tiles->columns + column]) {
+                    continue;
+                }
+
+                while (column + 1 < tiles->columns &&
+                           tiles->flags[(size_t) row * tiles->columns + column + 1]) {
+                    ++column;
+                }
+
+                png_uint_32 x0 =
+                    first_column * tiles->tile_width;
+                png_uint_32 x1 =
+                    IPS_MIN((column + 1) * tiles->tile_width, image->width);
+
+                /* Texture rows go bottom-up, the lowest one is image row y1 - 1 */
+                glTexSubImage2D(
+                    GL_TEXTURE_2D, 0,
+                    (GLint) x0, (GLint) (image->height - y1),
+                    (GLsizei) (x1 - x0), (GLsizei) (y1 - y0),
+                    format, GL_UNSIGNED_BYTE,
+                    image->rows[y1 - 1] + x0 * image->channels
+                );
+            }
+        }
+
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+}
+
+/*
+    Uploads the mip levels below the changed tiles of the first level. The
+    levels are small, so every one gets a single rectangle around all of
+    its changes.
+*/
+void ips_update_texture_mipmaps(
+         GLuint texture,
+         ips_pyramid_t *pyramid,
+         const ips_dirty_tiles_t *tiles
+     )
+{
+    png_uint_32 x0 = tiles->image_width,
+                y0 = tiles->image_height,
+                x1 = 0,
+                y1 = 0;
+    GLint format;
+
+    if (!texture || pyramid->number_of_levels < 2 || tiles->number_of_dirty_tiles == 0) {
+        return;
+    }
+
+    for (png_uint_32 row = 0; row < tiles->rows; ++row) {
+        for (png_uint_32 column = 0; column < tiles->columns; ++column) {
+            if (tiles->flags[(size_t) row * tiles->columns + column]) {
+                x0 = IPS_MIN(x0, column * tiles->tile_width);
+                y0 = IPS_MIN(y0, row * tiles->tile_height);
+                x1 = IPS_MAX(x1, IPS_MIN((column + 1) * tiles->tile_width, tiles->image_width));
+                y1 = IPS_MAX(y1, IPS_MIN((row + 1) * tiles->tile_height, tiles->image_height));
+            }
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    format = pyramid->levels[0]->channels == 3 ? GL_RGB : GL_RGBA;
+
+    for (unsigned int level = 1; level < pyramid->number_of_levels; ++level) {
+        ips_raw_image_t *image =
+            pyramid->levels[level];
+
+        x0 = x0 / 2;
+        y0 = y0 / 2;
+        x1 = IPS_MIN((x1 + 1) / 2, image->width);
+        y1 = IPS_MIN((y1 + 1) / 2, image->height);
+
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint) (image->stride / image->channels));
+        glTexSubImage2D(
+            GL_TEXTURE_2D, (GLint) level,
+            (GLint) x0, (GLint) (image->height - y1),
+            (GLsizei) (x1 - x0), (GLsizei) (y1 - y0),
+            format, GL_UNSIGNED_BYTE,
+            image->rows[y1 - 1] + x0 * image->channels
+        );
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/*
+    Starts the texture update from the pixel buffer of a whole frame, the
+    compute thread has already written the pixels into its mapping. The
+    fence tells when the buffer may be written again.
+*/
+void ips_update_texture_from_pixel_buffer(GLuint texture, ips_frame_t *frame)
+{
+    ips_raw_image_t *image =
+        frame->image;
+    GLint format =
+        image->channels == 3 ? GL_RGB : GL_RGBA;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, frame->pixel_buffer);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint) (image->stride / image->channels));
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0, 0, 0,
+        (GLsizei) image->width,
+        (GLsizei) image->height,
+        format, GL_UNSIGNED_BYTE,
+        (GLvoid *) (uintptr_t) (image->rows[image->height - 1] - image->data)
+    );
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (frame->upload_fence) {
+        glDeleteSync(frame->upload_fence);
+    }
+    frame->upload_fence =
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/* Blocks until the last texture update from the pixel buffer of a frame is done. */
+void ips_wait_for_texture_update(ips_frame_t *frame)
+{
+    GLenum status;
+
+    if (!frame->upload_fence) {
+        return;
+    }
+
+    do {
+        status =
+            glClientWaitSync(frame->upload_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    } while (status == GL_TIMEOUT_EXPIRED);
+
+    glDeleteSync(frame->upload_fence);
+    frame->upload_fence = NULL;
+}
+
+void ips_delete_texture(GLuint texture)
+{
+    glDeleteTextures(1, &texture);
+}
+
+void ips_update_model_matrix(ips_raw_image *image)
+{
+    model_matrix =
+        glm::scale(1.0f, (float) image->height / image->width, 1.0f);
+
+    ips_update_matrices(
+            Initial_Window_Width,
+            Initial_Window_Height
+    );
+}
+
+void ips_update_matrices(
+         int window_width,
+         int window_height
+     )
+{
+    view_matrix =
+        glm::lookAt<float>(
+            glm::vec3(camera_x, camera_y, -1),
+            glm::vec3(camera_x, camera_y, 0),
+            glm::vec3(0, 1, 0)
+        );
+
+    float aspect_ration =
+        fabsf(
+            (float) window_width /
+                (float) window_height
+        );
+
+    projection_matrix =
+        glm::ortho<float>(
+            -(camera_zoom * aspect_ration), camera_zoom * aspect_ration,
+            -camera_zoom, camera_zoom,
+            0.1f, 100
+        );
+
+    model_view_projection_matrix =
+        projection_matrix * view_matrix * model_matrix;
+}
+
+void ips_render_quad(
+         GLuint shader_program,
+         GLuint vertex_array_object,
+         GLuint texture
+     )
+{
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glUseProgram(shader_program);
+    glBindVertexArray(vertex_array_object);
+
+    if (texture && texture_sampler_uniform_location != -1) {
+        glActiveTexture(GL_TEXTURE0 + First_Texture_Unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glUniform1i(
+            texture_sampler_uniform_location,
+            First_Texture_Unit
+        );
+    }
+
+    glUniformMatrix4fv(
+        mvp_matrix_uniform_location,
+        1, GL_FALSE,
+        glm::value_ptr(model_view_projection_matrix)
+    );
+
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+    SDL_GL_SwapWindow(program_window);
+
+    ++frames;
+}
+
+void ips_update_view_matrix()
+{
+    SDL_GetWindowSize(
+        program_window,
+        &current_window_width,
+        &current_window_height
+    );
+
+    ips_update_matrices(
+        current_window_width,
+        current_window_height
+    );
+
+    glViewport(
+        0, 0,
+        (GLsizei) current_window_width,
+        (GLsizei) current_window_height
+    );
+
+    if (should_preview_visible_region && compute_coordinator) {
+        /* The camera looks along +Z, so the right of the window is -X in the world */
+        float half_width =
+            camera_zoom * fabsf((float) current_window_width / (float) current_window_height);
+        ips_view_t view = {
+            camera_x - half_width, camera_y - camera_zoom,
+            camera_x + half_width, camera_y + camera_zoom,
+            current_window_height / (2.0f * camera_zoom)
+        };
+
+        ips_request_view(compute_coordinator, &view);
+    }
+
+    should_render_frame = 1;
+}
+
+void ips_measure_and_show_frame_rate()
+{
+    static char title[IPS_WINDOW_TITLE_LENGTH];
+    static const char *title_format = "%s: %d X %d at %.2f FPS, filter %.1f ms, "
+                                      "upload %.3f ms from pixel buffers, %.3f ms from client memory, "
+                                      "%lu task allocations";
+
+    unsigned int timer_tick =
+        SDL_GetTicks();
+
+    float frame_rate =
+        1000.0f / (timer_tick - previous_timer_tick);
+    previous_timer_tick =
+        timer_tick;
+
+    snprintf(
+        title,
+        IPS_WINDOW_TITLE_LENGTH,
+        title_format,
+        Window_Title,
+        current_window_width,
+        current_window_height,
+        frame_rate,
+        filter_milliseconds,
+        pixel_buffer_upload_milliseconds,
+        client_upload_milliseconds,
+        task_allocations
+    );
+
+    SDL_SetWindowTitle(
+        program_window,
+        title
+    );
+}
+
+/* Accepts "WIDTHxHEIGHT", e.g. "64x64" or "100000x1" for row bands. */
+int ips_parse_tile_size(const char *tile_size)
+{
+    unsigned int width, height;
+
+    if (sscanf(tile_size, "%ux%u", &width, &height) != 2 ||
+            width == 0 || height == 0) {
+        fprintf(stderr, "Invalid tile size \"%s\"\n", tile_size);
+
+        return 0;
+    }
+
+    tile_width  = width;
+    tile_height = height;
+
+    return 1;
+}
+
+int ips_images_are_equal(ips_raw_image_t *first_image, ips_raw_image_t *second_image)
+{
+    if (first_image->width    != second_image->width  ||
+            first_image->height   != second_image->height ||
+            first_image->channels != second_image->channels) {
+        return 0;
+    }
+
+    if (first_image->layout == IPS_LAYOUT_PLANAR || second_image->layout == IPS_LAYOUT_PLANAR) {
+        for (png_uint_32 y = 0; y < first_image->height; ++y) {
+            for (png_uint_32 x = 0; x < first_image->width; ++x) {
+                for (unsigned int channel = 0; channel < first_image->channels; ++channel) {
+                    if (first_image->rows[y][x * first_image->pixel_step + channel * first_image->channel_step] !=
+                            second_image->rows[y][x * second_image->pixel_step + channel * second_image->channel_step]) {
+                        return 0;
+                    }
+                }
+            }
+        }
+
+        return 1;
+    }
+
+    for (png_uint_32 y = 0; y < first_image->height; ++y) {
+        if (memcmp(
+                first_image->rows[y], second_image->rows[y],
+                first_image->width * first_image->channels
+            ) != 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+double ips_benchmark_filter(
+           const ips_filter_t *filter,
+           ips_raw_image_t *input_image,
+           ips_raw_image_t *output_image,
+           unsigned int iterations
+       )
+{
+    Uint64 start = 0, end;
+    unsigned int iteration;
+
+    /* One warm-up frame to settle the task arena and caches */
+    for (iteration = 0; iteration <= iterations; ++iteration) {
+        if (iteration == 1) {
+            start = SDL_GetPerformanceCounter();
+        }
+
+        ips_reset_task_arena(task_group->task_arena);
+        ips_apply_filter(task_group, filter, input_image, output_image);
+    }
+    end = SDL_GetPerformanceCounter();
+
+    return (end - start) * 1000.0 / SDL_GetPerformanceFrequency() / iterations;
+}
+
+void *ips_request_generation_after_delay(void *args)
+{
+    ips_cancellation_timer_t *timer =
+        (ips_cancellation_timer_t *) args;
+
+    SDL_Delay(timer->delay);
+
+    timer->request_time = SDL_GetPerformanceCounter();
+    SDL_AtomicIncRef(timer->requested_generation);
+
+    return NULL;
+}
+
+/*
+    Flips a 16x16 square in the middle of a copy of the image, the change
+    the dirty tile and pyramid update benchmarks recompute.
+*/
+static ips_raw_image_t *ips_create_changed_benchmark_image(ips_raw_image_t *image)
+{
+    ips_raw_image_t *changed_image =
+        ips_duplicate_image(image);
+
+    for (png_uint_32 y = image->height / 2; y < IPS_MIN(image->height / 2 + 16, image->height); ++y) {
+        for (png_uint_32 x = image->width / 2; x < IPS_MIN(image->width / 2 + 16, image->width); ++x) {
+            for (unsigned int channel = 0; channel < image->channels; ++channel) {
+                changed_image->rows[y][x * image->channels + channel] ^= 0xFF;
+            }
+        }
+    }
+
+    return changed_image;
+}
+
+/* Every filter with square tiles and with full-row bands of a few heights. */
+static void ips_benchmark_tile_sizes(const ips_benchmark_t *benchmark)
+{
+    static const png_uint_32 Square_Tile_Sizes[] = {
+        16, 32, 64, 128, 256
+    };
+    static const png_uint_32 Band_Heights[] = {
+        1, 16, 64
+    };
+
+    png_uint_32 tile_sizes[32][2];
+    size_t number_of_tile_sizes = 0, i, j;
+
+    double milliseconds;
+    char description[32];
+
+    for (i = 0; i < sizeof(Square_Tile_Sizes) / sizeof(*Square_Tile_Sizes); ++i) {
+        tile_sizes[number_of_tile_sizes][0] = Square_Tile_Sizes[i];
+        tile_sizes[number_of_tile_sizes][1] = Square_Tile_Sizes[i];
+        ++number_of_tile_sizes;
+    }
+    for (i = 0; i < sizeof(Band_Heights) / sizeof(*Band_Heights); ++i) {
+        tile_sizes[number_of_tile_sizes][0] = benchmark->input_image->width;
+        tile_sizes[number_of_tile_sizes][1] = Band_Heights[i];
+        ++number_of_tile_sizes;
+    }
+
+    printf("%-24s %-14s %12s %12s\n", "filter", "tile", "ms/frame", "MP/s");
+
+    for (i = 0; i < Number_Of_Filters; ++i) {
+        for (j = 0; j < number_of_tile_sizes; ++j) {
+            tile_width  = tile_sizes[j][0];
+            tile_height = tile_sizes[j][1];
+
+            milliseconds =
+                ips_benchmark_filter(
+                    &Filters[i], benchmark->input_image, benchmark->output_image,
+                    Benchmark_Iterations
+                );
+
+            snprintf(
+                description, sizeof(description),
+                "%ux%u", tile_width, tile_height
+            );
+            printf(
+                "%-24s %-14s %12.3f %12.1f\n",
+                Filters[i].name, description, milliseconds,
+                benchmark->megapixels * 1000.0 / milliseconds
+            );
+        }
+    }
+
+    tile_width  = benchmark->tile_width;
+    tile_height = benchmark->tile_height;
+}
+
+/* Every filter with both schedulers at several thread counts, a new pool for each. */
+static void ips_benchmark_schedulers(const ips_benchmark_t *benchmark)
+{
+    static const ips_scheduler_t Schedulers[] = {
+        IPS_SCHEDULER_CENTRAL_QUEUE,
+        IPS_SCHEDULER_WORK_STEALING
+    };
+
+    size_t i, j, k;
+
+    double milliseconds;
+    char description[32];
+
+    printf("\n%-24s %-14s %12s %12s\n", "filter", "scheduler", "ms/frame", "MP/s");
+
+    for (i = 0; i < Number_Of_Filters; ++i) {
+        for (j = 0; j < sizeof(Benchmark_Thread_Counts) / sizeof(*Benchmark_Thread_Counts); ++j) {
+            for (k = 0; k < sizeof(Schedulers) / sizeof(*Schedulers); ++k) {
+                number_of_threads = Benchmark_Thread_Counts[j];
+                scheduler = Schedulers[k];
+                ips_create_image_processing_task_pool();
+
+                milliseconds =
+                    ips_benchmark_filter(
+                        &Filters[i], benchmark->input_image, benchmark->output_image,
+                        Benchmark_Iterations
+                    );
+
+                ips_delete_image_processing_task_pool();
+
+                snprintf(
+                    description, sizeof(description),
+                    "%s/%d", Scheduler_Names[Schedulers[k]], Benchmark_Thread_Counts[j]
+                );
+                printf(
+                    "%-24s %-14s %12.3f %12.1f\n",
+                    Filters[i].name, description, milliseconds,
+                    benchmark->megapixels * 1000.0 / milliseconds
+                );
+            }
+        }
+    }
+
+    number_of_threads = benchmark->number_of_threads;
+    scheduler = benchmark->scheduler;
+}
+
+/* Every vector path has to reproduce the scalar output bit-for-bit. Returns 0 on a mismatch. */
+static int ips_benchmark_simd_levels(const ips_benchmark_t *benchmark)
+{
+    size_t i, j;
+    int are_all_exact = 1;
+
+    double milliseconds;
+
+    printf("\n%-24s %-14s %12s %12s %8s\n", "filter", "simd", "ms/frame", "MP/s", "exact");
+
+    for (i = 0; i < Number_Of_Filters; ++i) {
+        ips_raw_image_t *reference_image = NULL;
+
+        for (j = IPS_SIMD_NONE; j <= (size_t) benchmark->simd_level; ++j) {
+            int is_exact = 1;
+
+            simd_level = (ips_simd_level_t) j;
+
+            milliseconds =
+                ips_benchmark_filter(
+                    &Filters[i], benchmark->input_image, benchmark->output_image,
+                    Benchmark_Iterations
+                );
+
+            if (!reference_image) {
+                reference_image = ips_duplicate_image(benchmark->output_image);
+            } else {
+                is_exact = ips_images_are_equal(reference_image, benchmark->output_image);
+            }
+
+            printf(
+                "%-24s %-14s %12.3f %12.1f %8s\n",
+                Filters[i].name, Simd_Level_Names[j], milliseconds,
+                benchmark->megapixels * 1000.0 / milliseconds,
+                is_exact ? "yes" : "NO"
+            );
+
+            are_all_exact = are_all_exact && is_exact;
+        }
+
+        ips_delete_image(reference_image);
+    }
+
+    simd_level = benchmark->simd_level;
+
+    return are_all_exact;
+}
+
+/*
+    The sorting networks of the small radii against the generic histogram
+    median. Returns 0 on a mismatch.
+*/
+static int ips_benchmark_median_networks(const ips_benchmark_t *benchmark)
+{
+    static const unsigned int Median_Radii[] = {
+        1, 2, 5
+    };
+
+    size_t i, j;
+    int are_all_exact = 1;
+
+    double milliseconds;
+    char description[32];
+
+    printf("\n%-24s %-14s %12s %12s %8s\n", "median", "simd", "ms/frame", "ms/MP", "exact");
+
+    for (i = 0; i < sizeof(Median_Radii) / sizeof(*Median_Radii); ++i) {
+        ips_raw_image_t *reference_image = NULL;
+
+        median_parameters.radius = Median_Radii[i];
+
+        for (j = IPS_SIMD_NONE; j <= (size_t) benchmark->simd_level; ++j) {
+            int is_exact = 1;
+
+            simd_level = (ips_simd_level_t) j;
+
+            milliseconds =
+                ips_benchmark_filter(
+                    ips_find_filter("median"), benchmark->input_image, benchmark->output_image,
+                    Benchmark_Iterations
+                );
+
+            if (!reference_image) {
+                reference_image = ips_duplicate_image(benchmark->output_image);
+            } else {
+                is_exact = ips_images_are_equal(reference_image, benchmark->output_image);
+            }
+
+            snprintf(
+                description, sizeof(description),
+                "radius %u", Median_Radii[i]
+            );
+            printf(
+                "%-24s %-14s %12.3f %12.3f %8s\n",
+                description, Simd_Level_Names[j], milliseconds,
+                milliseconds / benchmark->megapixels,
+                is_exact ? "yes" : "NO"
+            );
+
+            are_all_exact = are_all_exact && is_exact;
+        }
+
+        ips_delete_image(reference_image);
+    }
+
+    median_parameters.radius = benchmark->median_radius;
+    simd_level = benchmark->simd_level;
+
+    return are_all_exact;
+}
+
+/* The histogram median has to take about as long for any radius. */
+static void ips_benchmark_histogram_median(const ips_benchmark_t *benchmark)
+{
+    static const unsigned int Histogram_Median_Radii[] = {
+        3, 10, 30, 100
+    };
+
+    size_t i;
+
+    double milliseconds, first_milliseconds = 0.0;
+    char description[32];
+
+    printf("\n%-24s %-14s %12s %12s %8s\n", "histogram median", "simd", "ms/frame", "ms/MP", "vs first");
+
+    for (i = 0; i < sizeof(Histogram_Median_Radii) / sizeof(*Histogram_Median_Radii); ++i) {
+        median_parameters.radius = Histogram_Median_Radii[i];
+
+        milliseconds =
+            ips_benchmark_filter(
+                ips_find_filter("median"), benchmark->input_image, benchmark->output_image,
+                Benchmark_Iterations
+            );
+        if (i == 0) {
+            first_milliseconds = milliseconds;
+        }
+
+        snprintf(
+            description, sizeof(description),
+            "radius %u", Histogram_Median_Radii[i]
+        );
+        printf(
+            "%-24s %-14s %12.3f %12.3f %7.2fx\n",
+            description, Simd_Level_Names[simd_level], milliseconds,
+            milliseconds / benchmark->megapixels,
+            milliseconds / first_milliseconds
+        );
+    }
+
+    median_parameters.radius = benchmark->median_radius;
+}
+
+/*
+    The layout conversion both ways and every filter on planar images, which
+    have to match the interleaved ones sample for sample. Returns 0 on a
+    mismatch.
+*/
+static int ips_benchmark_layouts(const ips_benchmark_t *benchmark)
+{
+    ips_raw_image_t *input_image =
+        benchmark->input_image;
+    ips_raw_image_t *output_image =
+        benchmark->output_image;
+    ips_raw_image_t *planar_input_image, *planar_output_image;
+
+    size_t i;
+    int are_all_exact = 1;
+
+    double milliseconds;
+
+    printf("\n%-24s %-14s %12s %12s %8s\n", "filter", "layout", "ms/frame", "MP/s", "exact");
+
+    planar_input_image =
+        ips_create_image_with_layout(
+            input_image->width,
+            input_image->height,
+            input_image->channels,
+            0,
+            IPS_LAYOUT_PLANAR
+        );
+    planar_output_image = ips_duplicate_image(planar_input_image);
+
+    for (i = 0; i < 2; ++i) {
+        int is_exact;
+
+        milliseconds =
+            ips_benchmark_filter(
+                &Layout_Conversion_Filter,
+                i ? planar_input_image : input_image,
+                i ? output_image : planar_input_image,
+                Benchmark_Iterations
+            );
+        is_exact =
+            ips_images_are_equal(input_image, i ? output_image : planar_input_image);
+
+        printf(
+            "%-24s %-14s %12.3f %12.1f %8s\n",
+            Layout_Conversion_Filter.name, i ? "to interleaved" : "to planar",
+            milliseconds, benchmark->megapixels * 1000.0 / milliseconds,
+            is_exact ? "yes" : "NO"
+        );
+
+        are_all_exact = are_all_exact && is_exact;
+    }
+
+    for (i = 0; i < Number_Of_Filters; ++i) {
+        ips_raw_image_t *reference_image;
+        int is_exact;
+
+        milliseconds =
+            ips_benchmark_filter(
+                &Filters[i], input_image, output_image,
+                Benchmark_Iterations
+            );
+        reference_image = ips_duplicate_image(output_image);
+
+        printf(
+            "%-24s %-14s %12.3f %12.1f %8s\n",
+            Filters[i].name, "interleaved", milliseconds,
+            benchmark->megapixels * 1000.0 / milliseconds, "-"
+        );
+
+        milliseconds =
+            ips_benchmark_filter(
+                &Filters[i], planar_input_image, planar_output_image,
+                Benchmark_Iterations
+            );
+        is_exact =
+            ips_images_are_equal(reference_image, planar_output_image);
+
+        printf(
+            "%-24s %-14s %12.3f %12.1f %8s\n",
+            Filters[i].name, "planar", milliseconds,
+            benchmark->megapixels * 1000.0 / milliseconds,
+            is_exact ? "yes" : "NO"
+        );
+
+        are_all_exact = are_all_exact && is_exact;
+
+        ips_delete_image(reference_image);
+    }
+
+    ips_delete_image(planar_output_image);
+    ips_delete_image(planar_input_image);
+
+    return are_all_exact;
+}
+
+/* Recomputing the tiles around a small change has to give the full result. Returns 0 on a mismatch. */
+static int ips_benchmark_dirty_tiles(const ips_benchmark_t *benchmark)
+{
+    ips_raw_image_t *input_image =
+        benchmark->input_image;
+    ips_raw_image_t *output_image =
+        benchmark->output_image;
+    ips_raw_image_t *changed_image =
+        ips_create_changed_benchmark_image(input_image);
+    ips_raw_image_t *reference_image =
+        ips_duplicate_image(output_image);
+    ips_dirty_tiles_t *dirty_tiles =
+        ips_create_dirty_tiles(input_image->width, input_image->height);
+
+    size_t i, k;
+    int are_all_exact = 1;
+
+    double milliseconds;
+    char description[32];
+
+    printf("\n%-24s %-14s %12s %12s %8s\n", "incremental", "dirty tiles", "ms/change", "ms/full", "exact");
+
+    for (i = 0; i < Number_Of_Filters; ++i) {
+        double full_milliseconds;
+        int is_exact;
+
+        if (!ips_can_update_dirty_tiles(&Filters[i])) {
+            printf("%-24s %-14s %12s %12s %8s\n", Filters[i].name, "all", "n/a", "n/a", "-");
+            continue;
+        }
+
+        full_milliseconds =
+            ips_benchmark_filter(
+                &Filters[i], changed_image, reference_image,
+                Benchmark_Iterations
+            );
+
+        milliseconds = 0.0;
+        for (k = 0; k < Benchmark_Iterations; ++k) {
+            Uint64 start;
+
+            ips_reset_task_arena(task_group->task_arena);
+            ips_apply_filter(task_group, &Filters[i], input_image, output_image);
+
+            ips_clear_dirty_tiles(dirty_tiles);
+            ips_mark_changed_tiles(dirty_tiles, input_image, changed_image);
+
+            start = SDL_GetPerformanceCounter();
+            ips_reset_task_arena(task_group->task_arena);
+            ips_apply_filter_to_dirty_tiles(task_group, &Filters[i], changed_image, output_image, dirty_tiles);
+            milliseconds +=
+                (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+        }
+        milliseconds /= Benchmark_Iterations;
+
+        is_exact = ips_images_are_equal(reference_image, output_image);
+
+        snprintf(
+            description, sizeof(description),
+            "%zu/%zu", dirty_tiles->number_of_dirty_tiles,
+            (size_t) dirty_tiles->columns * dirty_tiles->rows
+        );
+        printf(
+            "%-24s %-14s %12.3f %12.3f %8s\n",
+            Filters[i].name, description, milliseconds, full_milliseconds,
+            is_exact ? "yes" : "NO"
+        );
+
+        are_all_exact = are_all_exact && is_exact;
+    }
+
+    ips_delete_dirty_tiles(dirty_tiles);
+    ips_delete_image(reference_image);
+    ips_delete_image(changed_image);
+
+    return are_all_exact;
+}
+
+/* A frame cancelled halfway returns once the running tasks are done. */
+static void ips_benchmark_cancellation(const ips_benchmark_t *benchmark)
+{
+    size_t i;
+
+    printf("\n%-24s %-14s %12s %12s %8s\n", "cancellation", "after ms", "ms/cancel", "ms/full", "stopped");
+
+    for (i = 0; i < Number_Of_Filters; ++i) {
+        ips_cancellation_timer_t timer;
+        SDL_atomic_t requested_generation;
+        pthread_t timer_thread;
+        double full_milliseconds;
+        int is_frame_complete;
+        Uint64 end;
+
+        full_milliseconds =
+            ips_benchmark_filter(
+                &Filters[i], benchmark->input_image, benchmark->output_image,
+                Benchmark_Iterations
+            );
+
+        SDL_AtomicSet(&requested_generation, 0);
+        timer.requested_generation = &requested_generation;
+        timer.delay = (Uint32) IPS_MAX(full_milliseconds / 2.0, 1.0);
+        timer.request_time = 0;
+
+        task_group->generation = 0;
+        task_group->requested_generation = &requested_generation;
+
+        pthread_create(&timer_thread, NULL, ips_request_generation_after_delay, &timer);
+        ips_reset_task_arena(task_group->task_arena);
+        is_frame_complete =
+            ips_apply_filter(task_group, &Filters[i], benchmark->input_image, benchmark->output_image);
+        end = SDL_GetPerformanceCounter();
+        pthread_join(timer_thread, NULL);
+
+        task_group->requested_generation = NULL;
+
+        if (is_frame_complete) {
+            printf(
+                "%-24s %-14u %12s %12.3f %8s\n",
+                Filters[i].name, (unsigned int) timer.delay, "n/a", full_milliseconds, "no"
+            );
+        } else {
+            printf(
+                "%-24s %-14u %12.3f %12.3f %8s\n",
+                Filters[i].name, (unsigned int) timer.delay,
+                (end - timer.request_time) * 1000.0 / SDL_GetPerformanceFrequency(),
+                full_milliseconds, "yes"
+            );
+        }
+    }
+}
+
+/*
+    Every layout and vector path of the pyramid has to reproduce the scalar
+    interleaved levels. Returns 0 on a mismatch.
+*/
+static int ips_benchmark_pyramid(const ips_benchmark_t *benchmark)
+{
+    ips_raw_image_t *input_image =
+        benchmark->input_image;
+    ips_raw_image_t *planar_input_image;
+    ips_pyramid_t *pyramid, *reference_pyramid = NULL;
+
+    size_t i, j, k;
+    int are_all_exact = 1;
+
+    double milliseconds;
+
+    printf("\n%-24s %-14s %12s %12s %8s\n", "pyramid", "simd", "ms/build", "MP/s", "exact");
+
+    planar_input_image =
+        ips_create_image_with_layout(
+            input_image->width,
+            input_image->height,
+            input_image->channels,
+            0,
+            IPS_LAYOUT_PLANAR
+        );
+    ips_reset_task_arena(task_group->task_arena);
+    ips_apply_filter(task_group, &Layout_Conversion_Filter, input_image, planar_input_image);
+
+    for (i = 0; i < 2; ++i) {
+        for (j = IPS_SIMD_NONE; j <= (size_t) benchmark->simd_level; ++j) {
+            int is_exact = 1;
+
+            simd_level = (ips_simd_level_t) j;
+
+            pyramid =
+                ips_create_pyramid(i ? planar_input_image : input_image);
+
+            milliseconds = 0.0;
+            for (k = 0; k < Benchmark_Iterations; ++k) {
+                Uint64 start = SDL_GetPerformanceCounter();
+                ips_build_pyramid(task_group, pyramid);
+                milliseconds +=
+                    (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+            }
+            milliseconds /= Benchmark_Iterations;
+
+            if (!reference_pyramid) {
+                reference_pyramid = pyramid;
+            } else {
+                for (unsigned int level = 1; level < pyramid->number_of_levels; ++level) {
+                    is_exact =
+                        is_exact &&
+                        ips_images_are_equal(reference_pyramid->levels[level], pyramid->levels[level]);
+                }
+                ips_delete_pyramid(pyramid);
+            }
+
+            printf(
+                "%-24s %-14s %12.3f %12.1f %8s\n",
+                i ? "planar" : "interleaved", Simd_Level_Names[j], milliseconds,
+                benchmark->megapixels * 1000.0 / milliseconds,
+                is_exact ? "yes" : "NO"
+            );
+
+            are_all_exact = are_all_exact && is_exact;
+        }
+    }
+
+    simd_level = benchmark->simd_level;
+
+    ips_delete_pyramid(reference_pyramid);
+    ips_delete_image(planar_input_image);
+
+    return are_all_exact;
+}
+
+/* A small change only redoes the levels below its tiles. Returns 0 on a mismatch. */
+static int ips_benchmark_pyramid_update(const ips_benchmark_t *benchmark)
+{
+    ips_raw_image_t *input_image =
+        benchmark->input_image;
+    ips_raw_image_t *changed_image =
+        ips_create_changed_benchmark_image(input_image);
+    ips_dirty_tiles_t *dirty_tiles =
+        ips_create_dirty_tiles(input_image->width, input_image->height);
+    ips_pyramid_t *pyramid =
+        ips_create_pyramid(input_image);
+    ips_pyramid_t *changed_pyramid =
+        ips_create_pyramid(changed_image);
+
+    size_t k;
+    int is_exact = 1;
+
+    double milliseconds, full_milliseconds;
+    char description[32];
+
+    printf("\n%-24s %-14s %12s %12s %8s\n", "pyramid update", "dirty tiles", "ms/change", "ms/full", "exact");
+
+    ips_mark_changed_tiles(dirty_tiles, input_image, changed_image);
+
+    full_milliseconds = 0.0;
+    for (k = 0; k < Benchmark_Iterations; ++k) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        ips_build_pyramid(task_group, changed_pyramid);
+        full_milliseconds +=
+            (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+    }
+    full_milliseconds /= Benchmark_Iterations;
+
+    milliseconds = 0.0;
+    for (k = 0; k < Benchmark_Iterations; ++k) {
+        Uint64 start;
+
+        pyramid->levels[0] = input_image;
+        ips_build_pyramid(task_group, pyramid);
+
+        start = SDL_GetPerformanceCounter();
+        pyramid->levels[0] = changed_image;
+        ips_update_pyramid(task_group, pyramid, dirty_tiles);
+        milliseconds +=
+            (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+    }
+    milliseconds /= Benchmark_Iterations;
+
+    for (unsigned int level = 1; level < changed_pyramid->number_of_levels; ++level) {
+        is_exact =
+            is_exact &&
+            ips_images_are_equal(changed_pyramid->levels[level], pyramid->levels[level]);
+    }
+
+    snprintf(
+        description, sizeof(description),
+        "%zu/%zu", dirty_tiles->number_of_dirty_tiles,
+        (size_t) dirty_tiles->columns * dirty_tiles->rows
+    );
+    printf(
+        "%-24s %-14s %12.3f %12.3f %8s\n",
+        "downsample", description, milliseconds, full_milliseconds,
+        is_exact ? "yes" : "NO"
+    );
+
+    ips_delete_pyramid(changed_pyramid);
+    ips_delete_pyramid(pyramid);
+    ips_delete_dirty_tiles(dirty_tiles);
+    ips_delete_image(changed_image);
+
+    return is_exact;
+}
+
+/* PNG encoding with bands deflated in parallel, a new pool for every thread count. */
+static void ips_benchmark_png_encoder(const ips_benchmark_t *benchmark)
+{
+    static const int Compression_Levels[] = {
+        1, 6, 9
+    };
+
+    ips_raw_image_t *output_image =
+        benchmark->output_image;
+
+    size_t i, j;
+
+    double milliseconds;
+    char description[32];
+
+    printf("\n%-24s %-14s %12s %12s %12s\n", "png level", "threads", "ms/image", "MB/s", "ratio");
+
+    for (i = 0; i < sizeof(Compression_Levels) / sizeof(*Compression_Levels); ++i) {
+        for (j = 0; j < sizeof(Benchmark_Thread_Counts) / sizeof(*Benchmark_Thread_Counts); ++j) {
+            size_t png_size = 0;
+            png_bytep png_data;
+            Uint64 start;
+
+            number_of_threads = Benchmark_Thread_Counts[j];
+            ips_create_image_processing_task_pool();
+
+            start = SDL_GetPerformanceCounter();
+            png_data = ips_encode_png(task_group, output_image, Png_Adaptive_Filter, Compression_Levels[i], &png_size);
+            milliseconds =
+                (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+            free(png_data);
+
+            ips_delete_image_processing_task_pool();
+
+            snprintf(
+                description, sizeof(description),
+                "level %d", Compression_Levels[i]
+            );
+            printf(
+                "%-24s %-14d %12.3f %12.1f %12.3f\n",
+                description, Benchmark_Thread_Counts[j], milliseconds,
+                benchmark->megapixels * output_image->channels * 1000.0 / milliseconds,
+                png_size / (benchmark->megapixels * 1000000.0 * output_image->channels)
+            );
+        }
+    }
+
+    number_of_threads = benchmark->number_of_threads;
+}
+
+/*
+    The SSE2 and SSSE3 row filters of libpng have to decode what the C ones
+    do. Returns 0 on a mismatch.
+*/
+static int ips_benchmark_png_unfilter(const ips_benchmark_t *benchmark)
+{
+    static const int Png_Filter_Types[] = {
+        1, 3, 4
+    };
+    static const char *Png_Filter_Names[] = {
+        "none", "sub", "up", "average", "paeth"
+    };
+
+    ips_raw_image_t *input_image =
+        benchmark->input_image;
+
+    size_t i, j, k;
+    int are_all_exact = 1;
+
+    double milliseconds;
+
+    printf("\n%-24s %-14s %12s %12s %8s\n", "png unfilter", "simd", "ms/image", "MP/s", "exact");
+
+    for (i = 0; i < sizeof(Png_Filter_Types) / sizeof(*Png_Filter_Types); ++i) {
+        size_t png_size = 0;
+        png_bytep png_data =
+            ips_encode_png(task_group, input_image, Png_Filter_Types[i], 1, &png_size);
+
+        for (j = 0; j < 2 && png_data; ++j) {
+            ips_raw_image_t *decoded_image =
+                ips_duplicate_image(input_image);
+            int is_decoded = 1, is_exact;
+
+            milliseconds = 0.0;
+            for (k = 0; k < Benchmark_Iterations; ++k) {
+                Uint64 start = SDL_GetPerformanceCounter();
+                is_decoded =
+                    ips_decode_png_into_image(png_data, png_size, (int) j, decoded_image) && is_decoded;
+                milliseconds +=
+                    (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+            }
+            milliseconds /= Benchmark_Iterations;
+
+            is_exact =
+                is_decoded && ips_images_are_equal(input_image, decoded_image);
+
+            printf(
+                "%-24s %-14s %12.3f %12.1f %8s\n",
+                Png_Filter_Names[Png_Filter_Types[i]], j == 0 ? "none" : "sse2",
+                milliseconds, benchmark->megapixels * 1000.0 / milliseconds,
+                is_exact ? "yes" : "NO"
+            );
+
+            are_all_exact = are_all_exact && is_exact;
+
+            ips_delete_image(decoded_image);
+        }
+
+        free(png_data);
+    }
+
+    return are_all_exact;
+}
+
+/* Loading a file through stdio and mmap with a cold and a warm page cache. */
+static void ips_benchmark_loaders(const ips_benchmark_t *benchmark, char *image_file_path)
+{
+    size_t i, j, k;
+
+    double milliseconds;
+
+    printf("\n%-24s %-14s %12s %12s\n", "load", "cache", "ms/image", "MB/s");
+
+    for (i = 0; i < 2; ++i) {
+        for (j = 0; j < 2; ++j) {
+            int is_cold = j == 0;
+            double file_megabytes = 0.0;
+
+            should_map_input_files = (int) i;
+            milliseconds = 0.0;
+
+            for (k = 0; k < Benchmark_Iterations; ++k) {
+                ips_raw_image_t *image;
+                Uint64 start;
+                FILE *file;
+
+                if (is_cold && !ips_utils_drop_file_from_cache(image_file_path)) {
+                    break;
+                } else if (!is_cold) {
+                    ips_delete_image(ips_load_image_from_png_file(image_file_path));
+                }
+
+                start = SDL_GetPerformanceCounter();
+                image = ips_load_image_from_png_file(image_file_path);
+                milliseconds +=
+                    (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+                ips_delete_image(image);
+
+                file = fopen(image_file_path, "rb");
+                if (file) {
+                    fseek(file, 0, SEEK_END);
+                    file_megabytes = ftell(file) / 1000000.0;
+                    fclose(file);
+                }
+            }
+
+            if (k < Benchmark_Iterations) {
+                printf(
+                    "%-24s %-14s %12s %12s\n",
+                    i ? "mmap" : "stdio", "cold", "n/a", "n/a"
+                );
+            } else {
+                milliseconds /= Benchmark_Iterations;
+                printf(
+                    "%-24s %-14s %12.3f %12.1f\n",
+                    i ? "mmap" : "stdio", is_cold ? "cold" : "warm",
+                    milliseconds, file_megabytes * 1000.0 / milliseconds
+                );
+            }
+        }
+    }
+
+    should_map_input_files = benchmark->should_map_input_files;
+}
+
+/*
+    Runs every filter over an image with a sweep of tile sizes and then
+    compares the schedulers at several thread counts, the SIMD levels, the
+    median kernels, the interleaved and planar layouts, the recomputation
+    of dirty tiles, the cancellation of frames, the PNG encoder and, for a
+    file, the stdio and mmap loaders without creating a window. A noise
+    image is generated if no path is given. Returns EXIT_FAILURE if any
+    exactness check found a mismatch.
+*/
+int ips_run_benchmark(char *image_file_path)
+{
+    static const png_uint_32 Synthetic_Image_Width  = 2048,
+                             Synthetic_Image_Height = 2048;
+
+    ips_benchmark_t benchmark;
+    int are_all_exact = 1;
+
+    if (image_file_path) {
+        benchmark.input_image = ips_load_image_from_png_file(image_file_path);
+        if (!benchmark.input_image) {
+            return EXIT_FAILURE;
+        }
+    } else {
+        benchmark.input_image =
+            ips_create_image(
+                Synthetic_Image_Width,
+                Synthetic_Image_Height,
+                3
+            );
+        srand(0);
+        for (png_uint_32 y = 0; y < benchmark.input_image->height; ++y) {
+            for (png_uint_32 x = 0; x < benchmark.input_image->width * benchmark.input_image->channels; ++x) {
+                benchmark.input_image->rows[y][x] = (png_byte) (rand() & 0xff);
+            }
+        }
+    }
+    benchmark.output_image =
+        ips_duplicate_image(benchmark.input_image);
+    benchmark.megapixels =
+        benchmark.input_image->width * (double) benchmark.input_image->height / 1000000.0;
+
+    benchmark.tile_width =
+        tile_width;
+    benchmark.tile_height =
+        tile_height;
+    benchmark.number_of_threads =
+        number_of_threads;
+    benchmark.scheduler =
+        scheduler;
+    benchmark.simd_level =
+        simd_level;
+    benchmark.median_radius =
+        median_parameters.radius;
+    benchmark.should_map_input_files =
+        should_map_input_files;
+
+    /* The pool settles the number of threads if it was not given */
+    ips_create_image_processing_task_pool();
+
+    printf(
+        "%u X %u X %u image, %d threads, %s scheduler, %s, %u iterations\n\n",
+        benchmark.input_image->width, benchmark.input_image->height, benchmark.input_image->channels,
+        number_of_threads, Scheduler_Names[scheduler],
+        Simd_Level_Names[simd_level], Benchmark_Iterations
     );
 
-    glLinkProgram(shader_program);
+    ips_benchmark_tile_sizes(&benchmark);
+    ips_delete_image_processing_task_pool();
 
-    glGetProgramiv(
-        shader_program,
-        GL_LINK_STATUS,
-        &status
+    /* Both make a pool for every thread count */
+    ips_benchmark_schedulers(&benchmark);
+
+    ips_create_image_processing_task_pool();
+    are_all_exact = ips_benchmark_simd_levels(&benchmark) && are_all_exact;
+    are_all_exact = ips_benchmark_median_networks(&benchmark) && are_all_exact;
+    ips_benchmark_histogram_median(&benchmark);
+    are_all_exact = ips_benchmark_layouts(&benchmark) && are_all_exact;
+    are_all_exact = ips_benchmark_dirty_tiles(&benchmark) && are_all_exact;
+    ips_benchmark_cancellation(&benchmark);
+    are_all_exact = ips_benchmark_pyramid(&benchmark) && are_all_exact;
+    are_all_exact = ips_benchmark_pyramid_update(&benchmark) && are_all_exact;
+    ips_delete_image_processing_task_pool();
+
+    ips_benchmark_png_encoder(&benchmark);
+
+    ips_create_image_processing_task_pool();
+    are_all_exact = ips_benchmark_png_unfilter(&benchmark) && are_all_exact;
+    ips_delete_image_processing_task_pool();
+
+    if (image_file_path) {
+        ips_benchmark_loaders(&benchmark, image_file_path);
+    }
+
+    ips_delete_image(benchmark.output_image);
+    ips_delete_image(benchmark.input_image);
+
+    if (!are_all_exact) {
+        fprintf(stderr, "Error: an exactness check of the benchmark failed\n");
+    }
+
+    return are_all_exact ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void ips_count_stress_task(ips_task_t *task)
+{
+    SDL_AtomicIncRef((SDL_atomic_t *) task->image_processing_parameters);
+}
+
+/* Pushes the tasks of a producer in batches, the last one is left to the drain. */
+void *ips_produce_stress_tasks(void *args)
+{
+    ips_queue_stress_thread_t *producer =
+        (ips_queue_stress_thread_t *) args;
+
+    size_t i = 0;
+
+    while (i < producer->number_of_tasks) {
+        size_t batch_end =
+            IPS_MIN(i + Queue_Stress_Batch, producer->number_of_tasks);
+
+        ips_reset_task_arena(producer->group->task_arena);
+        for (; i < batch_end; ++i) {
+            ips_task_t *task =
+                ips_allocate_task(producer->group->task_arena);
+
+            task->image_processing_function = ips_count_stress_task;
+            task->image_processing_parameters = &producer->run_counts[producer->first_task_id + i];
+            task->group = producer->group;
+            task->generation = 0;
+
+            if (ips_push_task(producer->pool, task)) {
+                producer->number_of_pushed_tasks++;
+            }
+        }
+
+        if (i < producer->number_of_tasks) {
+            ips_wait_for_image_processing_tasks(producer->group);
+        }
+    }
+
+    return NULL;
+}
+
+void *ips_consume_stress_tasks(void *args)
+{
+    ips_queue_stress_thread_t *consumer =
+        (ips_queue_stress_thread_t *) args;
+
+    ips_task_t *tasks[64];
+    size_t number_of_tasks;
+
+    for (;;) {
+        if (consumer->should_pop_batches) {
+            number_of_tasks =
+                ips_pop_tasks(consumer->pool, tasks, sizeof(tasks) / sizeof(*tasks));
+        } else {
+            tasks[0] = ips_pop_task(consumer->pool);
+            number_of_tasks = tasks[0] ? 1 : 0;
+        }
+
+        if (number_of_tasks == 0) {
+            break;
+        }
+
+        consumer->number_of_popped_tasks += number_of_tasks;
+        for (size_t i = 0; i < number_of_tasks; ++i) {
+            tasks[i]->image_processing_function(tasks[i]);
+            ips_finish_task(consumer->pool, tasks[i]->group);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+    Pushes millions of tasks through the task queue from as many producers
+    as there are consumers, half of which pop single tasks and half batches.
+    The queue is shut down while the last batches are still queued, they
+    have to be drained. Every task has to run exactly once and the pushed,
+    popped and run counts have to match.
+*/
+int ips_run_queue_stress_test()
+{
+    ips_task_pool_t queue;
+    ips_queue_stress_thread_t *producers, *consumers;
+    unsigned int number_of_producers, number_of_consumers, i;
+
+    SDL_atomic_t *run_counts;
+    size_t tasks_per_producer, number_of_tasks;
+    size_t number_of_pushed_tasks = 0,
+           number_of_popped_tasks = 0,
+           number_of_run_tasks = 0,
+           number_of_duplicate_runs = 0,
+           number_of_lost_tasks = 0,
+           number_of_unfinished_tasks = 0;
+
+    ips_task_t late_task;
+    int was_late_task_rejected;
+
+    double milliseconds;
+    Uint64 start;
+
+    number_of_consumers =
+        number_of_threads > 0 ? number_of_threads : ips_utils_get_number_of_cpu_cores();
+    number_of_consumers = IPS_MAX(number_of_consumers, 2);
+    number_of_producers = number_of_consumers;
+
+    tasks_per_producer = Queue_Stress_Tasks / number_of_producers;
+    number_of_tasks = tasks_per_producer * number_of_producers;
+
+    queue.capacity = Task_Pool_Capacity;
+    queue.tasks =
+        (ips_task_t **) malloc(sizeof(*queue.tasks) * queue.capacity);
+    queue.first_task_index = 0;
+    queue.size = 0;
+    queue.is_shut_down = 0;
+    queue.threads = NULL;
+    queue.scheduler = IPS_SCHEDULER_CENTRAL_QUEUE;
+    queue.workers = NULL;
+    queue.number_of_workers = number_of_consumers;
+    SDL_AtomicSet(&queue.number_of_stealable_tasks, 0);
+    queue.number_of_sleeping_workers = 0;
+
+    pthread_mutex_init(&queue.mutex, NULL);
+    pthread_cond_init(&queue.tasks_available, NULL);
+    pthread_cond_init(&queue.space_available, NULL);
+
+    run_counts =
+        (SDL_atomic_t *) malloc(sizeof(*run_counts) * number_of_tasks);
+    for (size_t task_id = 0; task_id < number_of_tasks; ++task_id) {
+        SDL_AtomicSet(&run_counts[task_id], 0);
+    }
+
+    producers =
+        (ips_queue_stress_thread_t *) calloc(number_of_producers, sizeof(*producers));
+    consumers =
+        (ips_queue_stress_thread_t *) calloc(number_of_consumers, sizeof(*consumers));
+
+    printf(
+        "%u producers, %u consumers, %lu tasks, queue of %lu\n\n",
+        number_of_producers, number_of_consumers,
+        (unsigned long) number_of_tasks, (unsigned long) queue.capacity
     );
 
-    if (status == GL_FALSE) {
-        GLint info_log_length;
-        glGetProgramiv(
-            shader_program,
-            GL_INFO_LOG_LENGTH,
-            &info_log_length
+    start = SDL_GetPerformanceCounter();
+
+    for (i = 0; i < number_of_consumers; ++i) {
+        consumers[i].pool = &queue;
+        consumers[i].should_pop_batches = i % 2;
+        pthread_create(&consumers[i].thread, NULL, ips_consume_stress_tasks, &consumers[i]);
+    }
+    for (i = 0; i < number_of_producers; ++i) {
+        producers[i].pool = &queue;
+        producers[i].group = ips_create_task_group(&queue);
+        producers[i].run_counts = run_counts;
+        producers[i].first_task_id = i * tasks_per_producer;
+        producers[i].number_of_tasks = tasks_per_producer;
+        pthread_create(&producers[i].thread, NULL, ips_produce_stress_tasks, &producers[i]);
+    }
+
+    for (i = 0; i < number_of_producers; ++i) {
+        pthread_join(producers[i].thread, NULL);
+        number_of_pushed_tasks += producers[i].number_of_pushed_tasks;
+    }
+
+    ips_shut_down_task_pool(&queue);
+
+    for (i = 0; i < number_of_consumers; ++i) {
+        pthread_join(consumers[i].thread, NULL);
+        number_of_popped_tasks += consumers[i].number_of_popped_tasks;
+    }
+
+    milliseconds =
+        (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+    /* Nothing may be taken once the queue is shut down */
+    late_task.image_processing_function = ips_count_stress_task;
+    late_task.image_processing_parameters = &run_counts[0];
+    late_task.group = producers[0].group;
+    was_late_task_rejected = !ips_push_task(&queue, &late_task);
+
+    for (size_t task_id = 0; task_id < number_of_tasks; ++task_id) {
+        int run_count = SDL_AtomicGet(&run_counts[task_id]);
+
+        number_of_run_tasks += run_count;
+        if (run_count == 0) {
+            ++number_of_lost_tasks;
+        } else if (run_count > 1) {
+            number_of_duplicate_runs += run_count - 1;
+        }
+    }
+
+    for (i = 0; i < number_of_producers; ++i) {
+        number_of_unfinished_tasks += producers[i].group->number_of_unfinished_tasks;
+        ips_delete_task_group(producers[i].group);
+    }
+
+    printf("%-24s %14lu\n", "pushed", (unsigned long) number_of_pushed_tasks);
+    printf("%-24s %14lu\n", "popped", (unsigned long) number_of_popped_tasks);
+    printf("%-24s %14lu\n", "run", (unsigned long) number_of_run_tasks);
+    printf("%-24s %14lu\n", "run twice or more", (unsigned long) number_of_duplicate_runs);
+    printf("%-24s %14lu\n", "never run", (unsigned long) number_of_lost_tasks);
+    printf("%-24s %14lu\n", "left in the queue", (unsigned long) queue.size);
+    printf("%-24s %14lu\n", "unfinished", (unsigned long) number_of_unfinished_tasks);
+    printf("%-24s %14s\n", "pushed after shutdown", was_late_task_rejected ? "rejected" : "TAKEN");
+    printf("%-24s %14.3f\n", "ms", milliseconds);
+    printf("%-24s %14.1f\n", "Mtasks/s", number_of_tasks / milliseconds / 1000.0);
+
+    free(consumers);
+    free(producers);
+    free(run_counts);
+
+    pthread_cond_destroy(&queue.space_available);
+    pthread_cond_destroy(&queue.tasks_available);
+    pthread_mutex_destroy(&queue.mutex);
+    free(queue.tasks);
+
+    if (number_of_pushed_tasks != number_of_tasks ||
+            number_of_popped_tasks != number_of_tasks ||
+            number_of_run_tasks != number_of_tasks ||
+            number_of_duplicate_runs != 0 ||
+            number_of_lost_tasks != 0 ||
+            number_of_unfinished_tasks != 0 ||
+            !was_late_task_rejected) {
+        fprintf(stderr, "The task queue lost, repeated or miscounted tasks\n");
+
+        return EXIT_FAILURE;
+    }
+
+    printf("\nok\n");
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Applies a chain of filters to an image and saves the result. Never
+    touches SDL video or OpenGL, so it works on machines without a display.
+    The first filter runs while the image is decoded, the rest ping-pong
+    between two buffers.
+*/
+int ips_run_batch(
+        char *input_image_file_path,
+        char *output_image_file_path,
+        const ips_filter_t **filters,
+        size_t number_of_filters
+    )
+{
+    Uint64 start, streamed, filtered, saved;
+    double frequency = (double) SDL_GetPerformanceFrequency();
+    double first_tiles_milliseconds = 0.0;
+
+    ips_png_reader_t *reader;
+    ips_raw_image_t *images[2], *interleaved_image;
+    size_t current_image = 1;
+
+    /* Planar chains stream the conversion instead of the first filter */
+    ips_layout_t layout =
+        should_use_planar_layout ? IPS_LAYOUT_PLANAR : IPS_LAYOUT_INTERLEAVED;
+    const ips_filter_t *streamed_filter =
+        should_use_planar_layout ? &Layout_Conversion_Filter : filters[0];
+    size_t first_filter =
+        should_use_planar_layout ? 0 : 1;
+
+    int status = EXIT_SUCCESS;
+
+    start = SDL_GetPerformanceCounter();
+
+    reader = ips_open_png_reader(input_image_file_path);
+    if (!reader) {
+        return EXIT_FAILURE;
+    }
+    interleaved_image = reader->image;
+    images[0] = interleaved_image;
+    images[1] =
+        ips_create_image_with_layout(
+            images[0]->width,
+            images[0]->height,
+            images[0]->channels,
+            0,
+            layout
         );
 
-        if (info_log_length > 0) {
-            GLchar *info_log =
-                (GLchar *) malloc((size_t) info_log_length);
+    ips_create_image_processing_task_pool();
 
-            glGetProgramInfoLog(
-                shader_program,
-                info_log_length,
-                NULL,
-                info_log
+    /* The first filter overlaps with decoding */
+    if (!ips_apply_filter_to_png_stream(task_group, streamed_filter, reader, images[1], &first_tiles_milliseconds)) {
+        ips_delete_image_processing_task_pool();
+        ips_close_png_reader(reader);
+        ips_delete_image(images[1]);
+        ips_delete_image(images[0]);
+
+        return EXIT_FAILURE;
+    }
+    ips_close_png_reader(reader);
+
+    if (should_use_planar_layout) {
+        images[0] =
+            ips_create_image_with_layout(
+                images[1]->width,
+                images[1]->height,
+                images[1]->channels,
+                0,
+                layout
             );
+    }
+
+    streamed = SDL_GetPerformanceCounter();
+
+    for (size_t i = first_filter; i < number_of_filters; ++i) {
+        ips_reset_task_arena(task_group->task_arena);
+        ips_apply_filter(task_group, filters[i], images[current_image], images[1 - current_image]);
+        current_image = 1 - current_image;
+    }
+
+    /* The decoded image is not needed anymore and takes the interleaved result */
+    if (should_use_planar_layout) {
+        ips_reset_task_arena(task_group->task_arena);
+        ips_apply_filter(task_group, &Layout_Conversion_Filter, images[current_image], interleaved_image);
+    } else {
+        interleaved_image = images[current_image];
+    }
+
+    filtered = SDL_GetPerformanceCounter();
+
+    ips_reset_task_arena(task_group->task_arena);
+    if (!ips_save_image_to_png_file(task_group, interleaved_image, output_image_file_path)) {
+        status = EXIT_FAILURE;
+    }
+
+    saved = SDL_GetPerformanceCounter();
+
+    ips_delete_image_processing_task_pool();
+
+    printf(
+        "%s: %u X %u X %u, first tiles %.3f ms, load and first filter %.3f ms, "
+        "other filters %.3f ms, save %.3f ms\n",
+        output_image_file_path,
+        images[0]->width, images[0]->height, images[0]->channels,
+        first_tiles_milliseconds,
+        (streamed - start) * 1000.0 / frequency,
+        (filtered - streamed) * 1000.0 / frequency,
+        (saved - filtered) * 1000.0 / frequency
+    );
+
+    if (should_use_planar_layout) {
+        ips_delete_image(interleaved_image);
+    }
+    ips_delete_image(images[1]);
+    ips_delete_image(images[0]);
+
+    return status;
+}
+
+void ips_init_batch_queue(ips_batch_queue_t *queue, size_t capacity, unsigned int number_of_producers)
+{
+    queue->capacity = capacity;
+    queue->items =
+        (ips_batch_item_t *) malloc(sizeof(*queue->items) * capacity);
+    queue->first_item_index = 0;
+    queue->size = 0;
+    queue->number_of_producers = number_of_producers;
+
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->items_available, NULL);
+    pthread_cond_init(&queue->space_available, NULL);
+}
+
+void ips_destroy_batch_queue(ips_batch_queue_t *queue)
+{
+    pthread_cond_destroy(&queue->space_available);
+    pthread_cond_destroy(&queue->items_available);
+    pthread_mutex_destroy(&queue->mutex);
+
+    free(queue->items);
+    queue->items = NULL;
+}
+
+/* Blocks while the queue is full. */
+void ips_push_batch_item(ips_batch_queue_t *queue, const ips_batch_item_t *item)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->size == queue->capacity) {
+        pthread_cond_wait(&queue->space_available, &queue->mutex);
+    }
+
+    queue->items[(queue->first_item_index + queue->size) % queue->capacity] =
+        *item;
+    queue->size++;
+
+    pthread_cond_signal(&queue->items_available);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/*
+    Blocks while the queue is empty. Returns 0 once it is empty and every
+    producer has left.
+*/
+int ips_pop_batch_item(ips_batch_queue_t *queue, ips_batch_item_t *item)
+{
+    int result = 0;
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->size == 0 && queue->number_of_producers > 0) {
+        pthread_cond_wait(&queue->items_available, &queue->mutex);
+    }
+
+    if (queue->size > 0) {
+        *item =
+            queue->items[queue->first_item_index];
+        queue->first_item_index =
+            (queue->first_item_index + 1) % queue->capacity;
+        queue->size--;
+        result = 1;
+
+        pthread_cond_signal(&queue->space_available);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return result;
+}
+
+/* Called by every producer once it has pushed its last item. */
+void ips_leave_batch_queue(ips_batch_queue_t *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    if (--queue->number_of_producers == 0) {
+        pthread_cond_broadcast(&queue->items_available);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/* Decode stage: claims the inputs one by one and inflates them. */
+void *ips_decode_batch_images(void *args)
+{
+    ips_batch_thread_t *thread = (ips_batch_thread_t *) args;
+    ips_batch_pipeline_t *pipeline = thread->pipeline;
+    ips_batch_item_t item;
+
+    for (;;) {
+        Uint64 start;
+
+        item.index =
+            (size_t) SDL_AtomicAdd(&pipeline->next_image_index, 1);
+        if (item.index >= pipeline->number_of_images) {
+            break;
+        }
+
+        start = SDL_GetPerformanceCounter();
+        item.image =
+            ips_load_image_from_png_file(pipeline->input_image_file_paths[item.index]);
+        thread->busy_ticks += SDL_GetPerformanceCounter() - start;
+
+        if (!item.image) {
+            fprintf(stderr, "Error: failed to load \"%s\"\n", pipeline->input_image_file_paths[item.index]);
+            SDL_AtomicAdd(&pipeline->number_of_failures, 1);
+
+            continue;
+        }
+
+        ++thread->number_of_images;
+        ips_push_batch_item(&pipeline->decoded_images, &item);
+    }
+
+    ips_leave_batch_queue(&pipeline->decoded_images);
+
+    return NULL;
+}
+
+/*
+    Filter stage: runs the filter chain of an image on the shared task pool.
+    Every thread has its own task group, so the tiles of several images are
+    processed by the pool at the same time.
+*/
+void *ips_filter_batch_images(void *args)
+{
+    ips_batch_thread_t *thread = (ips_batch_thread_t *) args;
+    ips_batch_pipeline_t *pipeline = thread->pipeline;
+    ips_batch_item_t item;
+
+    ips_task_group_t *group =
+        ips_create_task_group(pool);
+    ips_raw_image_t *spare_image = NULL, *image;
+    ips_raw_image_t *planar_images[2] = { NULL, NULL };
+
+    while (ips_pop_batch_item(&pipeline->decoded_images, &item)) {
+        Uint64 start = SDL_GetPerformanceCounter();
+
+        if (should_use_planar_layout) {
+            if (!planar_images[0] ||
+                    planar_images[0]->width    != item.image->width  ||
+                    planar_images[0]->height   != item.image->height ||
+                    planar_images[0]->channels != item.image->channels) {
+                for (int i = 0; i < 2; ++i) {
+                    ips_delete_image(planar_images[i]);
+                    planar_images[i] =
+                        ips_create_image_with_layout(
+                            item.image->width,
+                            item.image->height,
+                            item.image->channels,
+                            0,
+                            IPS_LAYOUT_PLANAR
+                        );
+                }
+            }
+
+            /* Split once, ping-pong between the planar images and join into the decoded one */
+            ips_reset_task_arena(group->task_arena);
+            ips_apply_filter(group, &Layout_Conversion_Filter, item.image, planar_images[0]);
+            for (size_t i = 0; i < pipeline->number_of_filters; ++i) {
+                ips_reset_task_arena(group->task_arena);
+                ips_apply_filter(group, pipeline->filters[i], planar_images[0], planar_images[1]);
+
+                image = planar_images[0];
+                planar_images[0] = planar_images[1];
+                planar_images[1] = image;
+            }
+            ips_reset_task_arena(group->task_arena);
+            ips_apply_filter(group, &Layout_Conversion_Filter, planar_images[0], item.image);
+        } else {
+            if (!spare_image ||
+                    spare_image->width    != item.image->width  ||
+                    spare_image->height   != item.image->height ||
+                    spare_image->channels != item.image->channels) {
+                /* A copy, so that samples a filter does not write are never garbage */
+                ips_delete_image(spare_image);
+                spare_image =
+                    ips_duplicate_image(item.image);
+            }
+
+            /* Ping-pong between the decoded image and the spare one */
+            for (size_t i = 0; i < pipeline->number_of_filters; ++i) {
+                ips_reset_task_arena(group->task_arena);
+                ips_apply_filter(group, pipeline->filters[i], item.image, spare_image);
+
+                image = item.image;
+                item.image = spare_image;
+                spare_image = image;
+            }
+        }
+
+        thread->busy_ticks += SDL_GetPerformanceCounter() - start;
+        ++thread->number_of_images;
+
+        ips_push_batch_item(&pipeline->filtered_images, &item);
+    }
+
+    ips_leave_batch_queue(&pipeline->filtered_images);
+
+    ips_delete_image(planar_images[1]);
+    ips_delete_image(planar_images[0]);
+    ips_delete_image(spare_image);
+    ips_delete_task_group(group);
+
+    return NULL;
+}
+
+/* Encode stage: deflates the bands of an image on the pool and writes it. */
+void *ips_encode_batch_images(void *args)
+{
+    ips_batch_thread_t *thread = (ips_batch_thread_t *) args;
+    ips_batch_pipeline_t *pipeline = thread->pipeline;
+    ips_batch_item_t item;
+
+    ips_task_group_t *group =
+        ips_create_task_group(pool);
+
+    while (ips_pop_batch_item(&pipeline->filtered_images, &item)) {
+        Uint64 start = SDL_GetPerformanceCounter();
+
+        ips_reset_task_arena(group->task_arena);
+        if (ips_save_image_to_png_file(group, item.image, pipeline->output_image_file_paths[item.index])) {
+            ++thread->number_of_images;
+        } else {
+            fprintf(stderr, "Error: failed to save \"%s\"\n", pipeline->output_image_file_paths[item.index]);
+            SDL_AtomicAdd(&pipeline->number_of_failures, 1);
+        }
+        ips_delete_image(item.image);
+
+        thread->busy_ticks += SDL_GetPerformanceCounter() - start;
+    }
+
+    ips_delete_task_group(group);
+
+    return NULL;
+}
+
+/*
+    Decodes, filters and encodes a list of images in three concurrent
+    stages connected by bounded queues. The filter and encode stages share
+    one task pool. At most decoders + filter jobs * 2 + encoders + both
+    queue capacities images are in memory at any time. Reports the
+    throughput and how busy every stage was.
+*/
+int ips_run_batch_pipeline(
+        char **input_image_file_paths,
+        char **output_image_file_paths,
+        size_t number_of_images,
+        const ips_filter_t **filters,
+        size_t number_of_filters
+    )
+{
+    static void *(*const Stage_Functions[IPS_NUMBER_OF_BATCH_STAGES])(void *) = {
+        ips_decode_batch_images,
+        ips_filter_batch_images,
+        ips_encode_batch_images
+    };
+    static const char *Stage_Names[IPS_NUMBER_OF_BATCH_STAGES] = {
+        "decode", "filter", "encode"
+    };
+
+    ips_batch_pipeline_t pipeline;
+    ips_batch_thread_t *threads;
+    size_t number_of_stage_threads = 0, number_of_encoded_images = 0, i;
+
+    Uint64 start, busy_ticks[IPS_NUMBER_OF_BATCH_STAGES] = { 0 };
+    size_t stage_images[IPS_NUMBER_OF_BATCH_STAGES] = { 0 };
+    double seconds;
+    int number_of_failures;
+
+    pipeline.input_image_file_paths = input_image_file_paths;
+    pipeline.output_image_file_paths = output_image_file_paths;
+    pipeline.number_of_images = number_of_images;
+    SDL_AtomicSet(&pipeline.next_image_index, 0);
+    SDL_AtomicSet(&pipeline.number_of_failures, 0);
+    pipeline.filters = filters;
+    pipeline.number_of_filters = number_of_filters;
+
+    ips_init_batch_queue(
+        &pipeline.decoded_images, batch_queue_capacity,
+        batch_stage_jobs[IPS_BATCH_STAGE_DECODE]
+    );
+    ips_init_batch_queue(
+        &pipeline.filtered_images, batch_queue_capacity,
+        batch_stage_jobs[IPS_BATCH_STAGE_FILTER]
+    );
+
+    ips_create_image_processing_task_pool();
+
+    for (i = 0; i < IPS_NUMBER_OF_BATCH_STAGES; ++i) {
+        number_of_stage_threads += batch_stage_jobs[i];
+    }
+    threads =
+        (ips_batch_thread_t *) calloc(number_of_stage_threads, sizeof(*threads));
 
-            fprintf(stderr, "Failed to link a GPU program\n");
-            fprintf(stderr, "Linker log:\n%s\n\n", info_log);
+    start = SDL_GetPerformanceCounter();
 
-            free(info_log);
+    number_of_stage_threads = 0;
+    for (i = 0; i < IPS_NUMBER_OF_BATCH_STAGES; ++i) {
+        for (int j = 0; j < batch_stage_jobs[i]; ++j) {
+            ips_batch_thread_t *thread = &threads[number_of_stage_threads++];
+
+            thread->pipeline = &pipeline;
+            thread->stage = (ips_batch_stage_t) i;
+            if (pthread_create(&thread->thread, NULL, Stage_Functions[i], thread) != 0) {
+                fprintf(stderr, "Failed to create a batch thread\n");
+
+                exit(EXIT_FAILURE);
+            }
         }
+    }
 
-        shader_program = 0;
+    for (i = 0; i < number_of_stage_threads; ++i) {
+        pthread_join(threads[i].thread, NULL);
+
+        busy_ticks[threads[i].stage] += threads[i].busy_ticks;
+        stage_images[threads[i].stage] += threads[i].number_of_images;
     }
 
-    glDetachShader(
-        shader_program,
-        vertex_shader_object
-    );
-    glDetachShader(
-        shader_program,
-        fragment_shader_object
+    seconds =
+        (SDL_GetPerformanceCounter() - start) / (double) SDL_GetPerformanceFrequency();
+    number_of_encoded_images =
+        stage_images[IPS_BATCH_STAGE_ENCODE];
+    number_of_failures =
+        SDL_AtomicGet(&pipeline.number_of_failures);
+
+    printf("%-24s %8s %12s %12s\n", "stage", "jobs", "images", "busy");
+    for (i = 0; i < IPS_NUMBER_OF_BATCH_STAGES; ++i) {
+        printf(
+            "%-24s %8d %12lu %11.1f%%\n",
+            Stage_Names[i], batch_stage_jobs[i], (unsigned long) stage_images[i],
+            busy_ticks[i] * 100.0 / (SDL_GetPerformanceFrequency() * seconds * batch_stage_jobs[i])
+        );
+    }
+    printf(
+        "\n%lu images in %.3f s, %.1f images/s, %d failed\n",
+        (unsigned long) number_of_encoded_images, seconds,
+        number_of_encoded_images / seconds, number_of_failures
     );
 
-    return shader_program;
+    free(threads);
+
+    ips_delete_image_processing_task_pool();
+
+    ips_destroy_batch_queue(&pipeline.filtered_images);
+    ips_destroy_batch_queue(&pipeline.decoded_images);
+
+    return number_of_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-void ips_delete_shader_program(GLuint shader_program)
+static int ips_compare_file_paths(const void *first, const void *second)
 {
-    glDeleteProgram(shader_program);
+    return SDL_strcasecmp(*(char * const *) first, *(char * const *) second);
 }
 
-GLuint ips_generate_quad_geometry()
+/*
+    Runs the batch pipeline over the PNG files of a directory, or over the
+    paths listed one per line in a text file. The results are saved under
+    the same names into the output directory, which is created if needed.
+    Nothing is processed if two inputs would be saved under the same name,
+    names that differ only in case count as the same.
+*/
+int ips_run_batch_on_directory(
+        char *input_path,
+        int is_file_list,
+        char *output_directory_path,
+        const ips_filter_t **filters,
+        size_t number_of_filters
+    )
 {
-    GLuint vertex_array_object  = 0,
-           vertex_buffer_object = 0;
+    char **names = NULL, **input_image_file_paths, **output_image_file_paths;
+    size_t number_of_names = 0, number_of_images = 0, i;
 
-    GLfloat vertex_data[] = {
-    //   Position           Color (RGBA),            Texture coordinates (UV)
-        -1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f,  1.0f, 0.0f,
-        -1.0f,  1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f,  1.0f, 1.0f,
-         1.0f,  1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f,  0.0f, 1.0f,
-         1.0f, -1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f,  0.0f, 0.0f
-    };
+    char *file_list = NULL, *line;
+    int status;
 
-    glGenVertexArrays(1, &vertex_array_object);
-    glBindVertexArray(vertex_array_object);
+    if (is_file_list) {
+        file_list = ips_utils_read_text_file(input_path);
+        if (!file_list) {
+            fprintf(stderr, "Error: failed to read the file list \"%s\"\n", input_path);
 
-    glGenBuffers(1, &vertex_buffer_object);
-    glBindBuffer(
-        GL_ARRAY_BUFFER,
-        vertex_buffer_object
-    );
-    glBufferData(
-        GL_ARRAY_BUFFER,
-        sizeof(vertex_data),
-        vertex_data,
-        GL_STATIC_DRAW
-    );
+            return EXIT_FAILURE;
+        }
+        for (line = file_list; *line; ++line) {
+            number_of_names += *line == '\n';
+        }
+        ++number_of_names;
+    } else {
+        names = ips_utils_list_directory(input_path, &number_of_names);
+        if (!names) {
+            fprintf(stderr, "Error: failed to read the directory \"%s\"\n", input_path);
 
-    GLsizei stride =
-        sizeof(GLfloat) * 9;
+            return EXIT_FAILURE;
+        }
+    }
 
-    glEnableVertexAttribArray(position_attribute_location);
-    glVertexAttribPointer(
-        position_attribute_location, 3, GL_FLOAT, GL_FALSE,
-        stride, (const GLvoid *) 0
-    );
+    if (!ips_utils_make_directory(output_directory_path)) {
+        fprintf(stderr, "Error: failed to create the output directory \"%s\"\n", output_directory_path);
+        ips_utils_free_list(names, number_of_names);
+        free(file_list);
 
-    glEnableVertexAttribArray(color_attribute_location);
-    glVertexAttribPointer(
-        color_attribute_location, 4, GL_FLOAT, GL_FALSE,
-        stride, (const GLvoid *) (sizeof(GLfloat) * 3)
-    );
+        return EXIT_FAILURE;
+    }
 
-    glEnableVertexAttribArray(texture_coordinates_attribute_location);
-    glVertexAttribPointer(
-        texture_coordinates_attribute_location, 2, GL_FLOAT, GL_FALSE,
-        stride, (const GLvoid *) (sizeof(GLfloat) * 7)
-    );
+    input_image_file_paths =
+        (char **) malloc(sizeof(*input_image_file_paths) * number_of_names);
+    output_image_file_paths =
+        (char **) malloc(sizeof(*output_image_file_paths) * number_of_names);
+
+    line = file_list;
+    for (i = 0; i < number_of_names; ++i) {
+        char *input_image_file_path;
+        const char *name;
+        size_t length;
+
+        if (is_file_list) {
+            /* Split the list in place, dropping the carriage returns and blank lines */
+            input_image_file_path = line;
+            line += strcspn(line, "\n");
+            if (*line) {
+                *line++ = '\0';
+            }
+            length = strlen(input_image_file_path);
+            while (length > 0 && isspace((unsigned char) input_image_file_path[length - 1])) {
+                input_image_file_path[--length] = '\0';
+            }
+            if (length == 0) {
+                continue;
+            }
 
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+            name = input_image_file_path + length;
+            while (name > input_image_file_path && name[-1] != '/' && name[-1] != '\\') {
+                --name;
+            }
 
-    return vertex_array_object;
+            input_image_file_paths[number_of_images] =
+                (char *) malloc(length + 1);
+            strcpy(input_image_file_paths[number_of_images], input_image_file_path);
+        } else {
+            name = names[i];
+            length = strlen(name);
+            if (length < 4 || SDL_strcasecmp(name + length - 4, ".png") != 0) {
+                continue;
+            }
+
+            input_image_file_paths[number_of_images] =
+                (char *) malloc(strlen(input_path) + length + 2);
+            sprintf(input_image_file_paths[number_of_images], "%s/%s", input_path, name);
+        }
+
+        output_image_file_paths[number_of_images] =
+            (char *) malloc(strlen(output_directory_path) + strlen(name) + 2);
+        sprintf(output_image_file_paths[number_of_images], "%s/%s", output_directory_path, name);
+
+        ++number_of_images;
+    }
+
+    status = EXIT_SUCCESS;
+    if (number_of_images > 1) {
+        char **sorted_output_image_file_paths =
+            (char **) malloc(sizeof(*sorted_output_image_file_paths) * number_of_images);
+
+        memcpy(sorted_output_image_file_paths, output_image_file_paths, sizeof(*sorted_output_image_file_paths) * number_of_images);
+        qsort(sorted_output_image_file_paths, number_of_images, sizeof(*sorted_output_image_file_paths), ips_compare_file_paths);
+        for (i = 1; i < number_of_images; ++i) {
+            if (ips_compare_file_paths(&sorted_output_image_file_paths[i - 1], &sorted_output_image_file_paths[i]) == 0) {
+                fprintf(
+                    stderr,
+                    "Error: more than one input would be saved as \"%s\"\n",
+                    sorted_output_image_file_paths[i]
+                );
+                status = EXIT_FAILURE;
+            }
+        }
+        free(sorted_output_image_file_paths);
+    }
+
+    if (number_of_images == 0) {
+        fprintf(stderr, "Error: no PNG images found in \"%s\"\n", input_path);
+        status = EXIT_FAILURE;
+    } else if (status == EXIT_SUCCESS) {
+        status =
+            ips_run_batch_pipeline(
+                input_image_file_paths, output_image_file_paths, number_of_images,
+                filters, number_of_filters
+            );
+    }
+
+    ips_utils_free_list(output_image_file_paths, number_of_images);
+    ips_utils_free_list(input_image_file_paths, number_of_images);
+    ips_utils_free_list(names, number_of_names);
+    free(file_list);
+
+    return status;
 }
 
-ips_raw_image_t *ips_load_image_from_png_file(char *png_file_path)
+void ips_create_compute_coordinator()
 {
-#define IPS_ERROR(MESSAGE)                     \
-do {                                           \
-    fprintf(stderr, "Error: %s\n", (MESSAGE)); \
-    status = 0;                                \
-    goto cleanup;                              \
-} while (0)
-    ips_raw_image_t *result;
+    ips_compute_coordinator_t *coordinator =
+        (ips_compute_coordinator_t *) calloc(1, sizeof(*coordinator));
+
+    pthread_mutex_init(&coordinator->mutex, NULL);
+    pthread_cond_init(&coordinator->request_available, NULL);
+
+    coordinator->filter_index =
+        current_filter_index;
+    coordinator->brightness_contrast[0] =
+        brightness_contrast[0];
+    coordinator->brightness_contrast[1] =
+        brightness_contrast[1];
+    coordinator->median_radius =
+        median_parameters.radius;
+
+    coordinator->back_frame  = &coordinator->frames[0];
+    coordinator->ready_frame = &coordinator->frames[1];
+    coordinator->front_frame = &coordinator->frames[2];
+
+    /* Persistent mappings let the compute thread write and read the buffers while they are in use */
+    coordinator->has_pixel_buffers =
+        should_use_pixel_buffers &&
+        (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) &&
+        (GLEW_VERSION_3_2 || GLEW_ARB_sync);
+
+    coordinator->frame_event_type =
+        SDL_RegisterEvents(1);
+    if (coordinator->frame_event_type == (Uint32) -1) {
+        coordinator->frame_event_type = SDL_USEREVENT;
+    }
 
-    result = (ips_raw_image *) malloc(sizeof(*result));
-    result->data = NULL;
-    result->rows = NULL;
-    result->width  = 0;
-    result->height = 0;
-    result->channels = 3;
+    compute_coordinator = coordinator;
 
-    int status = 1;
+    if (pthread_create(&coordinator->thread, NULL, ips_run_compute_coordinator, coordinator) != 0) {
+        fprintf(stderr, "Failed to create the compute thread\n");
 
-    FILE *input_image_file = NULL;
+        exit(EXIT_FAILURE);
+    }
+}
 
-    png_byte input_image_header[1];
-    png_structp png_input_image_struct = NULL;
+/* Cancels the frame in progress and stops the compute thread. */
+void ips_delete_compute_coordinator()
+{
+    ips_compute_coordinator_t *coordinator =
+        compute_coordinator;
+
+    if (coordinator) {
+        pthread_mutex_lock(&coordinator->mutex);
+        coordinator->should_stop = 1;
+        SDL_AtomicIncRef(&coordinator->requested_generation);
+        pthread_cond_signal(&coordinator->request_available);
+        pthread_mutex_unlock(&coordinator->mutex);
+
+        pthread_join(coordinator->thread, NULL);
+
+        for (int i = 0; i < IPS_NUMBER_OF_FRAMES; ++i) {
+            ips_frame_t *frame =
+                &coordinator->frames[i];
+
+            ips_delete_pyramid(frame->pyramid);
+            if (frame->image && frame->image->data == frame->pixel_buffer_data) {
+                ips_delete_image_view(frame->image);
+            } else {
+                ips_delete_image(frame->image);
+            }
+            ips_delete_dirty_tiles(frame->stale_tiles);
+            ips_delete_dirty_tiles(frame->changed_tiles);
 
-    png_infop png_input_image_info = NULL;
-    png_uint_32 input_image_width,
-                input_image_height;
+            ips_wait_for_texture_update(frame);
+            glDeleteBuffers(1, &frame->pixel_buffer);
+        }
 
-    int input_image_bit_depth,
-        input_image_color_type,
-        input_image_interlace_type,
-        input_image_compression_type,
-        input_image_filter_type;
+        SDL_free(coordinator->image_path);
 
-    png_bytep image_data  = NULL;
-    png_bytepp image_rows = NULL;
-    png_size_t image_row_size;
+        pthread_cond_destroy(&coordinator->request_available);
+        pthread_mutex_destroy(&coordinator->mutex);
 
-    png_uint_32 i;
+        free(coordinator);
+        compute_coordinator = NULL;
+    }
+}
 
-    input_image_file = fopen(png_file_path, "rb");
-    if (!input_image_file) {
-        IPS_ERROR(
-            "failed to open the input image"
-        );
+/* Asks for an image to be loaded, NULL reloads the current one from disk. */
+void ips_request_image(ips_compute_coordinator_t *coordinator, char *image_path)
+{
+    pthread_mutex_lock(&coordinator->mutex);
+    if (image_path) {
+        SDL_free(coordinator->image_path);
+        coordinator->image_path = image_path;
+    } else {
+        coordinator->should_reload_image = 1;
     }
+    SDL_AtomicIncRef(&coordinator->requested_generation);
+    pthread_cond_signal(&coordinator->request_available);
+    pthread_mutex_unlock(&coordinator->mutex);
+}
 
-    fread(input_image_header, 1, sizeof(input_image_header), input_image_file);
-    if (png_sig_cmp(input_image_header, 0, sizeof(input_image_header))) {
-        IPS_ERROR(
-            "input file is not a valid PNG file"
-        );
+/*
+    Applies a key that switches the filter or edits a parameter to the
+    requested state. A frame is only requested if the current filter uses
+    what was changed, the frame in progress is then cancelled.
+*/
+void ips_request_parameter_change(ips_compute_coordinator_t *coordinator, SDL_Keycode key)
+{
+    void *changed_parameters = NULL;
+
+    pthread_mutex_lock(&coordinator->mutex);
+    switch (key) {
+        case SDLK_f:
+            coordinator->filter_index =
+                (coordinator->filter_index + 1) % Number_Of_Filters;
+            coordinator->should_process_image = 1;
+            break;
+        case SDLK_LEFTBRACKET:
+        case SDLK_RIGHTBRACKET:
+            coordinator->brightness_contrast[0] +=
+                key == SDLK_RIGHTBRACKET ? Brightness_Step : -Brightness_Step;
+            changed_parameters = brightness_contrast;
+            break;
+        case SDLK_COMMA:
+        case SDLK_PERIOD:
+            coordinator->brightness_contrast[1] =
+                IPS_MAX(
+                    0.0f,
+                    coordinator->brightness_contrast[1] +
+                        (key == SDLK_PERIOD ? Contrast_Step : -Contrast_Step)
+                );
+            changed_parameters = brightness_contrast;
+            break;
+        case SDLK_9:
+        case SDLK_0:
+            coordinator->median_radius =
+                IPS_CLAMP(
+                    coordinator->median_radius + (key == SDLK_0 ? 1 : -1),
+                    1u, (unsigned int) IPS_MAXIMUM_MEDIAN_RADIUS
+                );
+            changed_parameters = &median_parameters;
+            break;
     }
 
-    png_input_image_struct =
-        png_create_read_struct(
-            PNG_LIBPNG_VER_STRING,
-            NULL, NULL, NULL
-        );
+    if (changed_parameters &&
+            Filters[coordinator->filter_index].image_processing_parameters == changed_parameters) {
+        coordinator->should_process_image = 1;
+    }
+    if (coordinator->should_process_image) {
+        SDL_AtomicIncRef(&coordinator->requested_generation);
+        pthread_cond_signal(&coordinator->request_available);
+    }
+    pthread_mutex_unlock(&coordinator->mutex);
+}
 
-    if (!png_input_image_struct) {
-        IPS_ERROR(
-            "internal error: libpng: read structure was not created"
-        );
+/*
+    Asks the render thread for a mapped pixel buffer of the given size for
+    the back frame and waits for it. Returns NULL if the context has no
+    pixel buffers, creating one failed or the thread is stopping, the frame
+    then lives in client memory.
+*/
+png_bytep ips_request_pixel_buffer(ips_compute_coordinator_t *coordinator, ips_frame_t *frame, size_t size)
+{
+    png_bytep data = NULL;
+    SDL_Event event;
+
+    if (!coordinator->has_pixel_buffers) {
+        return NULL;
     }
 
-    png_input_image_info = png_create_info_struct(png_input_image_struct);
-    if (!png_input_image_info) {
-        IPS_ERROR(
-            "internal error: libpng: info structure for the "
-            "input file was not created"
-        );
+    pthread_mutex_lock(&coordinator->mutex);
+    coordinator->pixel_buffer_frame =
+        frame;
+    coordinator->pixel_buffer_size =
+        size;
+    pthread_mutex_unlock(&coordinator->mutex);
+
+    SDL_zero(event);
+    event.type = coordinator->frame_event_type;
+    SDL_PushEvent(&event);
+
+    /* The render thread answers on the condition of the requests */
+    pthread_mutex_lock(&coordinator->mutex);
+    while (coordinator->pixel_buffer_frame && !coordinator->should_stop) {
+        pthread_cond_wait(&coordinator->request_available, &coordinator->mutex);
+    }
+    if (!coordinator->pixel_buffer_frame) {
+        data = frame->pixel_buffer_data;
     }
+    coordinator->pixel_buffer_frame = NULL;
+    pthread_mutex_unlock(&coordinator->mutex);
 
-    if (setjmp(png_jmpbuf(png_input_image_struct))) {
-        IPS_ERROR(
-            "failed to read the image"
+    return data;
+}
+
+/*
+    Replaces the pixel buffer of the frame the compute thread asked for with
+    a new one mapped for good. The frame was taken off screen by
+    ips_acquire_frame after its last texture update finished, so only the
+    compute thread uses the old buffer, and it has let go of it.
+*/
+void ips_serve_pixel_buffer_request(ips_compute_coordinator_t *coordinator)
+{
+    ips_frame_t *frame;
+    GLbitfield flags =
+        GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    pthread_mutex_lock(&coordinator->mutex);
+    frame = coordinator->pixel_buffer_frame;
+    if (frame) {
+        glDeleteBuffers(1, &frame->pixel_buffer);
+
+        /* Client storage keeps the buffer in system memory, the compute thread reads it too */
+        glGenBuffers(1, &frame->pixel_buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, frame->pixel_buffer);
+        glBufferStorage(
+            GL_PIXEL_UNPACK_BUFFER,
+            (GLsizeiptr) coordinator->pixel_buffer_size,
+            NULL,
+            flags | GL_CLIENT_STORAGE_BIT
         );
-    }
+        frame->pixel_buffer_data =
+            (png_bytep) glMapBufferRange(
+                            GL_PIXEL_UNPACK_BUFFER,
+                            0, (GLsizeiptr) coordinator->pixel_buffer_size,
+                            flags
+                        );
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        if (!frame->pixel_buffer_data ||
+                (uintptr_t) frame->pixel_buffer_data % IPS_ROW_ALIGNMENT != 0) {
+            glDeleteBuffers(1, &frame->pixel_buffer);
+            frame->pixel_buffer = 0;
+            frame->pixel_buffer_data = NULL;
+        }
 
-    png_init_io(
-        png_input_image_struct,
-        input_image_file
-    );
-    png_set_sig_bytes(
-        png_input_image_struct,
-        sizeof(input_image_header)
-    );
+        coordinator->pixel_buffer_frame = NULL;
+        pthread_cond_signal(&coordinator->request_available);
+    }
+    pthread_mutex_unlock(&coordinator->mutex);
+}
 
-    png_read_info(
-        png_input_image_struct,
-        png_input_image_info
-    );
+/*
+    Gives a frame an image of the size of the given one, in a pixel buffer
+    if the render thread can map one. A new image starts with every tile
+    stale and changed. Returns 1 if the image was replaced.
+*/
+int ips_prepare_frame(ips_compute_coordinator_t *coordinator, ips_frame_t *frame, ips_raw_image_t *image)
+{
+    png_bytep data;
 
-    png_get_IHDR(
-        png_input_image_struct,
-        png_input_image_info,
-        &input_image_width,
-        &input_image_height,
-        &input_image_bit_depth,
-        &input_image_color_type,
-        &input_image_interlace_type,
-        &input_image_compression_type,
-        &input_image_filter_type
-    );
+    if (frame->image &&
+            frame->image->width    == image->width  &&
+            frame->image->height   == image->height &&
+            frame->image->channels == image->channels) {
+        return 0;
+    }
 
-    if (input_image_interlace_type != PNG_INTERLACE_NONE) {
-        IPS_ERROR(
-            "interlaced images are not supported"
-        );
+    ips_delete_pyramid(frame->pyramid);
+    if (frame->image && frame->image->data == frame->pixel_buffer_data) {
+        ips_delete_image_view(frame->image);
+    } else {
+        ips_delete_image(frame->image);
     }
 
-    if ((input_image_color_type != PNG_COLOR_TYPE_RGB &&
-         input_image_color_type != PNG_COLOR_TYPE_RGBA) ||
-            input_image_bit_depth != 8) {
-        IPS_ERROR(
-            "only RGB or RGBA 8-bit images can be processed"
-        );
+    frame->image =
+        ips_create_image_header(image->width, image->height, image->channels, 0, IPS_LAYOUT_INTERLEAVED);
+    data =
+        ips_request_pixel_buffer(coordinator, frame, ips_get_image_data_size(frame->image));
+    if (!data) {
+        data =
+            (png_bytep) ips_utils_aligned_malloc(
+                            ips_get_image_data_size(frame->image),
+                            IPS_ROW_ALIGNMENT
+                        );
     }
+    ips_set_image_data(frame->image, data);
+    frame->pyramid =
+        ips_create_pyramid(frame->image);
+
+    ips_delete_dirty_tiles(frame->stale_tiles);
+    frame->stale_tiles =
+        ips_create_dirty_tiles(image->width, image->height);
+    ips_mark_dirty_rectangle(frame->stale_tiles, 0, 0, image->width, image->height);
+
+    ips_delete_dirty_tiles(frame->changed_tiles);
+    frame->changed_tiles =
+        ips_create_dirty_tiles(image->width, image->height);
+    ips_mark_dirty_rectangle(frame->changed_tiles, 0, 0, image->width, image->height);
+
+    return 1;
+}
 
-    if (input_image_color_type == PNG_COLOR_TYPE_RGBA) {
-        result->channels = 4;
+/*
+    Swaps the finished back frame with the ready one. If the render thread
+    has not taken the ready frame, its changes are carried over, the texture
+    still lacks them. The arena of the task group is only touched by the
+    compute thread, its count is passed on with the frame. Returns the frame
+    that was published.
+*/
+ips_frame_t *ips_publish_frame(ips_compute_coordinator_t *coordinator, double filter_milliseconds)
+{
+    ips_frame_t *frame;
+    SDL_Event event;
+
+    pthread_mutex_lock(&coordinator->mutex);
+    frame = coordinator->back_frame;
+    if (coordinator->has_new_frame) {
+        ips_merge_dirty_tiles(frame->changed_tiles, coordinator->ready_frame->changed_tiles);
     }
-#undef IPS_ERROR
 
-    image_row_size =
-        png_get_rowbytes(
-            png_input_image_struct,
-            png_input_image_info
-        );
+    coordinator->back_frame  = coordinator->ready_frame;
+    coordinator->ready_frame = frame;
+    coordinator->has_new_frame = 1;
+    coordinator->filter_milliseconds =
+        filter_milliseconds;
+    coordinator->number_of_task_allocations =
+        task_group->task_arena->number_of_allocations;
+    pthread_mutex_unlock(&coordinator->mutex);
 
-    image_data =
-        (png_bytep) png_malloc(
-                        png_input_image_struct,
-                        input_image_height * image_row_size
-                    );
-    image_rows =
-        (png_bytepp) png_malloc(
-                         png_input_image_struct,
-                         input_image_height * sizeof(png_bytep)
-                     );
+    SDL_zero(event);
+    event.type = coordinator->frame_event_type;
+    SDL_PushEvent(&event);
 
-    for (i = 0; i < input_image_height; ++i) {
-        image_rows[input_image_height - i - 1] =
-            image_data + i * image_row_size;
+    return frame;
+}
+
+/*
+    Returns the latest finished frame, or NULL if it was already taken. The
+    frame on screen goes back to the compute thread, which writes into its
+    pixel buffer, so the texture update from it has to be done first.
+*/
+ips_frame_t *ips_acquire_frame(ips_compute_coordinator_t *coordinator)
+{
+    ips_frame_t *frame = NULL;
+    int has_new_frame;
+
+    pthread_mutex_lock(&coordinator->mutex);
+    has_new_frame =
+        coordinator->has_new_frame;
+    pthread_mutex_unlock(&coordinator->mutex);
+
+    if (!has_new_frame) {
+        return NULL;
     }
+    ips_wait_for_texture_update(coordinator->front_frame);
 
-    png_read_image(
-        png_input_image_struct,
-        image_rows
-    );
+    /* Only the render thread takes frames, so the new one is still there */
+    pthread_mutex_lock(&coordinator->mutex);
+    frame = coordinator->ready_frame;
 
-cleanup:
-    if (status) {
-        result->data =
-            image_data;
-        result->rows =
-            image_rows;
-        result->width =
-            input_image_width;
-        result->height =
-            input_image_height;
-    } else {
-        if (result) {
-            free(result);
-            result = NULL;
+    coordinator->ready_frame = coordinator->front_frame;
+    coordinator->front_frame = frame;
+    coordinator->has_new_frame = 0;
+
+    filter_milliseconds =
+        coordinator->filter_milliseconds;
+    task_allocations =
+        coordinator->number_of_task_allocations;
+    pthread_mutex_unlock(&coordinator->mutex);
+
+    return frame;
+}
+
+/*
+    Body of the compute thread. Loads the requested images and runs the
+    current filter on them with the interactive task group, then publishes
+    the result. Images reloaded with the same size only have the tiles that
+    changed recomputed. A frame is cancelled as soon as a request makes it
+    obsolete, at most the tasks already running are finished.
+*/
+void *ips_run_compute_coordinator(void *args)
+{
+    ips_compute_coordinator_t *coordinator =
+        (ips_compute_coordinator_t *) args;
+
+    /* With --planar the filters run on these, frames only take the interleaved result */
+    ips_raw_image_t *planar_source_image = NULL,
+                    *planar_image        = NULL;
+
+    /* Tiles of the output that a reload of a same-sized image has to recompute */
+    ips_dirty_tiles_t *dirty_tiles = NULL;
+    char *source_image_path = NULL;
+
+    ips_frame_t *latest_frame = NULL;
+
+    /* Set when a frame was cancelled, the images it left partly written are redone in full */
+    int should_redo_frame = 0;
+
+    /* With --preview only the view is filtered at first, the rest while it is idle */
+    ips_preview_t preview = { NULL, 0, NULL, NULL, NULL };
+    ips_view_t view = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    int should_refine = 0;
+
+    for (;;) {
+        char *image_path;
+        int should_process_image, is_refinement, is_frame_complete;
+        unsigned int generation;
+
+        pthread_mutex_lock(&coordinator->mutex);
+        while (!coordinator->should_stop &&
+                   !coordinator->should_process_image &&
+                   !coordinator->should_reload_image &&
+                   !coordinator->image_path &&
+                   !coordinator->has_new_view &&
+                   !should_refine) {
+            pthread_cond_wait(&coordinator->request_available, &coordinator->mutex);
         }
 
-        if (image_data) {
-            png_free(png_input_image_struct, image_data);
-            image_data = NULL;
+        if (coordinator->should_stop) {
+            pthread_mutex_unlock(&coordinator->mutex);
+            break;
         }
 
-        if (image_rows) {
-            png_free(png_input_image_struct, image_rows);
-            image_rows = NULL;
+        image_path = coordinator->image_path;
+        if (!image_path && coordinator->should_reload_image && source_image_path) {
+            image_path = SDL_strdup(source_image_path);
+        }
+        coordinator->image_path = NULL;
+        coordinator->should_reload_image = 0;
+
+        should_process_image = coordinator->should_process_image;
+        coordinator->should_process_image = 0;
+
+        is_refinement =
+            !image_path && !should_process_image && !coordinator->has_new_view;
+        coordinator->is_refining = is_refinement;
+        if (coordinator->has_new_view) {
+            view = coordinator->view;
+            coordinator->has_new_view = 0;
+        }
+
+        generation =
+            (unsigned int) SDL_AtomicGet(&coordinator->requested_generation);
+
+        /* The filters read the parameters from here, only this thread writes them now */
+        current_filter_index =
+            coordinator->filter_index;
+        brightness_contrast[0] =
+            coordinator->brightness_contrast[0];
+        brightness_contrast[1] =
+            coordinator->brightness_contrast[1];
+        median_parameters.radius =
+            coordinator->median_radius;
+        pthread_mutex_unlock(&coordinator->mutex);
+
+        if (image_path) {
+            ips_raw_image_t *new_image;
+            if ((new_image = ips_load_image_from_png_file(image_path)) &&
+                    source_image && dirty_tiles &&
+                    new_image->width    == source_image->width  &&
+                    new_image->height   == source_image->height &&
+                    new_image->channels == source_image->channels) {
+                /* The frames stay, only the changed tiles are redone */
+                ips_mark_changed_tiles(dirty_tiles, source_image, new_image);
+
+                ips_delete_image(source_image);
+                source_image = new_image;
+
+                if (planar_source_image) {
+                    ips_reset_task_arena(task_group->task_arena);
+                    ips_apply_filter_to_dirty_tiles(
+                        task_group, &Layout_Conversion_Filter,
+                        source_image, planar_source_image,
+                        dirty_tiles
+                    );
+                }
+            } else if (new_image) {
+                ips_delete_image(source_image);
+                source_image = new_image;
+
+                ips_delete_dirty_tiles(dirty_tiles);
+                dirty_tiles = ips_create_dirty_tiles(source_image->width, source_image->height);
+
+                if (should_use_planar_layout) {
+                    ips_delete_image(planar_source_image);
+                    planar_source_image =
+                        ips_create_image_with_layout(
+                            source_image->width, source_image->height, source_image->channels,
+                            0, IPS_LAYOUT_PLANAR
+                        );
+                    ips_delete_image(planar_image);
+                    planar_image =
+                        ips_duplicate_image(planar_source_image);
+
+                    ips_reset_task_arena(task_group->task_arena);
+                    ips_apply_filter(task_group, &Layout_Conversion_Filter, source_image, planar_source_image);
+                }
+
+                should_process_image = 1;
+            }
+
+            if (new_image) {
+                SDL_free(source_image_path);
+                source_image_path = image_path;
+
+                if (should_preview_visible_region) {
+                    ips_update_preview_pyramid(
+                        task_group, &preview,
+                        planar_source_image ? planar_source_image : source_image,
+                        dirty_tiles
+                    );
+                    ips_clear_dirty_tiles(dirty_tiles);
+                    should_process_image = 1;
+                }
+            } else {
+                SDL_free(image_path);
+            }
+        }
+
+        should_process_image |= should_redo_frame;
+        if (!source_image) {
+            continue;
         }
-    }
 
-    fclose(input_image_file);
-    input_image_file = NULL;
+        const ips_filter_t *filter =
+            &Filters[current_filter_index];
+        ips_frame_t *frame =
+            coordinator->back_frame;
+        ips_dirty_tiles_t *changed_tiles;
 
-    if (input_image_file) {
-        fclose(input_image_file);
-        input_image_file = NULL;
-    }
+        Uint64 filter_start =
+            SDL_GetPerformanceCounter();
 
-    if (png_input_image_info) {
-        png_free_data(
-            png_input_image_struct,
-            png_input_image_info,
-            PNG_FREE_ALL,
-            -1
-        );
-    }
+        if (should_preview_visible_region) {
+            task_group->generation = generation;
+            task_group->requested_generation = &coordinator->requested_generation;
 
-    if (png_input_image_struct) {
-        png_destroy_read_struct(
-            &png_input_image_struct,
-            NULL, NULL
-        );
-    }
+            is_frame_complete =
+                ips_update_preview(
+                    coordinator, &preview, filter,
+                    latest_frame, &view,
+                    should_process_image, is_refinement
+                );
 
-    return result;
-}
+            task_group->requested_generation = NULL;
 
-ips_raw_image_t *ips_duplicate_image(ips_raw_image_t *image)
-{
-    ips_raw_image_t *duplicate = NULL;
+            should_redo_frame = !is_frame_complete;
+            should_refine =
+                preview.level > 0 ||
+                preview.filtered_tiles->number_of_dirty_tiles <
+                    (size_t) preview.filtered_tiles->columns * preview.filtered_tiles->rows;
+            if (!is_frame_complete || preview.tiles->number_of_dirty_tiles == 0) {
+                continue;
+            }
 
-    png_bytep data = NULL,
-              duplicate_data = NULL;
+            changed_tiles = preview.tiles;
+        } else {
+            if (!should_process_image && dirty_tiles->number_of_dirty_tiles == 0) {
+                continue;
+            }
 
-    png_bytepp duplicate_rows = NULL;
+            /* Filters with a reduction read by a later pass are always applied in full */
+            if (ips_prepare_frame(coordinator, frame, source_image) ||
+                    !latest_frame || !ips_can_update_dirty_tiles(filter)) {
+                should_process_image = 1;
+            }
 
-    png_uint_32 i, width, height;
-    unsigned int channels;
-    size_t image_size, image_row_size;
+            /* Only the filters can be cancelled, the loaded source images have to stay whole */
+            task_group->generation = generation;
+            task_group->requested_generation = &coordinator->requested_generation;
+
+            ips_reset_task_arena(task_group->task_arena);
+            if (should_process_image) {
+                if (planar_image) {
+                    is_frame_complete =
+                        ips_apply_filter(task_group, filter, planar_source_image, planar_image) &&
+                        ips_apply_filter(task_group, &Layout_Conversion_Filter, planar_image, frame->image);
+                } else {
+                    is_frame_complete =
+                        ips_apply_filter(task_group, filter, source_image, frame->image);
+                }
 
-    if (image) {
-        duplicate = (ips_raw_image_t *) malloc(sizeof(*image));
-        duplicate->data = NULL;
-        duplicate->rows = NULL;
-        duplicate->width  = 0;
-        duplicate->height = 0;
-        duplicate->channels = 3;
-
-        data = image->data;
-        if (data) {
-            width =
-                image->width;
-            height =
-                image->height;
-            channels =
-                image->channels;
-            image_row_size =
-                width * sizeof(*data) * channels;
-            image_size =
-                height * image_row_size;
-
-            duplicate_data = duplicate->data =
-                (png_bytep) malloc(image_size);
-            duplicate_rows = duplicate->rows =
-                (png_bytepp) malloc(height * sizeof(*duplicate_rows));
-
-            memcpy(duplicate_data, data, image_size);
-            for (i = 0; i < height; ++i) {
-                duplicate_rows[height - i - 1] =
-                    duplicate_data + i * image_row_size;
-            }
-
-            duplicate->width =
-                width;
-            duplicate->height =
-                height;
-            duplicate->channels =
-                channels;
-        }
-    }
+                ips_mark_dirty_rectangle(dirty_tiles, 0, 0, source_image->width, source_image->height);
+            } else {
+                /* The latest frame was made by the same filter, the stale tiles are taken from it */
+                ips_copy_image_tiles(latest_frame->image, frame->image, frame->stale_tiles);
+
+                if (planar_image) {
+                    is_frame_complete =
+                        ips_apply_filter_to_dirty_tiles(
+                            task_group, filter,
+                            planar_source_image, planar_image,
+                            dirty_tiles
+                        ) &&
+                        ips_apply_filter_to_dirty_tiles(
+                            task_group, &Layout_Conversion_Filter,
+                            planar_image, frame->image,
+                            dirty_tiles
+                        );
+                } else {
+                    is_frame_complete =
+                        ips_apply_filter_to_dirty_tiles(task_group, filter, source_image, frame->image, dirty_tiles);
+                }
+            }
 
-    return duplicate;
-}
+            task_group->requested_generation = NULL;
 
-void ips_delete_image(ips_raw_image_t *image)
-{
-    if (image) {
-        if (image->data) {
-            free(image->data);
-            image->data = NULL;
+            should_redo_frame = !is_frame_complete;
+            if (should_redo_frame) {
+                ips_clear_dirty_tiles(dirty_tiles);
+                continue;
+            }
+
+            changed_tiles = dirty_tiles;
         }
 
-        if (image->rows) {
-            free(image->rows);
-            image->rows = NULL;
+        /* The mip levels follow the tiles taken from the latest frame and the new ones */
+        ips_merge_dirty_tiles(frame->stale_tiles, changed_tiles);
+        ips_update_pyramid(task_group, frame->pyramid, frame->stale_tiles);
+
+        /* Whatever changed in this frame is stale in the other ones */
+        ips_clear_dirty_tiles(frame->stale_tiles);
+        ips_clear_dirty_tiles(frame->changed_tiles);
+        ips_merge_dirty_tiles(frame->changed_tiles, changed_tiles);
+        for (int i = 0; i < IPS_NUMBER_OF_FRAMES; ++i) {
+            if (&coordinator->frames[i] != frame && coordinator->frames[i].stale_tiles) {
+                ips_merge_dirty_tiles(coordinator->frames[i].stale_tiles, changed_tiles);
+            }
         }
+        ips_clear_dirty_tiles(changed_tiles);
 
-        free(image);
+        latest_frame =
+            ips_publish_frame(
+                coordinator,
+                (SDL_GetPerformanceCounter() - filter_start) * 1000.0 / SDL_GetPerformanceFrequency()
+            );
     }
-}
 
-GLuint ips_create_texture_from_image(ips_raw_image *image)
-{
-    GLuint texture = 0;
-    GLint format;
+    ips_delete_image(source_image);
+    source_image = NULL;
 
-    if (image) {
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        format = image->channels == 3 ? GL_RGB : GL_RGBA;
-        glTexImage2D(
-            GL_TEXTURE_2D, 0, format,
-            (GLsizei) image->width,
-            (GLsizei) image->height,
-            0, format, GL_UNSIGNED_BYTE,
-            (GLvoid *) image->data
-        );
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glBindTexture(GL_TEXTURE_2D, 0);
-    }
+    ips_delete_image(planar_source_image);
+    ips_delete_image(planar_image);
+    ips_delete_dirty_tiles(dirty_tiles);
+    SDL_free(source_image_path);
+    ips_delete_preview(&preview);
 
-    return texture;
+    return NULL;
 }
 
-void ips_update_texture_from_image(
-         GLuint texture,
-         ips_raw_image *image
-     )
+/*
+    Replaces the requested view. The tiles on screen are still needed after
+    a small move, so only refinement off screen is cancelled.
+*/
+void ips_request_view(ips_compute_coordinator_t *coordinator, const ips_view_t *view)
 {
-    GLint format;
-
-    if (texture && image) {
-        glBindTexture(GL_TEXTURE_2D, texture);
-        format = image->channels == 3 ? GL_RGB : GL_RGBA;
-        glTexSubImage2D(
-            GL_TEXTURE_2D, 0, 0, 0, image->width,
-            image->height,
-            format, GL_UNSIGNED_BYTE,
-            image->data
-        );
-        glBindTexture(GL_TEXTURE_2D, 0);
+    pthread_mutex_lock(&coordinator->mutex);
+    coordinator->view = *view;
+    coordinator->has_new_view = 1;
+    if (coordinator->is_refining) {
+        SDL_AtomicIncRef(&coordinator->requested_generation);
     }
+    pthread_cond_signal(&coordinator->request_available);
+    pthread_mutex_unlock(&coordinator->mutex);
 }
 
-void ips_delete_texture(GLuint texture)
+/*
+    Keeps the pyramid of the source the filters read up to date. A source
+    of the same size only has the levels below its changed tiles redone.
+*/
+void ips_update_preview_pyramid(
+         ips_task_group_t *group,
+         ips_preview_t *preview,
+         ips_raw_image_t *image,
+         const ips_dirty_tiles_t *changed_tiles
+     )
 {
-    glDeleteTextures(1, &texture);
+    ips_raw_image_t *previous_image =
+        preview->pyramid ? preview->pyramid->levels[0] : NULL;
+
+    if (previous_image &&
+            previous_image->width    == image->width  &&
+            previous_image->height   == image->height &&
+            previous_image->channels == image->channels) {
+        preview->pyramid->levels[0] = image;
+        ips_update_pyramid(group, preview->pyramid, changed_tiles);
+    } else {
+        ips_delete_pyramid(preview->pyramid);
+        preview->pyramid = ips_create_pyramid(image);
+        ips_build_pyramid(group, preview->pyramid);
+    }
 }
 
-void ips_update_model_matrix(ips_raw_image *image)
+/* Returns the smallest level that still has a pixel for every window pixel it covers. */
+unsigned int ips_select_preview_level(const ips_preview_t *preview, const ips_view_t *view)
 {
-    model_matrix =
-        glm::scale(1.0f, (float) image->height / image->width, 1.0f);
+    float window_pixels_across_image =
+        2.0f * view->pixels_per_unit;
+    unsigned int level = 0;
 
-    ips_update_matrices(
-            Initial_Window_Width,
-            Initial_Window_Height
-    );
+    while (level + 1 < preview->pyramid->number_of_levels &&
+               preview->pyramid->levels[level + 1]->width >= window_pixels_across_image) {
+        ++level;
+    }
+
+    return level;
 }
 
-void ips_update_matrices(
-         int window_width,
-         int window_height
-     )
+/* Marks the tiles of an image that fills the quad which the view shows. */
+void ips_mark_visible_tiles(ips_dirty_tiles_t *tiles, const ips_view_t *view)
 {
-    view_matrix =
-        glm::lookAt<float>(
-            glm::vec3(camera_x, camera_y, -1),
-            glm::vec3(camera_x, camera_y, 0),
-            glm::vec3(0, 1, 0)
-        );
-
-    float aspect_ration =
-        fabsf(
-            (float) window_width /
-                (float) window_height
-        );
-
-    projection_matrix =
-        glm::ortho<float>(
-            -(camera_zoom * aspect_ration), camera_zoom * aspect_ration,
-            -camera_zoom, camera_zoom,
-            0.1f, 100
+    float width =
+        (float) tiles->image_width;
+    float height =
+        (float) tiles->image_height;
+    float aspect_ratio =
+        height / width;
+
+    /* The quad is mirrored horizontally and the texture starts with the last row */
+    float x0 = (1.0f - view->x1) / 2.0f * width,
+          x1 = (1.0f - view->x0) / 2.0f * width,
+          y0 = (1.0f - view->y1 / aspect_ratio) / 2.0f * height,
+          y1 = (1.0f - view->y0 / aspect_ratio) / 2.0f * height;
+
+    x0 = IPS_CLAMP(floorf(x0), 0.0f, width);
+    y0 = IPS_CLAMP(floorf(y0), 0.0f, height);
+    x1 = IPS_CLAMP(ceilf(x1), 0.0f, width);
+    y1 = IPS_CLAMP(ceilf(y1), 0.0f, height);
+
+    if (x0 < x1 && y0 < y1) {
+        ips_mark_dirty_rectangle(
+            tiles,
+            (png_uint_32) x0, (png_uint_32) y0,
+            (png_uint_32) x1, (png_uint_32) y1
         );
-
-    model_view_projection_matrix =
-        projection_matrix * view_matrix * model_matrix;
+    }
 }
 
-void ips_render_quad(
-         GLuint shader_program,
-         GLuint vertex_array_object,
-         GLuint texture
+/* Marks up to a number of the tiles that are not filtered yet, row by row from the top. */
+void ips_mark_unfiltered_tiles(
+         ips_dirty_tiles_t *tiles,
+         const ips_dirty_tiles_t *filtered_tiles,
+         size_t maximum_number_of_tiles
      )
 {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    for (size_t i = 0;
+             i < (size_t) tiles->columns * tiles->rows &&
+                 tiles->number_of_dirty_tiles < maximum_number_of_tiles;
+             ++i) {
+        if (!filtered_tiles->flags[i]) {
+            ips_mark_dirty_tile(tiles, (png_uint_32) (i % tiles->columns), (png_uint_32) (i / tiles->columns));
+        }
+    }
+}
 
-    glUseProgram(shader_program);
-    glBindVertexArray(vertex_array_object);
+/*
+    One step of the preview into the back frame. A reset starts a level
+    over from the source with nothing filtered, e.g., after an edit. A
+    refinement step moves the view to the next finer level or, on the
+    source, filters a part of what the view does not need.
+    Leaves the tiles that changed in preview->tiles, none if there was
+    nothing to do. Returns 0 if the step was cancelled.
+*/
+int ips_update_preview(
+        ips_compute_coordinator_t *coordinator,
+        ips_preview_t *preview,
+        const ips_filter_t *filter,
+        ips_frame_t *latest_frame,
+        const ips_view_t *view,
+        int should_reset,
+        int is_refinement
+    )
+{
+    ips_frame_t *frame =
+        coordinator->back_frame;
+    unsigned int level =
+        is_refinement ?
+            (preview->level > 0 ? preview->level - 1 : 0) :
+            ips_select_preview_level(preview, view);
+    ips_raw_image_t *level_image;
+    int is_frame_complete;
+
+    if (!latest_frame || !preview->filtered_tiles) {
+        should_reset = 1;
+    }
 
-    if (texture && texture_sampler_uniform_location != -1) {
-        glActiveTexture(GL_TEXTURE0 + First_Texture_Unit);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glUniform1i(
-            texture_sampler_uniform_location,
-            First_Texture_Unit
-        );
+    /* A finer level stays while it has everything on screen, e.g., after zooming out */
+    if (!should_reset && level > preview->level) {
+        ips_dirty_tiles_t *visible_tiles =
+            ips_create_dirty_tiles(preview->filtered_tiles->image_width, preview->filtered_tiles->image_height);
+        ips_mark_visible_tiles(visible_tiles, view);
+        ips_merge_dirty_tiles(visible_tiles, preview->filtered_tiles);
+        if (visible_tiles->number_of_dirty_tiles == preview->filtered_tiles->number_of_dirty_tiles) {
+            level = preview->level;
+        }
+        ips_delete_dirty_tiles(visible_tiles);
     }
 
-    glUniformMatrix4fv(
-        mvp_matrix_uniform_location,
-        1, GL_FALSE,
-        glm::value_ptr(model_view_projection_matrix)
-    );
+    level_image =
+        preview->pyramid->levels[level];
+    if (ips_prepare_frame(coordinator, frame, level_image) || level != preview->level) {
+        should_reset = 1;
+    }
 
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    if (!preview->tiles ||
+            preview->tiles->image_width  != level_image->width ||
+            preview->tiles->image_height != level_image->height) {
+        ips_delete_dirty_tiles(preview->tiles);
+        preview->tiles = ips_create_dirty_tiles(level_image->width, level_image->height);
+    }
+    ips_clear_dirty_tiles(preview->tiles);
+
+    if (should_reset) {
+        ips_delete_dirty_tiles(preview->filtered_tiles);
+        preview->filtered_tiles =
+            ips_create_dirty_tiles(level_image->width, level_image->height);
+        preview->level = level;
+
+        if (level_image->layout == IPS_LAYOUT_PLANAR &&
+                (!preview->output_image ||
+                     preview->output_image->width  != level_image->width ||
+                     preview->output_image->height != level_image->height)) {
+            ips_delete_image(preview->output_image);
+            preview->output_image =
+                ips_duplicate_image(level_image);
+        }
+    }
 
-    SDL_GL_SwapWindow(program_window);
+    if (is_refinement && !should_reset) {
+        ips_mark_unfiltered_tiles(preview->tiles, preview->filtered_tiles, Preview_Refinement_Tiles);
+    } else {
+        /* Filters with a reduction read by a later pass need every tile of the level */
+        if (ips_can_update_dirty_tiles(filter)) {
+            ips_mark_visible_tiles(preview->tiles, view);
+        } else {
+            ips_mark_dirty_rectangle(preview->tiles, 0, 0, level_image->width, level_image->height);
+        }
 
-    ++frames;
-}
+        for (size_t i = 0; i < (size_t) preview->tiles->columns * preview->tiles->rows; ++i) {
+            if (preview->tiles->flags[i] && preview->filtered_tiles->flags[i]) {
+                preview->tiles->flags[i] = 0;
+                --preview->tiles->number_of_dirty_tiles;
+            }
+        }
+    }
 
-void ips_update_view_matrix()
-{
-    SDL_GetWindowSize(
-        program_window,
-        &current_window_width,
-        &current_window_height
-    );
+    if (!should_reset && preview->tiles->number_of_dirty_tiles == 0) {
+        return 1;
+    }
 
-    ips_update_matrices(
-        current_window_width,
-        current_window_height
-    );
+    ips_reset_task_arena(task_group->task_arena);
+    if (should_reset) {
+        /* Tiles that are not filtered yet show the source */
+        if (level_image->layout == IPS_LAYOUT_PLANAR) {
+            is_frame_complete =
+                ips_apply_filter(task_group, &Layout_Conversion_Filter, level_image, frame->image);
+        } else {
+            for (png_uint_32 y = 0; y < level_image->height; ++y) {
+                memcpy(frame->image->rows[y], level_image->rows[y], (size_t) level_image->width * level_image->channels);
+            }
+            is_frame_complete = 1;
+        }
+    } else {
+        ips_copy_image_tiles(latest_frame->image, frame->image, frame->stale_tiles);
+        is_frame_complete = 1;
+    }
 
-    glViewport(
-        0, 0,
-        (GLsizei) current_window_width,
-        (GLsizei) current_window_height
-    );
-}
+    if (level_image->layout == IPS_LAYOUT_PLANAR) {
+        is_frame_complete =
+            is_frame_complete &&
+            ips_apply_filter_to_tiles(task_group, filter, level_image, preview->output_image, preview->tiles) &&
+            ips_apply_filter_to_tiles(
+                task_group, &Layout_Conversion_Filter,
+                preview->output_image, frame->image,
+                preview->tiles
+            );
+    } else {
+        is_frame_complete =
+            is_frame_complete &&
+            ips_apply_filter_to_tiles(task_group, filter, level_image, frame->image, preview->tiles);
+    }
 
-void ips_measure_and_show_frame_rate()
-{
-    static char title[IPS_WINDOW_TITLE_LENGTH];
-    static const char *title_format = "%s: %d X %d at %.2f FPS";
+    if (!is_frame_complete) {
+        /* The next step takes the tiles from the latest frame again, a reset starts over */
+        ips_merge_dirty_tiles(frame->stale_tiles, preview->tiles);
+        ips_clear_dirty_tiles(preview->tiles);
 
-    unsigned int timer_tick =
-        SDL_GetTicks();
+        return 0;
+    }
 
-    float frame_rate =
-        1000.0f / (timer_tick - previous_timer_tick);
-    previous_timer_tick =
-        timer_tick;
+    ips_merge_dirty_tiles(preview->filtered_tiles, preview->tiles);
+    if (should_reset) {
+        ips_mark_dirty_rectangle(preview->tiles, 0, 0, level_image->width, level_image->height);
+    }
 
-    snprintf(
-        title,
-        IPS_WINDOW_TITLE_LENGTH,
-        title_format,
-        Window_Title,
-        current_window_width,
-        current_window_height,
-        frame_rate
-    );
+    return 1;
+}
 
-    SDL_SetWindowTitle(
-        program_window,
-        title
-    );
+void ips_delete_preview(ips_preview_t *preview)
+{
+    ips_delete_pyramid(preview->pyramid);
+    preview->pyramid = NULL;
+
+    ips_delete_dirty_tiles(preview->filtered_tiles);
+    preview->filtered_tiles = NULL;
+    ips_delete_dirty_tiles(preview->tiles);
+    preview->tiles = NULL;
+    ips_delete_image(preview->output_image);
+    preview->output_image = NULL;
 }
 
 void ips_start(char *dropped_file_path)
 {
     SDL_Event event;
-    float dt; int timer_tick, should_measure_and_show_frame_rate;
+    int should_measure_and_show_frame_rate;
 
-    ips_raw_image *image = NULL;
+    ips_compute_coordinator_t *coordinator;
+
+    /* Size of the texture, a frame of another size gets a new one */
+    png_uint_32 texture_width = 0,
+                texture_height = 0;
+    unsigned int texture_channels = 0;
 
     GLuint shader_program      = 0,
            texture             = 0,
@@ -1161,15 +8786,35 @@ void ips_start(char *dropped_file_path)
         ips_generate_quad_geometry();
 
     ips_create_image_processing_task_pool();
+    ips_create_compute_coordinator();
+    coordinator = compute_coordinator;
+    ips_update_view_matrix();
+
+    if (dropped_file_path) {
+        ips_request_image(coordinator, dropped_file_path);
+    }
 
+    /*
+        The render thread only handles events, uploads finished frames and
+        draws, so it keeps up with the display however long a filter runs.
+    */
     for (;;) {
-        while (SDL_PollEvent(&event)) {
+        ips_frame_t *frame;
+
+        /* Sleep in the event queue until there is something to do, finished frames send an event */
+        int has_event =
+            should_render_frame ?
+                SDL_PollEvent(&event) : SDL_WaitEvent(&event);
+
+        for (; has_event; has_event = SDL_PollEvent(&event)) {
             if (event.type == SDL_WINDOWEVENT) {
                 if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
                     ips_update_view_matrix();
+                } else if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                    should_render_frame = 1;
                 }
             } else if (event.type == SDL_DROPFILE) {
-                dropped_file_path = event.drop.file;
+                ips_request_image(coordinator, event.drop.file);
             } else if (event.type == SDL_KEYDOWN) {
                 switch (event.key.keysym.sym) {
                     case SDLK_LEFT:
@@ -1205,58 +8850,78 @@ void ips_start(char *dropped_file_path)
                         camera_zoom = Initial_Camera_Zoom;
                         ips_update_view_matrix();
                         break;
+                    case SDLK_l:
+                        ips_request_image(coordinator, NULL);
+                        break;
+                    case SDLK_f:
+                    case SDLK_LEFTBRACKET:
+                    case SDLK_RIGHTBRACKET:
+                    case SDLK_COMMA:
+                    case SDLK_PERIOD:
+                    case SDLK_9:
+                    case SDLK_0:
+                        ips_request_parameter_change(coordinator, event.key.keysym.sym);
+                        break;
                 }
             } else if (event.type == SDL_QUIT) {
                 ips_stop();
             }
         }
 
-        if (dropped_file_path) {
-            ips_raw_image *new_image;
-            if ((new_image = ips_load_image_from_png_file(dropped_file_path))) {
-                ips_delete_image(source_image);
-                source_image = new_image;
+        previous_timer_tick = SDL_GetTicks();
 
-                ips_delete_image(image);
-                image = ips_duplicate_image(source_image);
-                ips_update_model_matrix(image);
+        ips_serve_pixel_buffer_request(coordinator);
+
+        if ((frame = ips_acquire_frame(coordinator))) {
+            ips_raw_image_t *image =
+                frame->image;
+            Uint64 upload_start =
+                SDL_GetPerformanceCounter();
+            double upload_milliseconds;
+            int is_from_pixel_buffer = 0;
 
+            if (!texture ||
+                    image->width    != texture_width  ||
+                    image->height   != texture_height ||
+                    image->channels != texture_channels) {
                 ips_delete_texture(texture);
-                texture = ips_create_texture_from_image(image);
+                texture = ips_create_texture_from_pyramid(frame->pyramid);
+                texture_width    = image->width;
+                texture_height   = image->height;
+                texture_channels = image->channels;
+                ips_update_model_matrix(image);
+            } else if (frame->changed_tiles->number_of_dirty_tiles ==
+                           (size_t) frame->changed_tiles->columns * frame->changed_tiles->rows) {
+                /* The compute thread wrote the frame straight into its pixel buffer */
+                if (frame->pixel_buffer) {
+                    ips_update_texture_from_pixel_buffer(texture, frame);
+                    is_from_pixel_buffer = 1;
+                } else {
+                    ips_update_texture_from_image(texture, image);
+                }
+                ips_update_texture_mipmaps(texture, frame->pyramid, frame->changed_tiles);
+            } else {
+                ips_update_texture_from_dirty_tiles(texture, image, frame->changed_tiles);
+                ips_update_texture_mipmaps(texture, frame->pyramid, frame->changed_tiles);
+            }
+            ips_clear_dirty_tiles(frame->changed_tiles);
+
+            /* Both paths are reported, only whole frames can come from a pixel buffer */
+            upload_milliseconds =
+                (SDL_GetPerformanceCounter() - upload_start) * 1000.0 / SDL_GetPerformanceFrequency();
+            if (is_from_pixel_buffer) {
+                pixel_buffer_upload_milliseconds =
+                    upload_milliseconds;
+            } else {
+                client_upload_milliseconds =
+                    upload_milliseconds;
             }
 
-            SDL_free(dropped_file_path);
-            dropped_file_path = NULL;
+            should_render_frame = 1;
         }
 
-        timer_tick = SDL_GetTicks();
-        dt = (timer_tick - previous_timer_tick) / 1000.0f;
-        previous_timer_tick = timer_tick;
-
-        if (source_image && image) {
-            reset_pass_data();
-
-            // Sobel
-            //
-            // ips_update_image(source_image, image, NULL, ips_apply_sobel, 1, dt);
-            // ...ips_update_image(source_image, image, NULL, ips_apply_sobel, 2, dt);
-
-            static const float brightness_contrast[2] = {
-                100.0f, 2.0f
-            };
-            static const unsigned int pass = 1;
-
-            ips_update_image(
-                source_image, image,
-                (void *) brightness_contrast,
-                ips_set_brightness_and_contrast,
-                pass, dt
-            );
-
-            // TODO: remove before enabling threading
-            ips_thread_process_image_part(pool);
-
-            ips_update_texture_from_image(texture, image);
+        if (!should_render_frame) {
+            continue;
         }
 
         ips_render_quad(
@@ -1264,6 +8929,7 @@ void ips_start(char *dropped_file_path)
             vertex_array_object,
             texture
         );
+        should_render_frame = 0;
 
         should_measure_and_show_frame_rate = frames % 240 == 0;
         if (should_measure_and_show_frame_rate) {
@@ -1271,11 +8937,7 @@ void ips_start(char *dropped_file_path)
         }
     }
 
-    ips_delete_image(source_image);
-    source_image = NULL;
-
-    ips_delete_image(image);
-    image = NULL;
+    ips_delete_compute_coordinator();
 
     ips_delete_texture(texture);
     texture = 0;
@@ -1283,6 +8945,9 @@ void ips_start(char *dropped_file_path)
 
 void ips_stop()
 {
+    ips_delete_compute_coordinator();
+    ips_delete_image_processing_task_pool();
+
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(program_window);
     SDL_EnableScreenSaver();
@@ -1298,25 +8963,165 @@ void ips_stop()
 int main(int argc, char *argv[])
 {
     char *image_file_path = NULL; size_t length = 0;
-    if (argc > 1) {
-        length = strlen(argv[1]);
-        image_file_path =
-            (char *) SDL_malloc(
-                         sizeof(*image_file_path) * (length + 1)
-                     );
-        strncpy(image_file_path, argv[1], length);
-        image_file_path[length] = '\0';
+    char *output_image_file_path = NULL;
+    int should_run_benchmark = 0, should_run_batch = 0, should_stress_queue = 0, status = EXIT_SUCCESS;
+
+    const ips_filter_t *batch_filters[IPS_MAXIMUM_BATCH_FILTERS];
+    size_t number_of_batch_filters = 0;
+    char *batch_file_list_path = NULL;
+
+    ips_detect_simd_level();
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--benchmark") == 0) {
+            should_run_benchmark = 1;
+        } else if (strcmp(argv[i], "--stress-queue") == 0) {
+            should_stress_queue = 1;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            should_run_batch = 1;
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            const ips_filter_t *filter = ips_find_filter(argv[++i]);
+            if (!filter) {
+                fprintf(stderr, "Unknown filter '%s', available filters:", argv[i]);
+                for (size_t j = 0; j < Number_Of_Filters; ++j) {
+                    fprintf(stderr, " %s", Filters[j].name);
+                }
+                fprintf(stderr, "\n");
+
+                return EXIT_FAILURE;
+            }
+            if (number_of_batch_filters == IPS_MAXIMUM_BATCH_FILTERS) {
+                fprintf(stderr, "At most %d filters can be chained\n", IPS_MAXIMUM_BATCH_FILTERS);
+
+                return EXIT_FAILURE;
+            }
+            batch_filters[number_of_batch_filters++] = filter;
+        } else if (strcmp(argv[i], "--file-list") == 0 && i + 1 < argc) {
+            batch_file_list_path = argv[++i];
+        } else if ((strcmp(argv[i], "--decode-jobs") == 0 ||
+                        strcmp(argv[i], "--filter-jobs") == 0 ||
+                        strcmp(argv[i], "--encode-jobs") == 0 ||
+                        strcmp(argv[i], "--queue-size") == 0) && i + 1 < argc) {
+            int value = atoi(argv[i + 1]);
+            if (value < 1) {
+                fprintf(stderr, "%s should be at least 1\n", argv[i]);
+
+                return EXIT_FAILURE;
+            }
+
+            if (strcmp(argv[i], "--decode-jobs") == 0) {
+                batch_stage_jobs[IPS_BATCH_STAGE_DECODE] = value;
+            } else if (strcmp(argv[i], "--filter-jobs") == 0) {
+                batch_stage_jobs[IPS_BATCH_STAGE_FILTER] = value;
+            } else if (strcmp(argv[i], "--encode-jobs") == 0) {
+                batch_stage_jobs[IPS_BATCH_STAGE_ENCODE] = value;
+            } else {
+                batch_queue_capacity = value;
+            }
+            ++i;
+        } else if (strcmp(argv[i], "--tile-size") == 0 && i + 1 < argc) {
+            if (!ips_parse_tile_size(argv[++i])) {
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--median-radius") == 0 && i + 1 < argc) {
+            int radius = atoi(argv[++i]);
+            if (radius < 1 || radius > IPS_MAXIMUM_MEDIAN_RADIUS) {
+                fprintf(stderr, "The median radius should be in [1, %d]\n", IPS_MAXIMUM_MEDIAN_RADIUS);
+
+                return EXIT_FAILURE;
+            }
+            median_parameters.radius = (unsigned int) radius;
+        } else if (strcmp(argv[i], "--compression-level") == 0 && i + 1 < argc) {
+            png_compression_level = atoi(argv[++i]);
+            if (png_compression_level < 0 || png_compression_level > 9) {
+                fprintf(stderr, "The compression level should be in [0, 9]\n");
+
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--no-mmap") == 0) {
+            should_map_input_files = 0;
+        } else if (strcmp(argv[i], "--planar") == 0) {
+            should_use_planar_layout = 1;
+        } else if (strcmp(argv[i], "--preview") == 0) {
+            should_preview_visible_region = 1;
+        } else if (strcmp(argv[i], "--no-pixel-buffers") == 0) {
+            should_use_pixel_buffers = 0;
+        } else if (strcmp(argv[i], "--sobel-direction") == 0) {
+            sobel_parameters.should_compute_direction = 1;
+        } else if (strcmp(argv[i], "--no-simd") == 0) {
+            simd_level = IPS_SIMD_NONE;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            number_of_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scheduler") == 0 && i + 1 < argc) {
+            if (!ips_parse_scheduler(argv[++i])) {
+                return EXIT_FAILURE;
+            }
+        } else if (!image_file_path) {
+            length = strlen(argv[i]);
+            image_file_path =
+                (char *) SDL_malloc(
+                             sizeof(*image_file_path) * (length + 1)
+                         );
+            strncpy(image_file_path, argv[i], length);
+            image_file_path[length] = '\0';
+        } else if (!output_image_file_path) {
+            output_image_file_path = argv[i];
+        }
+    }
+
+    if (should_run_batch &&
+            (!image_file_path || number_of_batch_filters == 0 ||
+                (!output_image_file_path && !batch_file_list_path))) {
+        fprintf(
+            stderr,
+            "Usage: %s --batch --filter <name> [--filter <name> ...] <input.png> <output.png>\n"
+            "       %s --batch --filter <name> [--filter <name> ...] <input directory> <output directory>\n"
+            "       %s --batch --filter <name> [--filter <name> ...] --file-list <list.txt> <output directory>\n",
+            argv[0], argv[0], argv[0]
+        );
+        SDL_free(image_file_path);
+
+        return EXIT_FAILURE;
     }
 
 #if defined _WIN32 && defined PTW32_STATIC_LIB
     pthread_win32_process_attach_np();
 #endif
 
-    ips_start(image_file_path);
+    if (should_run_batch && batch_file_list_path) {
+        status =
+            ips_run_batch_on_directory(
+                batch_file_list_path, 1, image_file_path,
+                batch_filters, number_of_batch_filters
+            );
+        SDL_free(image_file_path);
+    } else if (should_run_batch && ips_utils_is_directory(image_file_path)) {
+        status =
+            ips_run_batch_on_directory(
+                image_file_path, 0, output_image_file_path,
+                batch_filters, number_of_batch_filters
+            );
+        SDL_free(image_file_path);
+    } else if (should_run_batch) {
+        status =
+            ips_run_batch(
+                image_file_path, output_image_file_path,
+                batch_filters, number_of_batch_filters
+            );
+        SDL_free(image_file_path);
+    } else if (should_run_benchmark) {
+        status = ips_run_benchmark(image_file_path);
+        SDL_free(image_file_path);
+    } else if (should_stress_queue) {
+        status = ips_run_queue_stress_test();
+        SDL_free(image_file_path);
+    } else {
+        ips_start(image_file_path);
+    }
 
 #if defined _WIN32 && defined PTW32_STATIC_LIB
     pthread_win32_process_detach_np();
 #endif
 
-    return 0;
+    return status;
 }
@@ -15,8 +15,26 @@
     #include <unistd.h>
 #endif
 
+#ifndef _WIN32
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <dirent.h>
+#endif
+
+#if defined _MSC_VER
+    #include <intrin.h>
+#endif
+
+#ifdef _WIN32
+    #include <malloc.h>
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #pragma mark - System Information
 
@@ -57,6 +75,70 @@ int ips_utils_get_number_of_cpu_cores()
     return result;
 }
 
+int ips_utils_cpu_has_ssse3()
+{
+    int result = 0;
+
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+    __builtin_cpu_init();
+    result = __builtin_cpu_supports("ssse3");
+#elif defined _MSC_VER && (defined _M_X64 || defined _M_IX86)
+    int info[4];
+
+    __cpuid(info, 1);
+    result = (info[2] & (1 << 9)) != 0;
+#endif
+
+    return result;
+}
+
+int ips_utils_cpu_has_avx2()
+{
+    int result = 0;
+
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+    __builtin_cpu_init();
+    result = __builtin_cpu_supports("avx2");
+#elif defined _MSC_VER && (defined _M_X64 || defined _M_IX86)
+    int info[4];
+
+    __cpuid(info, 0);
+    if (info[0] >= 7) {
+        __cpuidex(info, 7, 0);
+        result = (info[1] & (1 << 5)) != 0;
+    }
+#endif
+
+    return result;
+}
+
+#pragma mark - Memory
+
+/* Alignment has to be a power of two. Free the result with ips_utils_aligned_free. */
+void *ips_utils_aligned_malloc(size_t size, size_t alignment)
+{
+    void *data = NULL;
+
+#ifdef _WIN32
+    data = _aligned_malloc(size, alignment);
+#else
+    if (posix_memalign(&data, alignment, size) != 0) {
+        data = NULL;
+    }
+#endif
+
+    return data;
+}
+
+void ips_utils_aligned_free(void *data)
+{
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
 #pragma mark - File I/O
 
 char* ips_utils_read_text_file(const char *path)
@@ -81,3 +163,207 @@ char* ips_utils_read_text_file(const char *path)
 
     return text;
 }
+
+void *ips_utils_map_file(const char *path, size_t *size)
+{
+    void *data = NULL;
+
+#ifdef _WIN32
+    HANDLE file, mapping;
+    LARGE_INTEGER file_size;
+
+    file =
+        CreateFileA(
+            path, GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL
+        );
+    if (file != INVALID_HANDLE_VALUE) {
+        if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+            mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping) {
+                data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if (data) {
+                    *size = (size_t) file_size.QuadPart;
+                }
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+    }
+#else
+    struct stat file_status;
+
+    int file = open(path, O_RDONLY);
+    if (file >= 0) {
+        if (fstat(file, &file_status) == 0 && file_status.st_size > 0) {
+            data = mmap(NULL, (size_t) file_status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+            if (data == MAP_FAILED) {
+                data = NULL;
+            } else {
+                *size = (size_t) file_status.st_size;
+
+                /* The decoder reads front to back, let the kernel read ahead aggressively */
+                madvise(data, *size, MADV_SEQUENTIAL);
+                madvise(data, *size, MADV_WILLNEED);
+            }
+        }
+        close(file);
+    }
+#endif
+
+    return data;
+}
+
+void ips_utils_unmap_file(void *data, size_t size)
+{
+    if (data) {
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap(data, size);
+#endif
+    }
+}
+
+/* Evicts the file from the page cache. Returns 0 if it is not supported. */
+int ips_utils_drop_file_from_cache(const char *path)
+{
+    int result = 0;
+
+#if !defined _WIN32 && defined POSIX_FADV_DONTNEED
+    int file = open(path, O_RDONLY);
+    if (file >= 0) {
+        result = posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED) == 0;
+        close(file);
+    }
+#endif
+
+    return result;
+}
+
+int ips_utils_is_directory(const char *path)
+{
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(path);
+
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat file_status;
+
+    return stat(path, &file_status) == 0 && S_ISDIR(file_status.st_mode);
+#endif
+}
+
+/* Returns 1 if the directory was created or already exists. */
+int ips_utils_make_directory(const char *path)
+{
+    if (ips_utils_is_directory(path)) {
+        return 1;
+    }
+
+#ifdef _WIN32
+    return CreateDirectoryA(path, NULL) != 0;
+#else
+    return mkdir(path, 0777) == 0;
+#endif
+}
+
+static int ips_utils_compare_strings(const void *first, const void *second)
+{
+    return strcmp(*(const char **) first, *(const char **) second);
+}
+
+/*
+    Names of the regular files in a directory in lexicographic order, or
+    NULL if it can not be read. Free the result with ips_utils_free_list.
+*/
+char **ips_utils_list_directory(const char *path, size_t *number_of_entries)
+{
+    char **entries = NULL, **new_entries;
+    size_t capacity = 0, size = 0;
+
+    const char *name;
+
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE directory;
+
+    char *pattern = (char *) malloc(strlen(path) + 3);
+    sprintf(pattern, "%s\\*", path);
+    directory = FindFirstFileA(pattern, &entry);
+    free(pattern);
+    if (directory == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+
+    do {
+        if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            continue;
+        }
+        name = entry.cFileName;
+#else
+    struct dirent *entry;
+    struct stat file_status;
+    char *entry_path;
+
+    DIR *directory = opendir(path);
+    if (!directory) {
+        return NULL;
+    }
+
+    while ((entry = readdir(directory))) {
+        int is_regular_file;
+
+        name = entry->d_name;
+
+        entry_path = (char *) malloc(strlen(path) + strlen(name) + 2);
+        sprintf(entry_path, "%s/%s", path, name);
+        is_regular_file =
+            stat(entry_path, &file_status) == 0 && S_ISREG(file_status.st_mode);
+        free(entry_path);
+
+        if (!is_regular_file) {
+            continue;
+        }
+#endif
+
+        if (size == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            new_entries = (char **) realloc(entries, sizeof(*entries) * capacity);
+            if (!new_entries) {
+                break;
+            }
+            entries = new_entries;
+        }
+
+        entries[size] = (char *) malloc(strlen(name) + 1);
+        strcpy(entries[size++], name);
+#ifdef _WIN32
+    } while (FindNextFileA(directory, &entry));
+
+    FindClose(directory);
+#else
+    }
+
+    closedir(directory);
+#endif
+
+    if (size > 0) {
+        qsort(entries, size, sizeof(*entries), ips_utils_compare_strings);
+    } else if (!entries) {
+        entries = (char **) malloc(sizeof(*entries));
+    }
+    *number_of_entries = size;
+
+    return entries;
+}
+
+void ips_utils_free_list(char **list, size_t size)
+{
+    if (list) {
+        for (size_t i = 0; i < size; ++i) {
+            free(list[i]);
+        }
+        free(list);
+    }
+}
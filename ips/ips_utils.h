@@ -7,6 +7,8 @@
 #ifndef IPS_UTILS_H
 #define IPS_UTILS_H
 
+#include <stddef.h>
+
 #pragma mark - Common Macros
 
 #define IPS_MIN(A,B) (((A)<(B))?(A):(B))
@@ -17,9 +19,25 @@
 #pragma mark - System Information
 
 int ips_utils_get_number_of_cpu_cores();
+int ips_utils_cpu_has_ssse3();
+int ips_utils_cpu_has_avx2();
+
+#pragma mark - Memory
+
+void *ips_utils_aligned_malloc(size_t size, size_t alignment);
+void ips_utils_aligned_free(void *data);
 
 #pragma mark - File I/O
 
 char* ips_utils_read_text_file(const char *path);
 
+void *ips_utils_map_file(const char *path, size_t *size);
+void ips_utils_unmap_file(void *data, size_t size);
+int ips_utils_drop_file_from_cache(const char *path);
+
+int ips_utils_is_directory(const char *path);
+int ips_utils_make_directory(const char *path);
+char **ips_utils_list_directory(const char *path, size_t *number_of_entries);
+void ips_utils_free_list(char **list, size_t size);
+
 #endif